@@ -16,7 +16,6 @@
 #endif
 #ifdef _WIN32
 #include <Windows.h>
-#include <filesystem>
 #include "SDL_syswm.h"
 #include "NESDL_WinMenu.h"
 #endif
@@ -30,8 +29,23 @@
 #include <thread>
 #include <random>
 #include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <array>
 
 #include "NESDL_Constants.h"
+#include "NESDL_Profiler.h"
+#include "NESDL_Trace.h"
+#include "NESDL_MappedFile.h"
+#include "NESDL_BatteryRAM.h"
+#include "NESDL_SaveState.h"
+#include "NESDL_Movie.h"
+#include "NESDL_Divergence.h"
+#include "NESDL_CPUTrace.h"
 #include "NESDL_Config.h"
 #include "NESDL_Input.h"
 
@@ -41,9 +55,12 @@
 #include "mappers/NESDL_Mapper.h"
 #endif
 
+#include "NESDL_HotSpots.h"
 #include "NESDL_CPU.h"
 #include "NESDL_PPU.h"
 #include "NESDL_RAM.h"
 #include "NESDL_SDL.h"
 #include "NESDL_APU.h"
+#include "NESDL_FlightRecorder.h"
 #include "NESDL_Core.h"
+#include "NESDL_ROMLibrary.h"
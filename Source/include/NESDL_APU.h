@@ -19,6 +19,17 @@ struct APUSquare
     uint16_t    timer;          // 0x4002/3/6/7
     uint8_t     length;
 };
+NESDL_STATE_MEMBERS(APUSquare,
+    NESDL_STATE_MEMBER(APUSquare, volume),
+    NESDL_STATE_MEMBER(APUSquare, constant),
+    NESDL_STATE_MEMBER(APUSquare, haltLoop),
+    NESDL_STATE_MEMBER(APUSquare, duty),
+    NESDL_STATE_MEMBER(APUSquare, sweepShift),
+    NESDL_STATE_MEMBER(APUSquare, sweepNegate),
+    NESDL_STATE_MEMBER(APUSquare, sweepPeriod),
+    NESDL_STATE_MEMBER(APUSquare, sweepEnabled),
+    NESDL_STATE_MEMBER(APUSquare, timer),
+    NESDL_STATE_MEMBER(APUSquare, length))
 
 struct APUTriangle
 {
@@ -28,6 +39,11 @@ struct APUTriangle
     uint16_t    timer;          // 0x400A/B
     uint8_t     length;
 };
+NESDL_STATE_MEMBERS(APUTriangle,
+    NESDL_STATE_MEMBER(APUTriangle, reload),
+    NESDL_STATE_MEMBER(APUTriangle, haltLoop),
+    NESDL_STATE_MEMBER(APUTriangle, timer),
+    NESDL_STATE_MEMBER(APUTriangle, length))
 
 struct APUNoise
 {
@@ -39,6 +55,13 @@ struct APUNoise
     bool        mode;
     uint8_t     length;         // 0x400F
 };
+NESDL_STATE_MEMBERS(APUNoise,
+    NESDL_STATE_MEMBER(APUNoise, volume),
+    NESDL_STATE_MEMBER(APUNoise, constant),
+    NESDL_STATE_MEMBER(APUNoise, haltLoop),
+    NESDL_STATE_MEMBER(APUNoise, period),
+    NESDL_STATE_MEMBER(APUNoise, mode),
+    NESDL_STATE_MEMBER(APUNoise, length))
 
 struct APUDMC
 {
@@ -50,6 +73,13 @@ struct APUDMC
     uint16_t    sampleAddr;     // 0x4012
     uint16_t    sampleLength;   // 0x4013
 };
+NESDL_STATE_MEMBERS(APUDMC,
+    NESDL_STATE_MEMBER(APUDMC, rate),
+    NESDL_STATE_MEMBER(APUDMC, loop),
+    NESDL_STATE_MEMBER(APUDMC, irqEnabled),
+    NESDL_STATE_MEMBER(APUDMC, directLoad),
+    NESDL_STATE_MEMBER(APUDMC, sampleAddr),
+    NESDL_STATE_MEMBER(APUDMC, sampleLength))
 
 struct APUStatus
 {
@@ -62,6 +92,14 @@ struct APUStatus
     bool        frameInterrupt;
     bool        dmcInterrupt;
 };
+NESDL_STATE_MEMBERS(APUStatus,
+    NESDL_STATE_MEMBER(APUStatus, square1Enable),
+    NESDL_STATE_MEMBER(APUStatus, square2Enable),
+    NESDL_STATE_MEMBER(APUStatus, triEnable),
+    NESDL_STATE_MEMBER(APUStatus, noiseEnable),
+    NESDL_STATE_MEMBER(APUStatus, dmcEnable),
+    NESDL_STATE_MEMBER(APUStatus, frameInterrupt),
+    NESDL_STATE_MEMBER(APUStatus, dmcInterrupt))
 
 struct APUEnvelope
 {
@@ -69,6 +107,10 @@ struct APUEnvelope
     uint8_t decay;
     uint8_t divider;
 };
+NESDL_STATE_MEMBERS(APUEnvelope,
+    NESDL_STATE_MEMBER(APUEnvelope, start),
+    NESDL_STATE_MEMBER(APUEnvelope, decay),
+    NESDL_STATE_MEMBER(APUEnvelope, divider))
 
 // struct APUGenerator
 // {
@@ -80,6 +122,9 @@ struct APUSequencer
     bool        disableIRQ;
     uint8_t     steps;
 };
+NESDL_STATE_MEMBERS(APUSequencer,
+    NESDL_STATE_MEMBER(APUSequencer, disableIRQ),
+    NESDL_STATE_MEMBER(APUSequencer, steps))
 
 struct APUCounters
 {
@@ -128,12 +173,48 @@ struct APUCounters
     uint32_t    sequencerPPUCounter;
     uint32_t    sequencerNextFrameCycles;
 };
+NESDL_STATE_MEMBERS(APUCounters,
+    NESDL_STATE_MEMBER(APUCounters, square1Length),
+    NESDL_STATE_MEMBER(APUCounters, square1CurrentTimer),
+    NESDL_STATE_MEMBER(APUCounters, square1TargetTimer),
+    NESDL_STATE_MEMBER(APUCounters, square1WaveTimer),
+    NESDL_STATE_MEMBER(APUCounters, square1WaveIndex),
+    NESDL_STATE_MEMBER(APUCounters, square1SweepTimer),
+    NESDL_STATE_MEMBER(APUCounters, square1SweepReload),
+    NESDL_STATE_MEMBER(APUCounters, square2Length),
+    NESDL_STATE_MEMBER(APUCounters, square2CurrentTimer),
+    NESDL_STATE_MEMBER(APUCounters, square2TargetTimer),
+    NESDL_STATE_MEMBER(APUCounters, square2WaveTimer),
+    NESDL_STATE_MEMBER(APUCounters, square2WaveIndex),
+    NESDL_STATE_MEMBER(APUCounters, square2SweepTimer),
+    NESDL_STATE_MEMBER(APUCounters, square2SweepReload),
+    NESDL_STATE_MEMBER(APUCounters, triLength),
+    NESDL_STATE_MEMBER(APUCounters, triWaveTimer),
+    NESDL_STATE_MEMBER(APUCounters, triWaveIndex),
+    NESDL_STATE_MEMBER(APUCounters, triLinearCounter),
+    NESDL_STATE_MEMBER(APUCounters, triLinearCounterReload),
+    NESDL_STATE_MEMBER(APUCounters, noiseLength),
+    NESDL_STATE_MEMBER(APUCounters, noiseTimer),
+    NESDL_STATE_MEMBER(APUCounters, noiseTimerPeriod),
+    NESDL_STATE_MEMBER(APUCounters, noiseLFSR),
+    NESDL_STATE_MEMBER(APUCounters, dmcTimer),
+    NESDL_STATE_MEMBER(APUCounters, dmcSampleBuffer),
+    NESDL_STATE_MEMBER(APUCounters, dmcBufferBitsRemaining),
+    NESDL_STATE_MEMBER(APUCounters, dmcAddr),
+    NESDL_STATE_MEMBER(APUCounters, dmcBytesLeft),
+    NESDL_STATE_MEMBER(APUCounters, dmcIsSilent),
+    NESDL_STATE_MEMBER(APUCounters, dmcOutputSample),
+    NESDL_STATE_MEMBER(APUCounters, sequencerIndex),
+    NESDL_STATE_MEMBER(APUCounters, sequencerPPUCounter),
+    NESDL_STATE_MEMBER(APUCounters, sequencerNextFrameCycles))
 
 class NESDL_APU
 {
 public:
     void Init(NESDL_Core* c, NESDL_SDL* s);
     void Reset();
+    void SaveState(NESDL_StateWriter& state);
+    void LoadState(NESDL_StateReader& state);
     void Update(uint32_t ppuCycles);
     uint8_t ReadByte(uint16_t addr);
     void WriteByte(uint16_t addr, uint8_t data);
@@ -150,6 +231,7 @@ private:
     
     // Frame counters, audio timers
     uint64_t ppuElapsedCycles;
+    uint8_t ppuCyclePhase; // ppuElapsedCycles mod 6, kept as a wrapping counter (CPU = 0/3, APU = 3)
     double cpuClocksPerSample = (double)1789773 / (double)APU_SAMPLE_RATE;
     double cpuClockSampleTimer;
     
@@ -0,0 +1,45 @@
+#pragma once
+
+// Battery-backed cartridge RAM, kept in a .sav file that's memory-mapped read/write so the mapper
+// reads and writes it directly. The emulation thread only ever marks pages dirty - a background
+// thread pushes dirty pages out to disk every NESDL_BATTERY_FLUSH_MS, and once more on Close()
+
+// Granularity of dirty tracking. Flushes get rounded out to the OS page size
+#define NESDL_BATTERY_PAGE_SIZE 0x400
+// One bit of dirtyPages per page, so this is as big as a save file can get
+#define NESDL_BATTERY_MAX_SIZE  (NESDL_BATTERY_PAGE_SIZE * 32)
+#define NESDL_BATTERY_FLUSH_MS  2000
+
+class NESDL_BatteryRAM
+{
+public:
+    NESDL_BatteryRAM();
+    ~NESDL_BatteryRAM();
+    bool Open(const char* path, uint32_t size); // Creates the file (zero-filled) if it doesn't exist
+    void Close();
+    bool IsOpen() { return data != nullptr; }
+    uint8_t* GetData() { return data; }
+    // Call after the write has landed, so a flush that picks up the bit also sees the data
+    void MarkDirty(uint32_t offset)
+    {
+        dirtyPages.fetch_or(1u << (offset / NESDL_BATTERY_PAGE_SIZE), memory_order_release);
+    }
+private:
+    void FlushThread();
+    void Flush();
+
+    uint8_t* data;
+    uint32_t size;
+    atomic<uint32_t> dirtyPages;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+
+    thread flushThread;
+    mutex flushMutex;
+    condition_variable flushSignal;
+    bool stopRequested;
+};
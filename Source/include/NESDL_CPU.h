@@ -9,6 +9,13 @@ struct CPURegisters
 	uint8_t y; // Index Y
 	uint8_t p; // Processor (status)
 };
+NESDL_STATE_MEMBERS(CPURegisters,
+    NESDL_STATE_MEMBER(CPURegisters, pc),
+    NESDL_STATE_MEMBER(CPURegisters, sp),
+    NESDL_STATE_MEMBER(CPURegisters, a),
+    NESDL_STATE_MEMBER(CPURegisters, x),
+    NESDL_STATE_MEMBER(CPURegisters, y),
+    NESDL_STATE_MEMBER(CPURegisters, p))
 
 // Bit masks for accessing the CPU processor status
 #define PSTATUS_CARRY 0x1
@@ -22,6 +29,25 @@ struct CPURegisters
 
 #define STACK_PTR 0x0100
 
+// N, Z, C and V as the CPU keeps them - the values they come from, rather than bits in P. registers.p
+// only has them once something that reads P asks for it (see NESDL_CPU::StoreLazyFlags)
+struct CPUFlags
+{
+    uint8_t n; // Bit 7 is N
+    uint8_t z; // Z is set when this is 0
+    uint8_t c; // 0 or 1
+    uint8_t v; // Bit 6 is V
+    uint8_t Apply(uint8_t p) const
+    {
+        return (p & ~(PSTATUS_NEGATIVE | PSTATUS_ZERO | PSTATUS_CARRY | PSTATUS_OVERFLOW)) |
+            (n & PSTATUS_NEGATIVE) | (z == 0 ? PSTATUS_ZERO : 0) | c | (v & PSTATUS_OVERFLOW);
+    }
+};
+
+// Longest loop (in instructions, and bytes back from the branch) considered for idle loop skipping
+#define CPU_IDLE_LOOP_MAX_INSTRUCTIONS 8
+#define CPU_IDLE_LOOP_MAX_BYTES 32
+
 #define ADDR_NMI 0xFFFA
 #define ADDR_RESET 0xFFFC
 #define ADDR_IRQ 0xFFFE
@@ -61,6 +87,30 @@ struct AddressModeResult
     uint8_t value;
 };
 
+// Superinstructions - instruction pairs that make up most of the time spent in typical NES code
+// (LDA $2002/BPL vblank waits, DEX/BNE and INY/CPY/BNE counters, LDA/STA copies and VRAM uploads).
+// The pair is spotted when the first instruction is decoded, and once it has run the second one's
+// timing is worked out straight from its bytes instead of dry-running it. Each half still runs as
+// its own instruction, so interrupts between the two are handled exactly as before
+enum CPUFusion : uint8_t
+{
+    FUSION_NONE,
+    FUSION_BRANCH,  // LDA/LDX/LDY/BIT, INX/INY/DEX/DEY or CMP/CPX/CPY followed by a branch
+    FUSION_COMPARE, // INX/INY/DEX/DEY followed by CMP/CPX/CPY immediate
+    FUSION_STORE    // LDA followed by STA zero page/absolute/absolute,X/absolute,Y
+};
+
+// An instruction's bytes as they were when it was first fetched from a given PC.
+// Only valid while tag matches the CPU's decodeGeneration
+struct CPUDecodedInstruction
+{
+    uint32_t tag;
+    uint8_t opcode;
+    uint8_t operand0;
+    uint8_t operand1;
+    CPUFusion fusion; // Superinstruction this forms with the instruction after it (if any)
+};
+
 struct DebugCPUState
 {
     uint64_t elapsedCycles;
@@ -216,13 +266,26 @@ class NESDL_CPU
 public:
     void Init(NESDL_Core* c);
     void Reset(bool hardReset);
+    void SaveState(NESDL_StateWriter& state);
+    void LoadState(NESDL_StateReader& state);
+    // Needs RAM and the mapper in place, so it's called after the whole state is loaded
+    void PrimeNextInstruction();
     void Update(uint32_t ppuCycles);
     void DidMapperWrite();
     bool IsConsecutiveMapperWrite();
     void HaltCPUForDMC(bool isReload);
+    void InvalidateDecodedCode(uint16_t addr);
+    void InvalidateAllDecodedCode();
+    // Off runs the plain interpreter (no idle loop skipping, decode cache or superinstructions). Binary CPU
+    // traces of the same ROM with and without them should be identical - NESDL_TraceTool diff finds where not
+    void SetFastPaths(bool enabled);
+    // Brings N/Z/C/V in registers.p up to date - for anything outside the CPU about to read P
+    void StoreLazyFlags();
 
     void DebugBindNintendulator(const char* path);
     void DebugUnbindNintendulator();
+    bool DebugStartTrace(const char* path);
+    void DebugStopTrace();
 
     uint64_t elapsedCycles;
     CPURegisters registers;
@@ -235,13 +298,25 @@ public:
     bool nextInstructionReady;
 
     bool ignoreChanges;
+    bool fastPaths;
 private:
     void RunNextInstruction();
+    const CPUDecodedInstruction* GetDecodedInstruction(uint16_t pc);
+    uint8_t FetchOperandByte();
+    uint16_t FetchOperandWord();
+    CPUFusion GetFusion(uint8_t opcode, uint8_t nextOpcode);
+    uint8_t GetCyclesForFusedInstruction(const CPUDecodedInstruction* first);
     void SetPSFlag(uint8_t flag, bool on);
+    void SetNZ(uint8_t value) { flags.n = value; flags.z = value; }
+    void LoadLazyFlags();
     void GetByteForAddressMode(AddrMode mode, AddressModeResult* result);
     void AdvanceCyclesForAddressMode(uint8_t opcode, AddrMode mode, bool pageCross, bool extraCycles, bool relSuccess);
     uint8_t GetCyclesForNextInstruction();
     void HaltCPUForDMAWrite();
+    bool IsIdleLoopInstruction(uint8_t opcode);
+    void TrackIdleLoop(const CPURegisters& before, uint8_t cycles);
+    void SkipIdleLoopInstruction();
+    void StopIdleLoop();
     
     // All opcode declarations
     void OP_ADC(uint8_t opcode, bool sbc = false);
@@ -306,6 +381,8 @@ private:
 
     string DebugMakeCurrentStateLine();
     void EvaluateNintendulatorDebug();
+    bool ParseNextNintendulatorLine(DebugCPUState& state, string& lineText);
+    void WriteTraceRecord();
 
     bool delayedDMA;
     NESDL_Core* core;
@@ -317,10 +394,34 @@ private:
     
     bool didMapperWrite;
     bool wasLastInstructionAMapperWrite; // Not happy with this, but needed
+    uint8_t lastOpcode;
+    CPUFlags flags; // N/Z/C/V (see StoreLazyFlags)
+
+    // Decoded instruction cache, indexed by PC (internal RAM code by its un-mirrored address).
+    // ROM entries go stale all at once on any mapper register write (bank switches), RAM entries
+    // are dropped individually when something writes over their bytes
+    CPUDecodedInstruction decodeCache[0x10000];
+    uint32_t decodeGeneration;
+    const CPUDecodedInstruction* decoded; // Instruction being run (nullptr if it isn't cacheable)
+    uint16_t decodedPC;
+
+    // Idle loop skipping - a short loop that only reads plain memory and comes back around with
+    // identical registers can't do anything different until an interrupt changes memory, so its
+    // instructions are replayed from these tables instead of being run
+    bool idleLoopWatching; // Recording one iteration of a candidate loop
+    bool idleLoopActive; // Replaying the recorded iteration
+    uint16_t idleLoopHead;
+    uint8_t idleLoopLength;
+    uint8_t idleLoopIndex;
+    CPURegisters idleLoopRegisters[CPU_IDLE_LOOP_MAX_INSTRUCTIONS]; // Registers before each instruction
+    uint8_t idleLoopCycles[CPU_IDLE_LOOP_MAX_INSTRUCTIONS];
+    uint8_t idleLoopPPUCycles[CPU_IDLE_LOOP_MAX_INSTRUCTIONS]; // What nextInstructionPPUCycles was for each
+    uint8_t idleLoopOpcodes[CPU_IDLE_LOOP_MAX_INSTRUCTIONS];
 
     DebugCPUState debugCPUState;
     bool nintendulatorDebugging;
-    vector<string> nintendulatorLog;
+    NESDL_MappedFile nintendulatorLog;
+    uint64_t nintendulatorLogOffset; // Byte offset of the next line to compare against
     uint64_t nintendulatorLogIndex;
-    uint64_t nintendulatorLogCount;
+    NESDL_CPUTraceWriter traceWriter;
 };
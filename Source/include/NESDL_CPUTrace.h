@@ -0,0 +1,82 @@
+#pragma once
+
+// Binary CPU execution trace - one fixed-size record per instruction, written before it runs
+// (the same point a Nintendulator log line describes). Shared with tools/NESDL_TraceTool.cpp,
+// which defines NESDL_CPUTRACE_FORMAT_ONLY to leave out the emulator-side writer
+
+#define NESDL_CPUTRACE_MAGIC    "NESDLTRC"
+#define NESDL_CPUTRACE_VERSION  1
+// Records per block handed to the writer thread (64K records = 2MB)
+#define NESDL_CPUTRACE_BLOCK    0x10000
+
+struct CPUTraceFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+struct CPUTraceRecord
+{
+    uint64_t masterCycle;   // PPU dots * 4
+    uint64_t cpuCycle;      // CPU cycles (CYC in Nintendulator logs)
+    uint16_t pc;
+    uint16_t ppuScanline;
+    uint16_t ppuDot;
+    uint8_t opcode;
+    uint8_t param0;
+    uint8_t param1;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t sp;
+    uint8_t reserved[2];    // Always 0 - keeps records at 32 bytes so they can be compared raw
+};
+static_assert(sizeof(CPUTraceRecord) == 32, "CPUTraceRecord must stay 32 bytes");
+
+#ifndef NESDL_CPUTRACE_FORMAT_ONLY
+
+// Collects records into large blocks and hands full blocks to a background thread to write out,
+// so tracing costs the CPU little more than a 32 byte copy per instruction
+class NESDL_CPUTraceWriter
+{
+public:
+    NESDL_CPUTraceWriter() : isOpen(false), current(nullptr), currentCount(0), stopRequested(false) {}
+    ~NESDL_CPUTraceWriter() { Close(); }
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() { return isOpen; }
+    void Write(const CPUTraceRecord& record)
+    {
+        current[currentCount++] = record;
+        if (currentCount == NESDL_CPUTRACE_BLOCK)
+        {
+            SubmitBlock();
+        }
+    }
+private:
+    void SubmitBlock();
+    void WriterThread();
+    
+    struct Block
+    {
+        unique_ptr<CPUTraceRecord[]> records;
+        uint32_t count;
+    };
+    
+    bool isOpen;
+    ofstream file;
+    CPUTraceRecord* current;
+    uint32_t currentCount;
+    unique_ptr<CPUTraceRecord[]> currentBlock;
+    
+    thread writerThread;
+    mutex queueMutex;
+    condition_variable queueSignal;
+    queue<Block> fullBlocks;
+    vector<unique_ptr<CPUTraceRecord[]>> freeBlocks;
+    bool stopRequested;
+};
+
+#endif
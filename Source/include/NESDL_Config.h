@@ -6,6 +6,7 @@ class ConfigSection
 public:
     constexpr static const char* GENERAL		= "General";
     constexpr static const char* PLAYER1		= "Player1";
+    constexpr static const char* HEADERFIXES	= "HeaderFixes"; // ROM CRC32 (PRG+CHR) = <mapper> <H|V|4> <battery>
 };
 
 class ConfigKey
@@ -13,6 +14,7 @@ class ConfigKey
 public:
     constexpr static const char* LASTROM		= "last_rom";
     constexpr static const char* LASTLOG		= "last_log";
+    constexpr static const char* LASTLIBRARY	= "last_library";
 
     constexpr static const char* INPUT_UP		= "input_up";
     constexpr static const char* INPUT_DOWN		= "input_down";
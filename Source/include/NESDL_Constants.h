@@ -3,6 +3,7 @@
 using namespace std;
 
 class NESDL_Core; // Decl needed for pointer refs
+class NESDL_ROMLibrary; // Needs the iNES header, so it comes in after NESDL_Core.h
 
 // Screen dimension constants
 #define NESDL_SCREEN_WIDTH 256
@@ -64,6 +65,7 @@ const uint32_t NESDL_PALETTE[0x40] =
 
 #define APU_SAMPLE_RATE 44100
 #define APU_SAMPLE_BUF 1024
+#define APU_SAMPLE_BATCH 64 // Samples handed to SDL at once (~1.5ms)
 
 // APU square duties (four selectable "sounds" for the two square channels)
 // https://www.nesdev.org/wiki/APU_Pulse
@@ -33,12 +33,23 @@ public:
     void LoadROM(const char* path);
     void HandleEvent(SDL_EventType eventType, SDL_KeyCode eventKeyCode);
     bool IsROMLoaded();
+    // Whole machine state, in a fixed order (see NESDL_SaveState.h)
+    void SaveState(NESDL_StateWriter& state);
+    void LoadState(NESDL_StateReader& state);
+    // Just one part of it (or, for StateHashPart::Frame, the picture)
+    void SaveStatePart(StateHashPart part, NESDL_StateWriter& state);
 
     // Menu bar actions (called from OS-specific areas)
     void Action_Quit();
     void Action_ShowAbout();
     void Action_OpenROM();
+    void Action_ScanROMLibrary();
     void Action_CloseROM();
+    void Action_SaveState();
+    void Action_LoadState();
+    void Action_NextStateSlot();
+    void Action_RecordMovie();
+    void Action_PlayMovie();
     void Action_ResetSoft();
     void Action_ResetHard();
     void Action_ViewFrameInfo();
@@ -53,6 +64,11 @@ public:
     void Action_DebugShowNT();
     void Action_AttachNintendulatorLog();
     void Action_DetachNintendulatorLog();
+    void Action_StartCPUTrace();
+    void Action_StopCPUTrace();
+    void Action_ToggleCPUFastPaths();
+    void Action_DumpFlightRecorder();
+    void Action_FindMovieDivergence();
 
     NESDL_CPU* cpu;
     NESDL_PPU* ppu;
@@ -61,14 +77,28 @@ public:
     NESDL_Input* input;
     NESDL_Mapper* mapper;
     NESDL_Config* config;
+    NESDL_FlightRecorder* flightRecorder;
+    NESDL_ROMLibrary* romLibrary;
+    NESDL_SaveStates* saveStates;
+    NESDL_Movie* movie;
+    NESDL_Divergence* divergence;
 
     bool romLoaded;
     bool paused;
 
 private:
     string GetDirectoryOf(const string& filePath);
+    string GetSavePathOf(const string& romPath, const string& extension = ".sav");
+    string GetStatePathOf(const string& romPath, int slot);
+    void SaveStateToSlot(int slot);
 
     NESDL_SDL* sdlCtx;
+    NESDL_MappedFile romFile; // Owns the loaded ROM image (the mapper points into it)
+    NESDL_BatteryRAM batteryRAM; // Cartridge save RAM, if the ROM has a battery
+    string romPath;
+    int stateSlot; // 0-9, or NESDL_STATE_AUTOSAVE_SLOT
+    bool stateSaveRequested; // Save to stateSlot at the end of the current frame
+    uint32_t framesSinceAutosave;
     
     double timeSinceStartup;
     bool stepFrame;
@@ -0,0 +1,86 @@
+#pragma once
+
+// Finds where two configurations of the emulator stop agreeing, running the same ROM and input movie.
+// Both run on the live core one after the other (it's put back how it was afterwards), swapping between
+// them with save states:
+//  1. From a shared checkpoint, each configuration runs the next NESDL_DIVERGENCE_INTERVAL frames of the
+//     movie, hashing every frame. If all the hashes match, the end of the interval becomes the next
+//     checkpoint (kept compressed in memory) and it moves on. Otherwise the first frame that doesn't
+//     match is where things went wrong
+//  2. Starting from that frame, a binary search over PPU dots finds the single dot where the two
+//     machines go from identical to different. The report gives the instruction the CPU was on there
+//  3. The states on either side of that dot are compared field by field, down to struct members
+// Differences between two builds (rather than two configurations) show up when a movie recorded by one is
+// played back on the other - see NESDL_Movie - and this narrows down the frame from there
+
+// Frames between checkpoints (about 10 seconds)
+#define NESDL_DIVERGENCE_INTERVAL 600
+// Most fields listed in a report - past the first few it's usually fallout from the first
+#define NESDL_DIVERGENCE_MAX_FIELDS 32
+#define NESDL_DIVERGENCE_FILE "nesdl_divergence.txt"
+
+struct DivergenceConfig
+{
+    const char* name;
+    bool cpuFastPaths;  // See NESDL_CPU::SetFastPaths
+};
+
+struct DivergenceField
+{
+    string name;    // e.g. "PPU registers PPURegisters::v" or "RAM ram[0x06F1]"
+    string valueA;
+    string valueB;
+};
+
+struct DivergenceReport
+{
+    bool diverged;
+    uint32_t frames;            // Movie frames both agreed on
+    // The rest is only set if they diverged
+    uint32_t dot;               // PPU dots into frame `frames` when they first differ
+    uint16_t scanline;          // Where the PPU was just before
+    uint16_t scanlineCycle;
+    uint64_t cpuCycle;
+    uint16_t pc;                // Next instruction
+    uint8_t opcode;             // ...and its opcode
+    vector<DivergenceField> fields;
+    double seconds;
+};
+
+class NESDL_Divergence
+{
+public:
+    void Init(NESDL_Core* c);
+    // startState is compressed, as NESDL_Movie::ReadMovie gives it. Leaves the core in whatever state
+    // the search ended in - the caller puts it back
+    void Run(const vector<uint8_t>& startState, const vector<MovieFrame>& frames,
+             const DivergenceConfig& a, const DivergenceConfig& b, DivergenceReport& report);
+    static string FormatReport(const DivergenceReport& report, const DivergenceConfig& a, const DivergenceConfig& b);
+
+private:
+    struct Checkpoint
+    {
+        uint32_t frame;
+        vector<uint8_t> state; // Compressed
+    };
+    struct PartState
+    {
+        vector<uint8_t> data;
+        vector<StateField> layout;
+    };
+
+    void Restore(const Checkpoint& checkpoint, const DivergenceConfig& config);
+    Checkpoint Capture();
+    bool StepDot();
+    void RunFrames(uint32_t count, vector<uint64_t>* hashes);
+    uint32_t CountFrameDots();
+    vector<uint8_t> RunToDot(const Checkpoint& frameStart, const DivergenceConfig& config, uint32_t dots);
+    void CaptureParts(PartState* parts);
+    void CompareParts(const PartState* a, const PartState* b, DivergenceReport& report);
+    static const StateField* FindField(const PartState& part, const char* name);
+    static uint64_t ReadValue(const uint8_t* src, size_t size);
+
+    NESDL_Core* core;
+    const vector<MovieFrame>* frames;
+    uint32_t frameIndex;    // Movie frame the machine's partway through
+};
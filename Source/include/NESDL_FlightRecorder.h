@@ -0,0 +1,121 @@
+#pragma once
+
+// Always-on record of the last few thousand things the system did (instructions, PPU/APU register
+// writes, interrupts), kept so there's some history to look at when a ROM hits a KIL opcode or
+// locks up. Recording is just a copy into a fixed ring - all formatting happens in Dump()
+
+// Ring size in entries. Must be a power of 2
+#define NESDL_FLIGHTREC_SIZE        8192
+// Frames the main program (anything outside NMI/IRQ handlers) can spin in one small spot before
+// the watchdog calls it a hang, and how small that spot has to be
+#define NESDL_FLIGHTREC_HANG_FRAMES 180
+#define NESDL_FLIGHTREC_HANG_BYTES  32
+#define NESDL_FLIGHTREC_FILE        "nesdl_flightrecorder.txt"
+
+enum class FlightRecorderEvent : uint8_t
+{
+    Instruction,
+    PPUWrite,
+    APUWrite,
+    NMI,
+    IRQ
+};
+
+struct FlightRecorderEntry
+{
+    uint64_t cpuCycle;
+    uint16_t addr;  // PC for instructions/interrupts, register address for writes
+    FlightRecorderEvent type;
+    uint8_t data;   // Opcode for instructions, value for writes
+    // CPU registers (instructions and interrupts only)
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;      // Without N/Z/C/V - those are in flags until the dump puts them together
+    uint8_t sp;
+    CPUFlags flags;
+};
+
+// Instructions that store to memory (or the stack) - a loop without any of them can only be waiting
+const bool NESDL_FLIGHTREC_WRITES[KIL + 1] =
+{
+    // ADC    AND    ASL    BCC    BCS    BEQ    BIT    BMI    BNE    BPL    BRK    BVC    BVS    CLC
+    false, false, true,  false, false, false, false, false, false, false, true,  false, false, false,
+    // CLD    CLI    CLV    CMP    CPX    CPY    DEC    DEX    DEY    EOR    INC    INX    INY    JMP
+    false, false, false, false, false, false, true,  false, false, false, true,  false, false, false,
+    // JSR    LDA    LDX    LDY    LSR    NOP    ORA    PHA    PHP    PLA    PLP    ROL    ROR    RTI
+    true,  false, false, false, true,  false, false, true,  true,  false, false, true,  true,  false,
+    // RTS    SBC    SEC    SED    SEI    STA    STX    STY    TAX    TAY    TSX    TXA    TXS    TYA
+    false, false, false, false, false, true,  true,  true,  false, false, false, false, false, false,
+    // KIL
+    false
+};
+
+class NESDL_FlightRecorder
+{
+public:
+    void Init(NESDL_Core* c);
+    void Reset();
+    void RecordInstruction(uint64_t cpuCycle, const CPURegisters& r, const CPUFlags& f, uint8_t opcode)
+    {
+        FlightRecorderEntry& e = entries[(next++) & (NESDL_FLIGHTREC_SIZE - 1)];
+        e.cpuCycle = cpuCycle;
+        e.addr = r.pc;
+        e.type = FlightRecorderEvent::Instruction;
+        e.data = opcode;
+        e.a = r.a;
+        e.x = r.x;
+        e.y = r.y;
+        e.p = r.p;
+        e.sp = r.sp;
+        e.flags = f;
+
+        // The watchdog reads instructions back out of the ring - catch it up before they get overwritten
+        if (next - watched >= NESDL_FLIGHTREC_SIZE / 2)
+        {
+            Watch();
+        }
+    }
+    void RecordInterrupt(FlightRecorderEvent type, uint64_t cpuCycle, const CPURegisters& r, const CPUFlags& f)
+    {
+        FlightRecorderEntry& e = entries[(next++) & (NESDL_FLIGHTREC_SIZE - 1)];
+        e.cpuCycle = cpuCycle;
+        e.addr = r.pc;
+        e.type = type;
+        e.data = 0;
+        e.a = r.a;
+        e.x = r.x;
+        e.y = r.y;
+        e.p = r.p;
+        e.sp = r.sp;
+        e.flags = f;
+    }
+    void RecordWrite(FlightRecorderEvent type, uint64_t cpuCycle, uint16_t addr, uint8_t data)
+    {
+        FlightRecorderEntry& e = entries[(next++) & (NESDL_FLIGHTREC_SIZE - 1)];
+        e.cpuCycle = cpuCycle;
+        e.addr = addr;
+        e.type = type;
+        e.data = data;
+    }
+    void EndFrame();
+    bool Dump(const string& reason);
+private:
+    void Watch();
+
+    NESDL_Core* core;
+    FlightRecorderEntry entries[NESDL_FLIGHTREC_SIZE];
+    uint64_t next; // Total entries ever recorded (ring index is next & (size - 1))
+
+    // Hang watchdog (see EndFrame)
+    uint64_t watched;       // Entries the watchdog has looked at so far
+    bool inHandler;         // In an NMI/IRQ/BRK handler (or one nested inside it)
+    uint8_t handlerSP;      // Stack pointer when the outermost handler was entered
+    uint16_t mainMinPC;     // Range of PCs the main program ran this frame
+    uint16_t mainMaxPC;
+    bool mainWrote;         // Main program ran anything that writes memory this frame
+    bool sawInterrupt;
+    uint16_t stuckMinPC;    // Range the main program has stayed inside since it last got anywhere
+    uint16_t stuckMaxPC;
+    uint32_t stuckFrames;
+};
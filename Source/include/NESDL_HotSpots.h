@@ -0,0 +1,107 @@
+#pragma once
+
+// Define NESDL_HOTSPOTS (project preprocessor settings, or uncomment below) to count instructions
+// and CPU cycles per PRG address. Without it, every hot-spot macro compiles to nothing
+//#define NESDL_HOTSPOTS
+
+// Hot spots are keyed by PRG-ROM offset, which keeps the same CPU address in different banks apart.
+// Reports show them as 8KB bank:CPU address
+#define NESDL_HOTSPOT_BANK_SIZE     0x2000
+// Code running outside of PRG-ROM ($0000-$7FFF) is keyed by CPU address instead
+#define NESDL_HOTSPOT_NONROM_SIZE   0x8000
+// Entries in the sorted report
+#define NESDL_HOTSPOT_REPORT_COUNT  200
+// Frames of per-bank cycle history kept for the per-frame breakdown
+#define NESDL_HOTSPOT_HISTORY       600
+#define NESDL_HOTSPOT_REPORT_FILE   "nesdl_hotspots.txt"
+#define NESDL_HOTSPOT_FRAMES_FILE   "nesdl_hotspots_frames.csv"
+
+#ifdef NESDL_HOTSPOTS
+
+struct NESDL_HotSpotEntry
+{
+    uint64_t instructions;
+    uint64_t cycles;
+    uint16_t cpuAddr; // Where this PRG byte was last executed from
+    uint8_t opcode;
+};
+
+class NESDL_HotSpots
+{
+public:
+    static void Begin(NESDL_Mapper* m, uint32_t prgROMSize);
+    static void End();
+    static void Count(uint16_t pc, uint8_t opcode, uint64_t cycles)
+    {
+        if (mapper == nullptr)
+        {
+            return;
+        }
+        uint32_t index;
+        uint32_t bank;
+        int32_t offset = pc >= 0x8000 ? mapper->GetPRGROMOffset(pc) : -1;
+        if (offset >= 0)
+        {
+            index = NESDL_HOTSPOT_NONROM_SIZE + offset;
+            bank = 1 + offset / NESDL_HOTSPOT_BANK_SIZE;
+        }
+        else
+        {
+            index = pc & (NESDL_HOTSPOT_NONROM_SIZE - 1);
+            bank = 0;
+        }
+        NESDL_HotSpotEntry& e = entries[index];
+        e.instructions++;
+        e.cycles += cycles;
+        e.cpuAddr = pc;
+        e.opcode = opcode;
+        frameCycles[bank] += cycles;
+    }
+    static void EndFrame();
+    static bool WriteReport(const char* path);
+    static bool WriteFrameCSV(const char* path);
+private:
+    static NESDL_Mapper* mapper;
+    static vector<NESDL_HotSpotEntry> entries;  // Non-ROM addresses first, then every PRG-ROM byte
+    static vector<uint64_t> frameCycles;        // This frame's cycles - [0] is non-ROM, then one per bank
+    static vector<uint64_t> history;            // NESDL_HOTSPOT_HISTORY rows of frameCycles
+    static uint32_t historyIndex;
+    static uint32_t historyCount;
+    static uint64_t frameNumber;
+};
+
+// Counts the instruction that starts at pc once the scope ends, charging it every cycle
+// the CPU's cycle counter moved in between (inactive scopes count nothing)
+class NESDL_HotSpotScope
+{
+public:
+    NESDL_HotSpotScope(uint16_t pc, uint8_t opcode, const uint64_t& cycleCounter, bool active)
+    :pc(pc), opcode(opcode), active(active), cycleCounter(cycleCounter), start(cycleCounter) {}
+    ~NESDL_HotSpotScope()
+    {
+        if (active)
+        {
+            NESDL_HotSpots::Count(pc, opcode, cycleCounter - start);
+        }
+    }
+private:
+    uint16_t pc;
+    uint8_t opcode;
+    bool active;
+    const uint64_t& cycleCounter;
+    uint64_t start;
+};
+
+#define NESDL_HOTSPOT_BEGIN(mapper, prgROMSize) NESDL_HotSpots::Begin(mapper, prgROMSize)
+#define NESDL_HOTSPOT_END() NESDL_HotSpots::End()
+#define NESDL_HOTSPOT_SCOPE(pc, opcode, cycleCounter, active) NESDL_HotSpotScope hotSpotScope(pc, opcode, cycleCounter, active)
+#define NESDL_HOTSPOT_END_FRAME() NESDL_HotSpots::EndFrame()
+
+#else
+
+#define NESDL_HOTSPOT_BEGIN(mapper, prgROMSize)
+#define NESDL_HOTSPOT_END()
+#define NESDL_HOTSPOT_SCOPE(pc, opcode, cycleCounter, active)
+#define NESDL_HOTSPOT_END_FRAME()
+
+#endif
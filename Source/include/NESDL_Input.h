@@ -17,11 +17,17 @@ class NESDL_Input
 {
 public:
 	void Init(NESDL_Core* c);
+    void SaveState(NESDL_StateWriter& state);
+    void LoadState(NESDL_StateReader& state);
     void RegisterKey(SDL_KeyCode keyCode, bool keyDown);
     void SetControllerConnected(bool connected, bool isPlayer2);
     uint8_t PlayerInputToByte(bool isPlayer2);
     bool GetNextPlayerInputBit(bool isPlayer2);
     void SetReadInputStrobe(bool strobe);
+    // While latched, the game reads these (PlayerInputToByte layout) instead of the keys - movies
+    // use it so input only ever changes at frame boundaries
+    void LatchInput(uint8_t player1Byte, uint8_t player2Byte);
+    void UnlatchInput();
 private:
     bool GetPlayerInputBit(uint8_t index, bool isPlayer2);
     
@@ -30,4 +36,6 @@ private:
     PlayerInput player2;
     uint8_t readBit;
     bool readInputStrobe;
+    bool inputLatched;
+    uint8_t latchedInput[2];
 };
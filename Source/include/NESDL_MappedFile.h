@@ -0,0 +1,24 @@
+#pragma once
+
+// Read-only memory mapping of a whole file. Pages are only pulled in by the OS as they're
+// touched, so this works for files far bigger than we'd ever want to read into memory
+class NESDL_MappedFile
+{
+public:
+    NESDL_MappedFile();
+    ~NESDL_MappedFile();
+    bool Open(const char* path, bool sequential = true); // sequential - hint that it'll be read front to back
+    void Close();
+    bool IsOpen() { return data != nullptr; }
+    const uint8_t* GetData() { return data; }
+    uint64_t GetSize() { return size; }
+private:
+    uint8_t* data;
+    uint64_t size;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+// Input movies. A movie starts from a snapshot of the whole machine and then holds, for every frame,
+// the controller bytes that were in effect and a hash of each subsystem's state once the frame was
+// done (plus one of the picture itself). Playing it back loads the snapshot, feeds the same inputs in
+// at the same frame boundaries and checks every frame's hashes against the recording, so the first
+// frame that comes out differently - and which part of the machine it's in - gets reported right away.
+// Controllers only change at frame boundaries while a movie is going (see NESDL_Input::LatchInput)
+
+#define NESDL_MOVIE_MAGIC   0x564F4D4E // "NMOV"
+#define NESDL_MOVIE_VERSION 2 // 2: version 2 start states, and the Frame hash covers frameData and frameEmphasis together
+
+// What each frame's hashes cover, in the order Core::SaveState writes them (then the framebuffer)
+enum class StateHashPart : uint8_t
+{
+    CPU,
+    PPU,
+    APU,
+    RAM,
+    Input,
+    Mapper,
+    Frame,
+    Count
+};
+
+struct MovieFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t romSize;
+    uint32_t frameCount;
+    uint32_t startStateSize;        // Serialized snapshot the movie starts from, before compression
+    uint32_t startStatePackedSize;  // ...and as stored (straight after this header, frames follow it)
+    uint8_t mapper;
+    uint8_t reserved[3];
+};
+
+// Stored as-is, one per frame
+struct MovieFrame
+{
+    uint8_t input[2];   // Player 1/2, as NESDL_Input::PlayerInputToByte lays them out
+    uint8_t reserved[6];
+    uint64_t hashes[(int)StateHashPart::Count];
+};
+static_assert(sizeof(MovieFrame) == 64, "MovieFrame must stay 64 bytes");
+
+enum class MovieMode : uint8_t
+{
+    Off,
+    Recording,
+    Playing
+};
+
+class NESDL_Movie
+{
+public:
+    void Init(NESDL_Core* c);
+    bool StartRecording(const string& path, uint64_t romSize);
+    bool StartPlayback(const string& path, uint64_t romSize, string& error);
+    // Recordings are written out here. Safe to call when nothing's going
+    void Stop();
+    // Called at every frame boundary - records or checks this frame, then latches the next one's input
+    void EndFrame();
+    MovieMode GetMode() { return mode; }
+    // Set when playback finishes or diverges, or a recording gets saved
+    bool TakeReport(string& report);
+
+    // 64-bit hash, four independent 64-bit lanes over 32-byte stripes so the multiplies overlap
+    // (and compilers can vectorize them). Not cryptographic - just quick and well mixed
+    static uint64_t Hash(const uint8_t* src, size_t size, uint64_t seed = 0);
+    static const char* GetHashPartName(StateHashPart part);
+    // Hashes the machine as it is right now, one hash per StateHashPart
+    void HashState(uint64_t* hashes);
+    // Reads and checks a movie file. startState is left compressed, as it is in the file
+    static bool ReadMovie(const string& path, uint64_t romSize, uint8_t mapperNumber, MovieFileHeader& header,
+                          vector<uint8_t>& startState, vector<MovieFrame>& frames, string& error);
+
+private:
+    void LatchInput(uint8_t player1, uint8_t player2);
+    bool WriteMovie();
+
+    NESDL_Core* core;
+    MovieMode mode;
+    string path;
+    MovieFileHeader header;
+    vector<uint8_t> startState;     // Compressed, as it goes in the file
+    vector<MovieFrame> frames;
+    uint32_t frameIndex;            // Playback position
+    uint8_t latchedInput[2];        // What the game's seeing this frame
+    NESDL_StateWriter hashScratch;  // Reused every frame so hashing doesn't allocate
+    string report;
+};
@@ -14,6 +14,15 @@ struct PPURegisters
     uint8_t status;     // PPU status register
     uint8_t oamAddr;    // OAM address
 };
+NESDL_STATE_MEMBERS(PPURegisters,
+    NESDL_STATE_MEMBER(PPURegisters, v),
+    NESDL_STATE_MEMBER(PPURegisters, t),
+    NESDL_STATE_MEMBER(PPURegisters, x),
+    NESDL_STATE_MEMBER(PPURegisters, w),
+    NESDL_STATE_MEMBER(PPURegisters, ctrl),
+    NESDL_STATE_MEMBER(PPURegisters, mask),
+    NESDL_STATE_MEMBER(PPURegisters, status),
+    NESDL_STATE_MEMBER(PPURegisters, oamAddr))
 
 // The bytes collected during PPU tile fetching
 struct PPUTileFetch
@@ -23,6 +32,11 @@ struct PPUTileFetch
     uint16_t pattern;
     uint8_t paletteIndex;
 };
+NESDL_STATE_MEMBERS(PPUTileFetch,
+    NESDL_STATE_MEMBER(PPUTileFetch, nametable),
+    NESDL_STATE_MEMBER(PPUTileFetch, attribute),
+    NESDL_STATE_MEMBER(PPUTileFetch, pattern),
+    NESDL_STATE_MEMBER(PPUTileFetch, paletteIndex))
 
 struct PPUSprFetch
 {
@@ -33,6 +47,21 @@ struct PPUSprFetch
     bool bgPriority;
 };
 
+// One scanline's worth of a single layer (BG or sprites), kept as separate byte planes
+// so both layers can be composited 16 pixels at a time
+struct PPULineBuffer
+{
+    alignas(16) uint8_t color[NESDL_SCREEN_WIDTH];      // Palette index of the pixel
+    alignas(16) uint8_t opaque[NESDL_SCREEN_WIDTH];     // 0xFF if the pixel isn't transparent
+    alignas(16) uint8_t priority[NESDL_SCREEN_WIDTH];   // Sprites only - 0xFF if drawn in front of BG
+    alignas(16) uint8_t spriteZero[NESDL_SCREEN_WIDTH]; // Sprites only - 0xFF if the pixel came from OAM sprite 0
+};
+NESDL_STATE_MEMBERS(PPULineBuffer,
+    NESDL_STATE_MEMBER(PPULineBuffer, color),
+    NESDL_STATE_MEMBER(PPULineBuffer, opaque),
+    NESDL_STATE_MEMBER(PPULineBuffer, priority),
+    NESDL_STATE_MEMBER(PPULineBuffer, spriteZero))
+
 // 4-byte struct for Object Attribute Memory
 struct OAMEntry
 {
@@ -78,6 +107,37 @@ struct OAMEntry
 #define PPUSTATUS_SPR0HIT       0x40
 #define PPUSTATUS_VBLANK        0x80
 
+// Scanline types - each gets its own row in the dot action table
+#define PPU_LINE_VISIBLE        0
+#define PPU_LINE_POSTRENDER     1
+#define PPU_LINE_VBLANK_START   2
+#define PPU_LINE_VBLANK         3
+#define PPU_LINE_PRERENDER      4
+#define PPU_LINE_TYPES          5
+#define PPU_DOTS_PER_LINE       341
+#define PPU_LINES_PER_FRAME     262
+
+// Dot action flags (what a given dot does on a given scanline type)
+#define PPUDOT_LINE_START           0x00001 // Per-line setup (and odd frame skip on line 0)
+#define PPUDOT_BG_PIXEL             0x00002 // Visible pixel - backdrop gets drawn here if BG is off
+#define PPUDOT_BG_FETCH             0x00004 // NT/AT/pattern fetches
+#define PPUDOT_BG_DRAW              0x00008 // Last dot of a visible tile fetch - draw the outgoing tile
+#define PPUDOT_BG_RELOAD            0x00010 // Last dot of a prefetched tile - shift it into the buffer
+#define PPUDOT_INC_Y                0x00020
+#define PPUDOT_RESET_X              0x00040
+#define PPUDOT_NT_DUMMY             0x00080 // Unused NT fetches at the end of the line
+#define PPUDOT_COMPOSITE            0x00100 // Flush the rest of the line to frameData
+#define PPUDOT_SPR_LINE_CLEAR       0x00200
+#define PPUDOT_SPR_CLEAR            0x00400 // Secondary OAM clear
+#define PPUDOT_SPR_EVAL             0x00800
+#define PPUDOT_SPR_OVERFLOW         0x01000 // Dots sprite overflow could be flagged on
+#define PPUDOT_SPR_FETCH            0x02000
+#define PPUDOT_FRAME_READY          0x04000
+#define PPUDOT_VBLANK_SET           0x08000
+#define PPUDOT_FLAGS_CLEAR          0x10000
+#define PPUDOT_PRERENDER_RESET_X    0x20000
+#define PPUDOT_RESET_Y              0x40000
+
 // OAM attributes flags
 #define SPR_PALETTE     0x3
 #define SPR_PRIORITY    0x20
@@ -89,12 +149,18 @@ class NESDL_PPU
 public:
 	void Init(NESDL_Core* c);
     void Reset(bool hardReset);
+    void SaveState(NESDL_StateWriter& state);
+    void LoadState(NESDL_StateReader& state);
 	void Update(uint32_t ppuCycles);
     void SetMapper(NESDL_Mapper* m);
     bool IsPPUReady();
     void RunNextCycle();
-    void HandleProcessVisibleScanline();
-    void HandleProcessVBlankScanline();
+    void BuildDotActionTable();
+    uint8_t GetLineType(uint16_t scanline);
+    void RunDotActions(uint32_t actions);
+    void IncrementCoarseX();
+    void IncrementFineY();
+    void FetchNextSprite();
     void WriteToRegister(uint16_t registerAddr, uint8_t data);
     uint8_t ReadFromRegister(uint16_t registerAddr);
     uint8_t ReadFromVRAM(uint16_t addr);
@@ -103,15 +169,19 @@ public:
     void FetchAndStoreTile(uint8_t pixelInFetchCycle);
     uint16_t WeavePatternBits(uint8_t low, uint8_t high, bool flip);
     uint32_t GetPalette(uint8_t index, bool spriteLayer);
-    uint32_t GetColor(uint16_t pattern, uint32_t palette, uint8_t pixelIndex);
+    uint8_t GetColor(uint16_t pattern, uint32_t palette, uint8_t pixelIndex);
     uint8_t GetPatternBits(uint16_t pattern, uint8_t pixelIndex);
+    void WriteBGPixel(const PPUTileFetch& tile, uint8_t pixelIndex);
+    void EvaluateSprites();
+    void RenderSprite(const PPUSprFetch& sprData);
+    void CompositeLine(uint16_t upToX);
     void PreprocessPPUForReadInstructionTiming(uint8_t instructionPPUTime);
     void PreprocessPPUForWriteInstructionTiming(uint8_t instructionPPUTime, uint8_t writeValue);
     void UpdateNTFrameData();
 
     PPURegisters registers;
-    uint32_t frameData[NESDL_SCREEN_WIDTH * NESDL_SCREEN_HEIGHT]; // Frame buffer
-    uint8_t frameDataSprite[NESDL_SCREEN_WIDTH * NESDL_SCREEN_HEIGHT]; // Some per-pixel data
+    uint8_t frameData[NESDL_SCREEN_WIDTH * NESDL_SCREEN_HEIGHT]; // Frame buffer (6-bit palette indices, converted to ARGB by SDL)
+    uint8_t frameEmphasis[NESDL_SCREEN_HEIGHT]; // PPUMASK emphasis bits (0-7) sampled per scanline
     uint32_t ntFrameData[0x1000]; // Frame buffer
 
     bool incrementV;
@@ -122,13 +192,19 @@ public:
     bool frameDataReady;
     bool frameFinished;
     uint64_t irqFiredAt;
+    uint64_t mapperIRQAt; // Cycle the mapper predicted its next IRQ for (UINT64_MAX if none)
     uint64_t nmiFiredAt;
     uint64_t elapsedCycles;
 private:
     NESDL_Core* core;
     NESDL_Mapper* mapper;
 
+    uint8_t currentLineType;
+    uint32_t dotActions[PPU_LINE_TYPES][PPU_DOTS_PER_LINE];
     int32_t currentDrawX;
+    uint16_t compositedX; // Pixels of the current line already composited into frameData
+    PPULineBuffer bgLine;
+    PPULineBuffer sprLine;
     uint8_t vram[0x1000];  // 4kb VRAM for the PPU (physically 2kb but supports 4 nametables)
     uint8_t paletteData[0x20]; // Bit of space at the end of VRAM address space for palette data
 	uint8_t ppuOpenBus;
@@ -139,10 +215,7 @@ private:
     uint8_t ppuDataReadBuffer; // Special internal buffer for PPUDATA reads
     uint8_t oam[64 * 4]; // 64 slots (256 bytes) for PPU "Object Attribute Memory"
     uint8_t secondaryOAM[8 * 5]; // 8 slots (32 + 8 bytes) of next scanline's chosen sprites
-    PPUSprFetch sprDataToDraw[8]; // 8 slots of next scanline's actual sprite draw data
-    uint8_t sprDataToDrawCount;
-    uint8_t oamN; // N counter for OAM writes (as described on NESDEV sprite evaluation)
-    uint8_t oamM; // M counter for OAM writes
+    uint16_t sprOverflowCycle; // Dot this line's sprite evaluation would have flagged overflow on (0 = none)
     uint8_t secondaryOAMNextSlot; // Index for the next available slot in secondary OAM
     uint8_t sprFetchIndex; // The index of the sprite to access during secondary OAM sprite fetching
 
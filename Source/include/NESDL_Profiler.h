@@ -0,0 +1,79 @@
+#pragma once
+
+// Define NESDL_PROFILING (project preprocessor settings, or uncomment below) to build
+// per-subsystem timers into the emulator. Without it, every profiling macro compiles to nothing
+//#define NESDL_PROFILING
+
+enum class NESDL_ProfileSection
+{
+    CPU,
+    PPU,
+    APU,
+    Events,
+    TextureUpload,
+    Present,
+    COUNT
+};
+
+// Frames of history kept for the rolling stats (and written out by WriteCSV)
+#define NESDL_PROFILE_HISTORY 240
+// Per-dot sections are only timed on 1 of every N dots (then scaled), otherwise the timer
+// calls would cost more than the work being measured. Must be a power of 2
+#define NESDL_PROFILE_SAMPLE_RATE 16
+// Histogram buckets are powers of 2 in microseconds (<1us, <2us, <4us ... up to ~32ms)
+#define NESDL_PROFILE_BUCKETS 16
+
+#ifdef NESDL_PROFILING
+
+struct NESDL_ProfileStats
+{
+    double averageMS;
+    double maxMS;
+    uint32_t histogram[NESDL_PROFILE_BUCKETS];
+};
+
+class NESDL_Profiler
+{
+public:
+    static void AddTime(NESDL_ProfileSection section, uint64_t ticks);
+    static void EndFrame();
+    static NESDL_ProfileStats GetStats(NESDL_ProfileSection section);
+    static string GetOverlayText();
+    static bool WriteCSV(const char* path);
+    static const char* GetSectionName(NESDL_ProfileSection section);
+private:
+    static uint64_t currentTicks[(int)NESDL_ProfileSection::COUNT];
+    static double history[NESDL_PROFILE_HISTORY][(int)NESDL_ProfileSection::COUNT]; // Milliseconds
+    static uint32_t historyIndex;
+    static uint32_t historyCount;
+};
+
+class NESDL_ProfileScope
+{
+public:
+    NESDL_ProfileScope(NESDL_ProfileSection section, bool active = true, uint32_t scale = 1)
+    :section(section), scale(scale), start(active ? SDL_GetPerformanceCounter() : 0) {}
+    ~NESDL_ProfileScope()
+    {
+        if (start != 0)
+        {
+            NESDL_Profiler::AddTime(section, (SDL_GetPerformanceCounter() - start) * scale);
+        }
+    }
+private:
+    NESDL_ProfileSection section;
+    uint32_t scale;
+    uint64_t start;
+};
+
+#define NESDL_PROFILE_SCOPE(section) NESDL_ProfileScope profileScope##section(NESDL_ProfileSection::section)
+#define NESDL_PROFILE_SCOPE_SAMPLED(section, sample) NESDL_ProfileScope profileScope##section(NESDL_ProfileSection::section, sample, NESDL_PROFILE_SAMPLE_RATE)
+#define NESDL_PROFILE_END_FRAME() NESDL_Profiler::EndFrame()
+
+#else
+
+#define NESDL_PROFILE_SCOPE(section)
+#define NESDL_PROFILE_SCOPE_SAMPLED(section, sample)
+#define NESDL_PROFILE_END_FRAME()
+
+#endif
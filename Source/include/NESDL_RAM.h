@@ -5,9 +5,12 @@ class NESDL_RAM
 {
 public:
     void Init(NESDL_Core* c);
+    void SaveState(NESDL_StateWriter& state);
+    void LoadState(NESDL_StateReader& state);
 	uint8_t ReadByte(uint16_t addr);
     uint16_t ReadWord(uint16_t addr);
 	void WriteByte(uint16_t addr, uint8_t data);
+    const uint8_t* GetDMAPage(uint8_t page);
     void SetMapper(NESDL_Mapper* m);
     
     bool oops;
@@ -0,0 +1,79 @@
+#pragma once
+
+// An index of every ROM under a library folder - where it is, PRG/CHR hashes (CRC32 and SHA-1) and what
+// its header really means once known-bad headers are fixed up. Scanning hashes files on every core and
+// only looks at files whose size or modification time changed since the last scan. Scans started from
+// the menu run in the background, and the new index is swapped in once it's done. The index is a
+// compact binary file that's read in one go at startup, so a big library doesn't slow launching down
+
+// Bits of ROMLibraryRecord::flags. The low ones sit where they do in iNES ctrl1 so they can be copied over
+#define ROMLIB_VERTICAL     INES_NTMIRROR
+#define ROMLIB_BATTERY      INES_SAVEDATA
+#define ROMLIB_FOURSCREEN   INES_NTLAYOUT
+#define ROMLIB_HEADER_BITS  (ROMLIB_VERTICAL | ROMLIB_BATTERY | ROMLIB_FOURSCREEN)
+#define ROMLIB_VALID        0x40 // Has an iNES header and is as long as it says (otherwise only size/mtime are kept)
+#define ROMLIB_CORRECTED    0x80 // mapper/flags differ from what the header says
+
+#define ROMLIB_INDEX_MAGIC   0x5844494C // "LIDX"
+#define ROMLIB_INDEX_VERSION 1
+
+// Stored as-is in the index file, followed by the path
+struct ROMLibraryRecord
+{
+    uint64_t size;
+    int64_t mtime;
+    uint32_t prgCRC32;
+    uint32_t chrCRC32;
+    uint32_t romCRC32;      // PRG and CHR together - what [HeaderFixes] in the config is keyed by
+    uint8_t prgSHA1[20];
+    uint8_t chrSHA1[20];
+    uint8_t prgBanks;
+    uint8_t chrBanks;
+    uint8_t mapper;
+    uint8_t flags;
+};
+
+struct ROMLibraryEntry
+{
+    string path;
+    ROMLibraryRecord record;
+};
+
+class NESDL_ROMLibrary
+{
+public:
+    constexpr static const char* FILENAME = "nesdl_library.idx";
+
+    void Init(NESDL_Core* c);
+    void Exit(); // Waits for a scan that's still going
+    // Walks root for .nes files, (re)hashes anything new or changed and writes the index back out.
+    // Returns how many files had to be hashed
+    size_t Scan(const string& root);
+    // Same, on a background thread. False if a scan's already going
+    bool StartScan(const string& root);
+    // Set once a background scan finishes - the emulation thread shows it as a notice
+    bool TakeReport(string& report);
+    size_t GetEntryCount();
+    // Rewrites the header's mapper/mirroring/battery bits if the library knows better. The file has to
+    // still match its index entry. Returns true if anything changed
+    bool ApplyHeaderFixes(const string& path, FileHeader_INES& header);
+
+private:
+    void ReadIndex();
+    void WriteIndex();
+    static bool GetFileStamp(const string& path, uint64_t& size, int64_t& mtime);
+    static void HashEntry(ROMLibraryEntry& entry);
+    static void FixHeader(const FileHeader_INES& header, ROMLibraryRecord& record);
+
+    NESDL_Core* core;
+    // Only a scan replaces these, and it does that under entryMutex - so the scan itself can read them
+    // without locking, while anyone else (ApplyHeaderFixes on the emulation thread) has to lock
+    vector<ROMLibraryEntry> entries;
+    unordered_map<string, size_t> entryIndices; // Path to position in entries
+    mutex entryMutex;
+
+    thread scanThread;
+    atomic<bool> scanning;
+    mutex reportMutex;
+    string report;
+};
@@ -26,9 +26,12 @@ public:
     void SetCore(NESDL_Core* coreRef);
     void UpdateScreen(double fps);
     void UpdateScreenTexture();
+    void SetPalette(const uint32_t* palette);
     void GetCloseWindowEvent(SDL_WindowEvent event);
     
     void WriteNextAPUSignal(float s);
+    void FlushAudio();
+    void ClearAudio();
     
     void ShowAbout();
     void ToggleFrameInfo();
@@ -55,6 +58,8 @@ public:
     
     SDL_AudioDeviceID audioDevice;
 private:
+    void ConvertFrameTexture();
+
     default_random_engine rng;
     uniform_int_distribution<int> dist;
 
@@ -67,6 +72,15 @@ private:
     SDL_Texture* texture;
     SDL_Texture* scanlineTexture;
     
+    // Last finished PPU frame (palette indices), converted to ARGB only when it's presented
+    uint8_t frameIndexData[NESDL_SCREEN_WIDTH * NESDL_SCREEN_HEIGHT];
+    uint8_t frameEmphasisData[NESDL_SCREEN_HEIGHT];
+    uint32_t paletteColors[8][0x40]; // One 64-color palette per PPUMASK emphasis combination
+    bool frameTextureDirty;
+    
+    float audioSamples[APU_SAMPLE_BATCH];
+    int audioSampleCount;
+    
     bool showFrameInfo;
     bool showCPU;
     bool showPPU;
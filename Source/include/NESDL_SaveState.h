@@ -0,0 +1,188 @@
+#pragma once
+
+// Save states. Every subsystem writes what it needs to pick up exactly where it left off with
+// SaveState(NESDL_StateWriter&), and reads it back in the same order with LoadState(NESDL_StateReader&).
+// NESDL_SaveStates turns that into files: the emulation thread only serializes (a few hundred KB of
+// memcpy), then a background worker compresses it, writes it to a temp file and renames it into place.
+// Files are LZ-compressed blocks, so a load decompresses one block at a time straight from the mapped
+// file into whichever struct is asking for it
+
+// Serialized state is compressed (and decompressed) in independent blocks of this size
+#define NESDL_STATE_BLOCK_SIZE      0x10000
+#define NESDL_STATE_MAGIC           0x5453534E // "NSST"
+#define NESDL_STATE_VERSION         2 // 2: CPU per-instruction scratch values aren't saved
+// Thumbnail is the last finished frame, point-sampled down to half size
+#define NESDL_STATE_THUMB_WIDTH     (NESDL_SCREEN_WIDTH / 2)
+#define NESDL_STATE_THUMB_HEIGHT    (NESDL_SCREEN_HEIGHT / 2)
+// Slots 0-9 go in .st0-.st9 next to the ROM, the autosave in .sta
+#define NESDL_STATE_SLOTS           10
+#define NESDL_STATE_AUTOSAVE_SLOT   -1
+#define NESDL_STATE_AUTOSAVE_FRAMES 3600 // About once a minute
+
+struct SaveStateFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t romSize;           // Along with mapper, a cheap check the state's for this cartridge
+    uint32_t rawSize;           // Serialized state before compression
+    uint32_t packedSize;        // State blocks as stored (after the thumbnail)
+    uint32_t thumbnailPackedSize;
+    uint16_t thumbnailWidth;    // Thumbnail is palette indices, then one emphasis byte per row
+    uint16_t thumbnailHeight;
+    uint32_t packedChecksum;    // FNV-1a of the state blocks as stored - catches damage the codec can't
+    uint8_t mapper;
+    uint8_t reserved[3];
+};
+
+// Timings are in milliseconds, and all of them are for the most recent save/load
+struct SaveStateStats
+{
+    uint32_t saves;
+    uint32_t loads;
+    uint32_t lastRawSize;
+    uint32_t lastPackedSize;
+    uint64_t totalRawSize;
+    uint64_t totalPackedSize;
+    double serializeTime;   // On the emulation thread - the only part a save can hitch
+    double compressTime;
+    double writeTime;
+    double saveLatency;     // From the save being asked for to the file being in place
+    double loadTime;        // Read, decompress and restore (all on the emulation thread)
+};
+
+// Members of a plain struct, so a difference somewhere inside one can be put down to a member by name
+struct StateMember
+{
+    const char* name;
+    size_t offset;
+    size_t size;
+};
+
+// Where one named field landed in serialized state (see NESDL_StateWriter::layout)
+struct StateField
+{
+    const char* name;
+    size_t offset;
+    size_t size;
+    size_t elementSize;             // Same as size, unless it's an array
+    const StateMember* members;     // The element type's members, if it has a table (see NESDL_STATE_MEMBERS)
+    size_t memberCount;
+};
+
+// Structs that go into save states whole declare their members with NESDL_STATE_MEMBERS right after
+// the struct itself. Anything without a table just gets reported by field name and byte offset
+template <typename T>
+struct NESDL_StateMembers
+{
+    static constexpr const StateMember* members = nullptr;
+    static constexpr size_t count = 0;
+};
+#define NESDL_STATE_MEMBER(type, member) StateMember { #type "::" #member, offsetof(type, member), sizeof(type::member) }
+#define NESDL_STATE_MEMBERS(type, ...) \
+    template <> \
+    struct NESDL_StateMembers<type> \
+    { \
+        static inline const StateMember members[] = { __VA_ARGS__ }; \
+        static constexpr size_t count = sizeof(members) / sizeof(StateMember); \
+    };
+
+class NESDL_StateWriter
+{
+public:
+    // name is only kept if layout is set - it's what a divergence report calls the field
+    template <typename T>
+    void Write(const T& value, const char* name)
+    {
+        static_assert(is_trivially_copyable<T>::value, "Only plain data goes in a save state");
+        typedef remove_all_extents_t<T> Element;
+        if (layout != nullptr)
+        {
+            layout->push_back({ name, data.size(), sizeof(T), sizeof(Element),
+                                NESDL_StateMembers<Element>::members, NESDL_StateMembers<Element>::count });
+        }
+        const uint8_t* bytes = (const uint8_t*)&value;
+        data.insert(data.end(), bytes, bytes + sizeof(T));
+    }
+    void WriteBytes(const void* src, size_t length, const char* name)
+    {
+        if (layout != nullptr)
+        {
+            layout->push_back({ name, data.size(), length, 1, nullptr, 0 });
+        }
+        const uint8_t* bytes = (const uint8_t*)src;
+        data.insert(data.end(), bytes, bytes + length);
+    }
+
+    vector<uint8_t> data;
+    vector<StateField>* layout = nullptr; // Set to also collect where every field went
+};
+
+class NESDL_StateReader
+{
+public:
+    // Either plain serialized state, or the compressed blocks of a save state file
+    NESDL_StateReader(const uint8_t* src, size_t size, bool compressed);
+    template <typename T>
+    void Read(T& value)
+    {
+        static_assert(is_trivially_copyable<T>::value, "Only plain data goes in a save state");
+        ReadBytes(&value, sizeof(T));
+    }
+    void ReadBytes(void* dst, size_t length);
+    bool Failed() { return failed; }
+    bool AtEnd() { return blockPos == block.size() && src == srcEnd; }
+private:
+    bool NextBlock();
+
+    const uint8_t* src;     // Whatever hasn't been read (or decompressed) yet
+    const uint8_t* srcEnd;
+    bool compressed;
+    vector<uint8_t> block;  // Current decompressed block
+    size_t blockPos;
+    bool failed;
+};
+
+class NESDL_SaveStates
+{
+public:
+    void Init(NESDL_Core* c);
+    void Exit(); // Finishes any writes still queued up
+    // Serializes the machine now and queues it (plus a thumbnail of the last frame) to be written
+    void Save(const string& path, uint64_t romSize);
+    bool Load(const string& path, uint64_t romSize, string& error);
+    void WaitForWrites();
+    SaveStateStats GetStats();
+    // Set once a queued save lands on disk (or fails) - the emulation thread shows it as a notice
+    bool TakeReport(string& report);
+
+    static void Compress(const uint8_t* src, size_t size, vector<uint8_t>& out);
+    static bool Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize);
+    static uint32_t Checksum(const uint8_t* src, size_t size);
+    // Compress, one NESDL_STATE_BLOCK_SIZE block at a time - what NESDL_StateReader expects
+    static void CompressBlocks(const vector<uint8_t>& src, vector<uint8_t>& out);
+private:
+    struct SaveJob
+    {
+        string path;
+        SaveStateFileHeader header;
+        vector<uint8_t> state;
+        vector<uint8_t> thumbnail;
+        chrono::steady_clock::time_point requested;
+    };
+    void WorkerThread();
+    bool WriteJob(SaveJob& job, double& compressTime, double& writeTime);
+
+    NESDL_Core* core;
+
+    thread worker;
+    mutex jobMutex;
+    condition_variable jobSignal;       // Worker waits on this for jobs
+    condition_variable idleSignal;      // WaitForWrites waits on this for the queue to empty
+    queue<SaveJob> jobs;
+    bool jobRunning;
+    bool stopRequested;
+
+    mutex statsMutex;
+    SaveStateStats stats;
+    string report;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+// Define NESDL_TRACING (project preprocessor settings, or uncomment below) to record a timeline
+// of host work and emulated events, written out as Chrome Trace Event JSON (chrome://tracing,
+// ui.perfetto.dev). Without it, every tracing macro compiles to nothing
+//#define NESDL_TRACING
+
+// Events per thread buffered before the flush thread gets to them (must be a power of 2)
+#define NESDL_TRACE_BUFFER_SIZE 16384
+// How often the flush thread drains the buffers, in milliseconds
+#define NESDL_TRACE_FLUSH_MS 50
+
+#ifdef NESDL_TRACING
+
+struct NESDL_TraceEvent
+{
+    const char* name;   // Must be a string literal - it's read later by the flush thread
+    char phase;         // 'X' (span with duration) or 'i' (instant)
+    bool emulated;      // Timestamps are master clock cycles instead of host performance ticks
+    uint64_t timestamp;
+    uint64_t duration;
+    uint32_t arg;
+};
+
+// Single producer (the owning thread) / single consumer (the flush thread) ring
+class NESDL_TraceBuffer
+{
+public:
+    NESDL_TraceBuffer(uint32_t index) : threadIndex(index), dropped(0), head(0), tail(0) {}
+    void Push(const NESDL_TraceEvent& event);
+    bool Pop(NESDL_TraceEvent& event);
+    
+    uint32_t threadIndex;
+    atomic<uint64_t> dropped;
+private:
+    NESDL_TraceEvent events[NESDL_TRACE_BUFFER_SIZE];
+    atomic<uint32_t> head;
+    atomic<uint32_t> tail;
+};
+
+class NESDL_Trace
+{
+public:
+    static bool Start(const char* path);
+    static void Stop();
+    static void Record(const char* name, char phase, bool emulated, uint64_t timestamp, uint64_t duration, uint32_t arg);
+    
+    static atomic<bool> enabled;
+private:
+    static NESDL_TraceBuffer* GetThreadBuffer();
+    static void FlushThread();
+    static void Drain();
+    
+    static mutex buffersMutex;
+    static vector<unique_ptr<NESDL_TraceBuffer>> buffers;
+    static thread flushThread;
+    static mutex flushMutex;
+    static condition_variable flushSignal;
+    static bool stopRequested;
+    static ofstream file;
+    static bool firstEvent;
+    static uint64_t startTicks;
+};
+
+// Host span covering the rest of the enclosing scope
+class NESDL_TraceScope
+{
+public:
+    NESDL_TraceScope(const char* name) : name(name), start(NESDL_Trace::enabled.load(memory_order_relaxed) ? SDL_GetPerformanceCounter() : 0) {}
+    ~NESDL_TraceScope()
+    {
+        if (start != 0)
+        {
+            NESDL_Trace::Record(name, 'X', false, start, SDL_GetPerformanceCounter() - start, 0);
+        }
+    }
+private:
+    const char* name;
+    uint64_t start;
+};
+
+#define NESDL_TRACE_START(path) NESDL_Trace::Start(path)
+#define NESDL_TRACE_STOP() NESDL_Trace::Stop()
+#define NESDL_TRACE_SCOPE(name) NESDL_TraceScope traceScope(name)
+// Emulated events take master clock timestamps (PPU dots * 4)
+#define NESDL_TRACE_EMU_INSTANT(name, clock, arg) do { if (NESDL_Trace::enabled.load(memory_order_relaxed)) NESDL_Trace::Record(name, 'i', true, clock, 0, arg); } while (0)
+#define NESDL_TRACE_EMU_SPAN(name, clock, duration, arg) do { if (NESDL_Trace::enabled.load(memory_order_relaxed)) NESDL_Trace::Record(name, 'X', true, clock, duration, arg); } while (0)
+
+#else
+
+#define NESDL_TRACE_START(path)
+#define NESDL_TRACE_STOP()
+#define NESDL_TRACE_SCOPE(name)
+#define NESDL_TRACE_EMU_INSTANT(name, clock, arg)
+#define NESDL_TRACE_EMU_SPAN(name, clock, duration, arg)
+
+#endif
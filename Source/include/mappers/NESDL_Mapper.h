@@ -12,39 +12,263 @@ enum MirroringMode
 class NESDL_Mapper
 {
 public:
-    NESDL_Mapper(NESDL_Core* c) : core(c) {}
-    ~NESDL_Mapper() { if (prgROM != nullptr) free(prgROM); if (chrROM != nullptr) free(chrROM); }
-    virtual void InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks) {}
+    NESDL_Mapper(NESDL_Core* c) : core(c), mirroringMode(MirroringMode::Horizontal), prgROM(nullptr), chrROM(nullptr),
+                                  prgRAM(prgRAMData), battery(nullptr)
+    {
+        memset(prgRAMData, 0x00, sizeof(prgRAMData));
+    }
+    virtual ~NESDL_Mapper() {}
+    virtual void InitROMData(const uint8_t* prgROMData, uint8_t prgROMBanks, const uint8_t* chrROMData, uint8_t chrROMBanks) {}
     virtual void SetMirroringData(bool data) {}
-    virtual MirroringMode GetMirroringMode() { return MirroringMode::Horizontal; }
+    MirroringMode GetMirroringMode() { return mirroringMode; } // Every nametable access asks, so it's not virtual
     virtual uint8_t ReadByte(uint16_t addr) { return 0; }
     virtual void WriteByte(uint16_t addr, uint8_t data) {}
+    virtual int32_t GetPRGROMOffset(uint16_t addr) { return -1; } // PRG-ROM byte a CPU address maps to (-1 if none)
+    // The 256 bytes of a CPU page (addr is page-aligned) if they're plain memory that reads back with no
+    // side effects, so OAM DMA can copy them in one go. nullptr sends it down the byte-by-byte ReadByte path
+    virtual const uint8_t* GetPRGPage(uint16_t addr)
+    {
+        int32_t offset = GetPRGROMOffset(addr);
+        return offset >= 0 ? prgROM + offset : nullptr;
+    }
+    void SetBatteryRAM(NESDL_BatteryRAM* b) // nullptr goes back to plain (volatile) PRG-RAM
+    {
+        battery = b;
+        prgRAM = b != nullptr ? b->GetData() : prgRAMData;
+    }
+    // Save states - mirroring and cartridge RAM here, bank registers in whichever mapper has them
+    virtual void SaveState(NESDL_StateWriter& state)
+    {
+        state.Write(mirroringMode, "mirroringMode");
+        state.WriteBytes(prgRAM, sizeof(prgRAMData), "prgRAM");
+        if (chrBanks == 0)
+        {
+            state.Write(chrRAM, "chrRAM");
+        }
+    }
+    virtual void LoadState(NESDL_StateReader& state)
+    {
+        state.Read(mirroringMode);
+        state.ReadBytes(prgRAM, sizeof(prgRAMData));
+        if (battery != nullptr)
+        {
+            // Loading a state rolls the save file back too, same as on a real cartridge
+            for (uint32_t offset = 0; offset < sizeof(prgRAMData); offset += NESDL_BATTERY_PAGE_SIZE)
+            {
+                battery->MarkDirty(offset);
+            }
+        }
+        if (chrBanks == 0)
+        {
+            state.Read(chrRAM);
+        }
+    }
     
     uint8_t mapperNumber;
 protected:
     NESDL_Core* core;
     MirroringMode mirroringMode;
-    uint8_t* prgROM;
-    uint8_t* chrROM;
+    // PRG/CHR-ROM point straight into the core's memory-mapped ROM file (the mapper doesn't own them).
+    // Cartridges without CHR-ROM get chrRAM instead, and chrROM points at that
+    const uint8_t* prgROM;
+    const uint8_t* chrROM;
+    uint8_t chrRAM[0x2000];
+    // 8KB of PRG-RAM at $6000-$7FFF, for mappers that have it. prgRAM points at the battery's
+    // .sav mapping if the cartridge has a battery, otherwise at prgRAMData
+    void WritePRGRAM(uint16_t offset, uint8_t data)
+    {
+        bool changed = prgRAM[offset] != data;
+        prgRAM[offset] = data;
+        if (changed && battery != nullptr)
+        {
+            battery->MarkDirty(offset);
+        }
+    }
+    uint8_t* prgRAM;
+    uint8_t prgRAMData[0x2000];
+    NESDL_BatteryRAM* battery;
     uint8_t prgBanks;
     uint8_t chrBanks;
 };
 
+// How a banked mapper's nametable mirroring is decided
+enum class MapperMirroring : uint8_t
+{
+    Header,     // Soldered on the board - comes from the iNES header (SetMirroringData)
+    Register    // Switched by the mapper's own registers, which set mirroringMode
+};
+
+/// Base for mappers that switch fixed-size windows of PRG-ROM and CHR around. The board's layout is
+/// all template parameters, so a read comes down to a shift, a mask and a table lookup, and bank
+/// arithmetic only happens when a bank actually changes. A mapper built on this only provides:
+///
+///   void ResetBanks()                               - Power-on layout (MapPRG/MapCHR every window)
+///   void WriteRegister(uint16_t addr, uint8_t data) - CPU writes to $8000-$FFFF
+///
+/// and, if it keeps any registers of its own, SaveRegisters/LoadRegisters for save states.
+/// CHR-RAM (cartridges without CHR-ROM) and PRG-RAM are handled here. These are all called on
+/// Derived directly, not through a virtual
+template <typename Derived, uint32_t PRGWindowSize, uint32_t CHRWindowSize, MapperMirroring Mirroring, bool HasPRGRAM>
+class NESDL_BankedMapper : public NESDL_Mapper
+{
+    static_assert((PRGWindowSize & (PRGWindowSize - 1)) == 0 && PRGWindowSize >= 0x2000 && PRGWindowSize <= 0x8000,
+                  "PRG windows are 8KB, 16KB or 32KB");
+    static_assert((CHRWindowSize & (CHRWindowSize - 1)) == 0 && CHRWindowSize >= 0x400 && CHRWindowSize <= 0x2000,
+                  "CHR windows are 1KB to 8KB");
+public:
+    using NESDL_Mapper::NESDL_Mapper; // Inherit constructor(s)
+    virtual void InitROMData(const uint8_t* prgROMData, uint8_t prgROMBanks, const uint8_t* chrROMData, uint8_t chrROMBanks)
+    {
+        prgBanks = prgROMBanks;
+        chrBanks = chrROMBanks;
+        
+        // PRG-ROM (and CHR-ROM, if any) are used in place, straight out of the ROM file
+        prgROM = prgROMData;
+        prgWindowBanks = max(1u, prgROMBanks * 0x4000u / PRGWindowSize);
+        
+        // Init CHR-ROM data
+        if (chrBanks > 0)
+        {
+            chrROM = chrROMData;
+            chrWindowBanks = chrROMBanks * 0x2000u / CHRWindowSize;
+        }
+        else
+        {
+            // Assume 8KB of CHR-RAM
+            memset(chrRAM, 0x00, sizeof(chrRAM));
+            chrROM = chrRAM;
+            chrWindowBanks = sizeof(chrRAM) / CHRWindowSize;
+        }
+        static_cast<Derived*>(this)->ResetBanks();
+    }
+    virtual void SetMirroringData(bool data)
+    {
+        if constexpr (Mirroring == MapperMirroring::Header)
+        {
+            mirroringMode = data ? MirroringMode::Vertical : MirroringMode::Horizontal;
+        }
+    }
+    virtual uint8_t ReadByte(uint16_t addr)
+    {
+        if (addr < 0x2000)
+        {
+            return chrROM[chrOffsets[addr / CHRWindowSize] + (addr % CHRWindowSize)];
+        }
+        if (addr >= 0x8000)
+        {
+            return prgROM[prgOffsets[(addr - 0x8000) / PRGWindowSize] + (addr % PRGWindowSize)];
+        }
+        if constexpr (HasPRGRAM)
+        {
+            if (addr >= 0x6000)
+            {
+                return prgRAM[addr - 0x6000];
+            }
+        }
+        return 0;
+    }
+    virtual void WriteByte(uint16_t addr, uint8_t data)
+    {
+        if (addr < 0x2000)
+        {
+            // Only writable if it's CHR-RAM
+            if (chrBanks == 0)
+            {
+                chrRAM[chrOffsets[addr / CHRWindowSize] + (addr % CHRWindowSize)] = data;
+            }
+        }
+        else if (addr >= 0x8000)
+        {
+            static_cast<Derived*>(this)->WriteRegister(addr, data);
+        }
+        else if constexpr (HasPRGRAM)
+        {
+            if (addr >= 0x6000)
+            {
+                WritePRGRAM(addr - 0x6000, data);
+            }
+        }
+    }
+    virtual int32_t GetPRGROMOffset(uint16_t addr)
+    {
+        if (addr < 0x8000)
+        {
+            return -1;
+        }
+        return prgOffsets[(addr - 0x8000) / PRGWindowSize] + (addr % PRGWindowSize);
+    }
+    virtual void SaveState(NESDL_StateWriter& state)
+    {
+        NESDL_Mapper::SaveState(state);
+        state.Write(prgOffsets, "prgOffsets");
+        state.Write(chrOffsets, "chrOffsets");
+        static_cast<Derived*>(this)->SaveRegisters(state);
+    }
+    virtual void LoadState(NESDL_StateReader& state)
+    {
+        NESDL_Mapper::LoadState(state);
+        state.Read(prgOffsets);
+        state.Read(chrOffsets);
+        static_cast<Derived*>(this)->LoadRegisters(state);
+    }
+    // Nothing to save beyond the bank layout, unless Derived has its own
+    void SaveRegisters(NESDL_StateWriter& /*state*/) {}
+    void LoadRegisters(NESDL_StateReader& /*state*/) {}
+    virtual const uint8_t* GetPRGPage(uint16_t addr)
+    {
+        // Windows are at least 8KB, so a page never straddles two banks
+        if (addr >= 0x8000)
+        {
+            return prgROM + prgOffsets[(addr - 0x8000) / PRGWindowSize] + (addr % PRGWindowSize);
+        }
+        if constexpr (HasPRGRAM)
+        {
+            if (addr >= 0x6000)
+            {
+                return prgRAM + (addr - 0x6000);
+            }
+        }
+        return nullptr;
+    }
+protected:
+    static constexpr uint32_t PRGWindows = 0x8000 / PRGWindowSize;
+    static constexpr uint32_t CHRWindows = 0x2000 / CHRWindowSize;
+    
+    // Puts a bank in a window. Banks are counted in window-sized units, wrap around at the end of
+    // the ROM (like the address lines a smaller board doesn't connect), and count back from the last
+    // bank if negative (-1 is the last bank, -2 the one before it)
+    void MapPRG(uint32_t window, int32_t bank)
+    {
+        prgOffsets[window] = WrapBank(bank, prgWindowBanks) * PRGWindowSize;
+    }
+    void MapCHR(uint32_t window, int32_t bank)
+    {
+        chrOffsets[window] = WrapBank(bank, chrWindowBanks) * CHRWindowSize;
+    }
+private:
+    static uint32_t WrapBank(int32_t bank, uint32_t count)
+    {
+        int32_t wrapped = bank % (int32_t)count;
+        return wrapped < 0 ? wrapped + count : wrapped;
+    }
+    uint32_t prgOffsets[PRGWindows];    // Where in prgROM each window starts
+    uint32_t chrOffsets[CHRWindows];    // Where in chrROM each window starts
+    uint32_t prgWindowBanks;            // Window-sized banks in PRG-ROM
+    uint32_t chrWindowBanks;            // Window-sized banks in CHR-ROM (or RAM)
+};
+
 /// iNES Header 000 - "NROM" (Released July 1983, "Donkey Kong" JP)
 /// https://www.nesdev.org/wiki/NROM
 ///
 /// The first mapping scheme designated by the iNES standard, and also the first board available.
 /// As such, it is also very basic, providing no bank switching, no interrupts, no battery RAM
 /// (Excitebike US lied!), and only 2 nametable mirroring configs (horizontal and vertical).
-class NESDL_Mapper_0 : public NESDL_Mapper
+class NESDL_Mapper_0 final : public NESDL_BankedMapper<NESDL_Mapper_0, 0x4000, 0x2000, MapperMirroring::Header, false>
 {
 public:
-    using NESDL_Mapper::NESDL_Mapper; // Inherit constructor(s)
-    virtual void InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks);
-    virtual void SetMirroringData(bool data);
-    MirroringMode GetMirroringMode() { return mirroringMode; }
-    virtual uint8_t ReadByte(uint16_t addr);
-    // No WriteByte - at least, not until Family BASIC gets supported
+    using NESDL_BankedMapper::NESDL_BankedMapper; // Inherit constructor(s)
+    void ResetBanks();
+    void WriteRegister(uint16_t /*addr*/, uint8_t /*data*/) {} // Nothing to write to - at least, not until Family BASIC gets supported
 };
 
 /// iNES Header 001 - "MMC1" (Released April 1987, "Morita Shougi" JP)
@@ -53,18 +277,19 @@ public:
 /// The most popular mapper across the entire library of games, covering over 680
 /// individual (known) releases! It is a simple but effective mapper, lacking IRQ or
 /// any fancy conveniences, but providing great bank-switching and NT-switching capabilities.
-class NESDL_Mapper_1 : public NESDL_Mapper
+class NESDL_Mapper_1 final : public NESDL_BankedMapper<NESDL_Mapper_1, 0x4000, 0x1000, MapperMirroring::Register, true>
 {
 public:
-    using NESDL_Mapper::NESDL_Mapper; // Inherit constructor(s)
-    virtual void InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks);
-    MirroringMode GetMirroringMode() { return mirroringMode; }
-    virtual uint8_t ReadByte(uint16_t addr);
-    virtual void WriteByte(uint16_t addr, uint8_t data);
+    using NESDL_BankedMapper::NESDL_BankedMapper; // Inherit constructor(s)
+    void ResetBanks();
+    void WriteRegister(uint16_t addr, uint8_t data);
+    void SaveRegisters(NESDL_StateWriter& state);
+    void LoadRegisters(NESDL_StateReader& state);
 private:
     void WriteControl();
     void WriteCHRBank(uint8_t index);
     void WritePRGBank();
+    void UpdateBanks();
     uint8_t shiftRegister;
     uint8_t shiftIndex;
     uint8_t prgROM0Index;   // PRG 16KB bank 1
@@ -72,9 +297,33 @@ private:
     uint8_t chrROM0Index;   // CHR  4KB bank 1
     uint8_t chrROM1Index;   // CHR  4KB bank 2
     uint8_t prgROMMode;
-    uint8_t prgRAM[0x2000];
     bool chrROMMode;
-    bool prgRAMEnable;
+};
+
+/// iNES Header 002 - "UxROM"
+/// https://www.nesdev.org/wiki/UxROM
+///
+/// Nintendo's UNROM and UOROM boards (Mega Man, Castlevania, Contra, DuckTales...). One switchable
+/// 16KB PRG bank at $8000 with the last bank fixed at $C000, and CHR-RAM instead of CHR-ROM.
+class NESDL_Mapper_2 final : public NESDL_BankedMapper<NESDL_Mapper_2, 0x4000, 0x2000, MapperMirroring::Header, false>
+{
+public:
+    using NESDL_BankedMapper::NESDL_BankedMapper; // Inherit constructor(s)
+    void ResetBanks();
+    void WriteRegister(uint16_t addr, uint8_t data);
+};
+
+/// iNES Header 003 - "CNROM"
+/// https://www.nesdev.org/wiki/CNROM
+///
+/// NROM with switchable CHR - PRG-ROM is fixed (16KB or 32KB, same as NROM), and the whole 8KB
+/// of CHR-ROM can be swapped out in one go.
+class NESDL_Mapper_3 final : public NESDL_BankedMapper<NESDL_Mapper_3, 0x4000, 0x2000, MapperMirroring::Header, false>
+{
+public:
+    using NESDL_BankedMapper::NESDL_BankedMapper; // Inherit constructor(s)
+    void ResetBanks();
+    void WriteRegister(uint16_t addr, uint8_t data);
 };
 
 /// iNES Header 004 - "MMC3" (Released October 1988, "Super Mario Bros 2" US)
@@ -83,17 +332,28 @@ private:
 /// Second-most popular mapper, and one with some of the most popular titles - Mega Man 3-6,
 /// Super Mario Bros. 2 and 3, and Kirby's Adventure to name a few. A great well-rounded cartridge
 /// to handle most use cases, 4-way nametable mirroring, and even a scanline timer (wow).
-class NESDL_Mapper_4 : public NESDL_Mapper
+class NESDL_Mapper_4 final : public NESDL_BankedMapper<NESDL_Mapper_4, 0x2000, 0x400, MapperMirroring::Register, true>
 {
 public:
-    using NESDL_Mapper::NESDL_Mapper; // Inherit constructor(s)
-    virtual void InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks);
-    MirroringMode GetMirroringMode() { return mirroringMode; }
+    using NESDL_BankedMapper::NESDL_BankedMapper; // Inherit constructor(s)
+    void ResetBanks();
     void SetFourWayMirroring(uint8_t fourWayMirroringMode);
-    virtual uint8_t ReadByte(uint16_t addr);
-    virtual void WriteByte(uint16_t addr, uint8_t data);
-    void ClockIRQ();
+    void WriteRegister(uint16_t addr, uint8_t data);
+    void SaveRegisters(NESDL_StateWriter& state);
+    void LoadRegisters(NESDL_StateReader& state);
+    // The scanline counter isn't clocked by the PPU every line. Instead, SyncIRQ works out how many
+    // lines went by since it last ran, and ScheduleIRQ tells the PPU the one dot the next IRQ fires at
+    // (ppu->mapperIRQAt). Anything that changes the counter or when it's clocked syncs before, and
+    // reschedules after
+    void ClockIRQ();            // Extra clock from A12 rising outside of rendering ($2006/$2007)
+    void SyncIRQ();
+    void ScheduleIRQ();
+    void RunPredictedIRQ();     // The PPU got to mapperIRQAt
+    void RestartIRQTiming();    // PPU timeline isn't the one we last synced against (new mapper)
 private:
+    void UpdateBanks();
+    uint16_t GetIRQClockDot();
+    uint64_t GetIRQClockBase(uint64_t now);
     bool mirroringModeHardwired;
     uint8_t prgROM0Index;   // PRG 8KB bank   (0x8000 - 0x9FFF or 0xC000 - 0xDFFF, toggleable)
     uint8_t prgROM1Index;   // PRG 8KB bank   (0xA000 - 0xBFFF)
@@ -103,13 +363,26 @@ private:
     uint8_t chrROM3Index;   // CHR 1KB bank 4
     uint8_t chrROM4Index;   // CHR 1KB bank 5
     uint8_t chrROM5Index;   // CHR 1KB bank 6
-    uint8_t prgRAM[0x2000];
     uint8_t bankRegisterMode;
     uint8_t prgROMBankMode;
     uint8_t chrA12Inversion;
     bool irqEnabled;
     uint8_t irqCounter;
     uint8_t irqCounterReload;
+    uint64_t irqSyncedAt;       // PPU cycle irqCounter is up to date as of
+};
+
+/// iNES Header 007 - "AxROM"
+/// https://www.nesdev.org/wiki/AxROM
+///
+/// Rare's boards of choice (Battletoads, Marble Madness, Wizards & Warriors). The whole 32KB of
+/// PRG-ROM switches at once, CHR is RAM, and a register bit picks which nametable every screen shows.
+class NESDL_Mapper_7 final : public NESDL_BankedMapper<NESDL_Mapper_7, 0x8000, 0x2000, MapperMirroring::Register, false>
+{
+public:
+    using NESDL_BankedMapper::NESDL_BankedMapper; // Inherit constructor(s)
+    void ResetBanks();
+    void WriteRegister(uint16_t addr, uint8_t data);
 };
 
 /// iNES Header 09  - "MMC2" (Released October 1987, "Mike Tyson's Punch-Out!!" US)
@@ -118,14 +391,16 @@ private:
 /// A mapper in which only one game was made on it - Mike Tyson's Punch-Out!! (and later Punch-Out!!)
 /// Very similar to MMC1 except it doesn't use a shift register to handle bank switching -
 /// simple address writes do the job. It's almost like a simpler version of MMC1, which is great for us
-class NESDL_Mapper_9 : public NESDL_Mapper
+class NESDL_Mapper_9 final : public NESDL_Mapper
 {
 public:
     using NESDL_Mapper::NESDL_Mapper; // Inherit constructor(s)
-    virtual void InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks);
-    MirroringMode GetMirroringMode() { return mirroringMode; }
+    virtual void InitROMData(const uint8_t* prgROMData, uint8_t prgROMBanks, const uint8_t* chrROMData, uint8_t chrROMBanks);
     virtual uint8_t ReadByte(uint16_t addr);
     virtual void WriteByte(uint16_t addr, uint8_t data);
+    virtual int32_t GetPRGROMOffset(uint16_t addr);
+    virtual void SaveState(NESDL_StateWriter& state);
+    virtual void LoadState(NESDL_StateReader& state);
 private:
     uint8_t prgROMIndex;    // PRG 8KB bank   (0x8000 - 0x9FFF)
     uint8_t chrROM0Index0;  // CHR 4KB bank 1 - Latch 0 0xFD (0x0000 - 0x0FFF)
@@ -134,5 +409,4 @@ private:
     uint8_t chrROM1Index1;  // CHR 4KB bank 2 - Latch 1 0xFE (0x1000 - 0x1FFF)
     uint8_t chrROM0Latch;   // Can be either 0xFD or 0xFE
     uint8_t chrROM1Latch;
-    uint8_t prgRAM[0x2000];
 };
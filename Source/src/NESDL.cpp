@@ -46,6 +46,8 @@ int main(int argc, char* args[])
     
 //    printf("%s", getcwd(NULL, 0));
 
+    NESDL_TRACE_START("nesdl_trace.json");
+
     // SLEEP for a second while we boot up
     SDL_GetPerformanceCounter();
 
@@ -61,8 +63,11 @@ int main(int argc, char* args[])
         // Counter check for entire program loop (used for framerate capping, not emulation time)
         uint64_t start = SDL_GetPerformanceCounter();
         
+        NESDL_PROFILE_END_FRAME();
+        
         while (SDL_PollEvent(&e))
         {
+            NESDL_PROFILE_SCOPE(Events);
             core->HandleEvent((SDL_EventType)e.type, (SDL_KeyCode)e.key.keysym.sym);
 #ifdef _WIN32
             if (e.type == SDL_SYSWMEVENT)
@@ -15,6 +15,12 @@
 // Menu item callbacks
 - (void) showAbout:(nullable id)sender;
 - (void) openROM:(nullable id)sender;
+- (void) scanROMLibrary:(nullable id)sender;
+- (void) saveState:(nullable id)sender;
+- (void) loadState:(nullable id)sender;
+- (void) nextStateSlot:(nullable id)sender;
+- (void) recordMovie:(nullable id)sender;
+- (void) playMovie:(nullable id)sender;
 - (void) closeROM:(nullable id)sender;
 - (void) resetSoft:(nullable id)sender;
 - (void) resetHard:(nullable id)sender;
@@ -33,6 +39,10 @@
 - (void) debugShowNT:(nullable id)sender;
 - (void) debugAttachLog:(nullable id)sender;
 - (void) debugDetachLog:(nullable id)sender;
+- (void) debugStartTrace:(nullable id)sender;
+- (void) debugStopTrace:(nullable id)sender;
+- (void) debugDumpFlightRecorder:(nullable id)sender;
+- (void) debugFindDivergence:(nullable id)sender;
 @end
 
 @implementation NESDLMac
@@ -72,7 +82,13 @@ NSMenu* AddSubMenuToMenuItem(NSMenuItem* menuItem)
     // Initialize File menu, store in main menu as the first option
     fileMenu = [[NSMenu alloc] initWithTitle:@"File"];
     CreateMenuItemAndAddToMenu(fileMenu, self, @"Open ROM...", @selector(openROM:), @"o");
+    CreateMenuItemAndAddToMenu(fileMenu, self, @"Scan ROM Library...", @selector(scanROMLibrary:), @"");
     CreateMenuItemAndAddToMenu(fileMenu, self, @"Close ROM", @selector(closeROM:), @"c");
+    CreateMenuItemAndAddToMenu(fileMenu, self, @"Save State (F5)", @selector(saveState:), @"");
+    CreateMenuItemAndAddToMenu(fileMenu, self, @"Next State Slot (F6)", @selector(nextStateSlot:), @"");
+    CreateMenuItemAndAddToMenu(fileMenu, self, @"Load State (F7)", @selector(loadState:), @"");
+    CreateMenuItemAndAddToMenu(fileMenu, self, @"Record/Stop Movie (F8)", @selector(recordMovie:), @"");
+    CreateMenuItemAndAddToMenu(fileMenu, self, @"Play/Stop Movie (F9)", @selector(playMovie:), @"");
     CreateMenuItemAndAddToMenu(fileMenu, self, @"Reset System", @selector(resetSoft:), @"t");
     CreateMenuItemAndAddToMenu(fileMenu, self, @"Reset System (Hard)", @selector(resetHard:), @"r");
     CreateMenuItemAndAddToMenu(fileMenu, nullptr, @"Quit", @selector(performClose:), @"q"); // Built-in action
@@ -105,7 +121,11 @@ NSMenu* AddSubMenuToMenuItem(NSMenuItem* menuItem)
 #ifdef _DEBUG
     CreateMenuItemAndAddToMenu(debugMenu, self, @"Attach Nintendulator Log...", @selector(debugAttachLog:), @"");
     CreateMenuItemAndAddToMenu(debugMenu, self, @"Detach Nintendulator Log", @selector(debugDetachLog:), @"");
+    CreateMenuItemAndAddToMenu(debugMenu, self, @"Start CPU Trace...", @selector(debugStartTrace:), @"");
+    CreateMenuItemAndAddToMenu(debugMenu, self, @"Stop CPU Trace", @selector(debugStopTrace:), @"");
+    CreateMenuItemAndAddToMenu(debugMenu, self, @"Dump Flight Recorder", @selector(debugDumpFlightRecorder:), @"");
 #endif
+    CreateMenuItemAndAddToMenu(debugMenu, self, @"Find Movie Divergence", @selector(debugFindDivergence:), @"");
     menuItem = [[NSMenuItem alloc] init];
     [menuItem setSubmenu:debugMenu];
     [[NSApp mainMenu] insertItem:menuItem atIndex:3];
@@ -121,6 +141,24 @@ NSMenu* AddSubMenuToMenuItem(NSMenuItem* menuItem)
 - (void) openROM:(nullable id)sender {
     nesdl.core->Action_OpenROM();
 }
+- (void) scanROMLibrary:(nullable id)sender {
+    nesdl.core->Action_ScanROMLibrary();
+}
+- (void) saveState:(nullable id)sender {
+    nesdl.core->Action_SaveState();
+}
+- (void) loadState:(nullable id)sender {
+    nesdl.core->Action_LoadState();
+}
+- (void) nextStateSlot:(nullable id)sender {
+    nesdl.core->Action_NextStateSlot();
+}
+- (void) recordMovie:(nullable id)sender {
+    nesdl.core->Action_RecordMovie();
+}
+- (void) playMovie:(nullable id)sender {
+    nesdl.core->Action_PlayMovie();
+}
 - (void) closeROM:(nullable id)sender {
     nesdl.core->Action_CloseROM();
 }
@@ -175,6 +213,18 @@ NSMenu* AddSubMenuToMenuItem(NSMenuItem* menuItem)
 - (void) debugDetachLog:(nullable id)sender {
     nesdl.core->Action_DetachNintendulatorLog();
 }
+- (void) debugStartTrace:(nullable id)sender {
+    nesdl.core->Action_StartCPUTrace();
+}
+- (void) debugStopTrace:(nullable id)sender {
+    nesdl.core->Action_StopCPUTrace();
+}
+- (void) debugDumpFlightRecorder:(nullable id)sender {
+    nesdl.core->Action_DumpFlightRecorder();
+}
+- (void) debugFindDivergence:(nullable id)sender {
+    nesdl.core->Action_FindMovieDivergence();
+}
 
 @end
 
@@ -6,6 +6,7 @@ void NESDL_APU::Init(NESDL_Core* c, NESDL_SDL* s)
     sdlCtx = s;
     
     ppuElapsedCycles = 0;
+    ppuCyclePhase = 0;
     
     sequencer.steps = 4;
     counters.noiseLFSR = 1; // Load up LFSR with a bit set for XOR to work off of
@@ -34,15 +35,61 @@ void NESDL_APU::Reset()
     dmcDMACPUCycles = 0;
 }
 
+void NESDL_APU::SaveState(NESDL_StateWriter& state)
+{
+    state.Write(ppuElapsedCycles, "ppuElapsedCycles");
+    state.Write(ppuCyclePhase, "ppuCyclePhase");
+    state.Write(cpuClockSampleTimer, "cpuClockSampleTimer");
+    state.Write(counters, "counters");
+    state.Write(square1Envelope, "square1Envelope");
+    state.Write(square2Envelope, "square2Envelope");
+    state.Write(noiseEnvelope, "noiseEnvelope");
+    state.Write(dmcDMASchedule, "dmcDMASchedule");
+    state.Write(dmcDMACPUCycles, "dmcDMACPUCycles");
+    state.Write(square1, "square1");
+    state.Write(square2, "square2");
+    state.Write(tri, "tri");
+    state.Write(noise, "noise");
+    state.Write(dmc, "dmc");
+    state.Write(status, "status");
+    state.Write(sequencer, "sequencer");
+}
+
+void NESDL_APU::LoadState(NESDL_StateReader& state)
+{
+    state.Read(ppuElapsedCycles);
+    state.Read(ppuCyclePhase);
+    state.Read(cpuClockSampleTimer);
+    state.Read(counters);
+    state.Read(square1Envelope);
+    state.Read(square2Envelope);
+    state.Read(noiseEnvelope);
+    state.Read(dmcDMASchedule);
+    state.Read(dmcDMACPUCycles);
+    state.Read(square1);
+    state.Read(square2);
+    state.Read(tri);
+    state.Read(noise);
+    state.Read(dmc);
+    state.Read(status);
+    state.Read(sequencer);
+}
+
 void NESDL_APU::Update(uint32_t ppuCycles)
 {
     // Update cycle counters (used to detect when to update values - APU sequencer and generators)
     ppuElapsedCycles += ppuCycles;
     counters.sequencerPPUCounter += ppuCycles;
     
+    ppuCyclePhase += ppuCycles;
+    while (ppuCyclePhase >= 6)
+    {
+        ppuCyclePhase -= 6;
+    }
+    
     // CPU/APU update flags
-    bool doCPUUpdate = ppuElapsedCycles % 3 == 0;
-    bool doAPUUpdate = ppuElapsedCycles % 6 == 3;
+    bool doCPUUpdate = ppuCyclePhase == 0 || ppuCyclePhase == 3;
+    bool doAPUUpdate = ppuCyclePhase == 3;
 
 
     UpdateAPUFrameCounter();
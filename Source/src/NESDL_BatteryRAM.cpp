@@ -0,0 +1,181 @@
+#include "NESDL.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+NESDL_BatteryRAM::NESDL_BatteryRAM()
+{
+    data = nullptr;
+    size = 0;
+    dirtyPages = 0;
+#ifdef _WIN32
+    fileHandle = INVALID_HANDLE_VALUE;
+    mappingHandle = NULL;
+#else
+    fileDescriptor = -1;
+#endif
+    stopRequested = false;
+}
+
+NESDL_BatteryRAM::~NESDL_BatteryRAM()
+{
+    Close();
+}
+
+bool NESDL_BatteryRAM::Open(const char* path, uint32_t ramSize)
+{
+    Close();
+    if (ramSize == 0 || ramSize > NESDL_BATTERY_MAX_SIZE)
+    {
+        return false;
+    }
+
+    // The file is grown to the RAM size if it's new (or short) - the OS fills the gap with zeros.
+    // Longer files are left alone and only the front of them is mapped
+#ifdef _WIN32
+    fileHandle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize))
+    {
+        Close();
+        return false;
+    }
+    if (fileSize.QuadPart < ramSize)
+    {
+        fileSize.QuadPart = ramSize;
+        if (!SetFilePointerEx(fileHandle, fileSize, NULL, FILE_BEGIN) || !SetEndOfFile(fileHandle))
+        {
+            Close();
+            return false;
+        }
+    }
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, 0, ramSize, NULL);
+    if (mappingHandle == NULL)
+    {
+        Close();
+        return false;
+    }
+    data = (uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, ramSize);
+#else
+    fileDescriptor = open(path, O_RDWR | O_CREAT, 0644);
+    if (fileDescriptor < 0)
+    {
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 ||
+        (fileStat.st_size < ramSize && ftruncate(fileDescriptor, ramSize) != 0))
+    {
+        Close();
+        return false;
+    }
+    void* mapped = mmap(nullptr, ramSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    data = mapped == MAP_FAILED ? nullptr : (uint8_t*)mapped;
+#endif
+    if (data == nullptr)
+    {
+        Close();
+        return false;
+    }
+    size = ramSize;
+    dirtyPages = 0;
+    stopRequested = false;
+    flushThread = thread(&NESDL_BatteryRAM::FlushThread, this);
+    return true;
+}
+
+void NESDL_BatteryRAM::Close()
+{
+    if (flushThread.joinable())
+    {
+        {
+            lock_guard<mutex> lock(flushMutex);
+            stopRequested = true;
+        }
+        flushSignal.notify_one();
+        flushThread.join();
+
+        // Anything written since the last flush
+        Flush();
+    }
+#ifdef _WIN32
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != NULL)
+    {
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (data != nullptr)
+    {
+        munmap(data, size);
+    }
+    if (fileDescriptor >= 0)
+    {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+void NESDL_BatteryRAM::FlushThread()
+{
+    unique_lock<mutex> lock(flushMutex);
+    while (!stopRequested)
+    {
+        flushSignal.wait_for(lock, chrono::milliseconds(NESDL_BATTERY_FLUSH_MS));
+        Flush();
+    }
+}
+
+void NESDL_BatteryRAM::Flush()
+{
+    // Writes to the mapping are already in the OS's file cache (so they'd survive us crashing) -
+    // this is what gets them onto the disk itself
+    uint32_t pages = dirtyPages.exchange(0, memory_order_acquire);
+    if (pages == 0)
+    {
+        return;
+    }
+#ifdef _WIN32
+    for (uint32_t page = 0; pages != 0; ++page, pages >>= 1)
+    {
+        if (pages & 1)
+        {
+            // FlushViewOfFile rounds out to whole OS pages by itself
+            FlushViewOfFile(data + page * NESDL_BATTERY_PAGE_SIZE, NESDL_BATTERY_PAGE_SIZE);
+        }
+    }
+    FlushFileBuffers(fileHandle);
+#else
+    // msync wants an address on an OS page boundary, and OS pages can be bigger than ours
+    // (16KB on Apple Silicon), so each dirty page is widened out to the OS page around it
+    uintptr_t osPageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    for (uint32_t page = 0; pages != 0; ++page, pages >>= 1)
+    {
+        if (pages & 1)
+        {
+            uintptr_t start = (uintptr_t)(data + page * NESDL_BATTERY_PAGE_SIZE) & ~(osPageSize - 1);
+            uintptr_t end = min((uintptr_t)(data + (page + 1) * NESDL_BATTERY_PAGE_SIZE), (uintptr_t)(data + size));
+            msync((void*)start, end - start, MS_SYNC);
+        }
+    }
+#endif
+}
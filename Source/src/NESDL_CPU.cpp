@@ -5,6 +5,10 @@ void NESDL_CPU::Init(NESDL_Core* c)
 {
     core = c;
     addrModeResult = new AddressModeResult();
+    decoded = nullptr;
+    decodeGeneration = 0;
+    fastPaths = true;
+    InvalidateAllDecodedCode();
 }
 
 void NESDL_CPU::Reset(bool hardReset)
@@ -29,10 +33,13 @@ void NESDL_CPU::Reset(bool hardReset)
     {
         registers.p = registers.p & PSTATUS_INTERRUPTDISABLE;
     }
+    LoadLazyFlags();
 
     nmi = false;
     delayNMI = false;
     irq = false;
+    StopIdleLoop();
+    InvalidateAllDecodedCode();
 
     // With the CPU state reset, prime the CPU for program execution
     // CPU warms up for 7 cycles and fetches the start address to PC
@@ -45,6 +52,75 @@ void NESDL_CPU::Reset(bool hardReset)
     nextInstructionPPUCycles = GetCyclesForNextInstruction() * 3;
 
     nintendulatorLogIndex = 0;
+    nintendulatorLogOffset = 0;
+}
+
+void NESDL_CPU::SaveState(NESDL_StateWriter& state)
+{
+    // Everything that carries over from one Update to the next. The decode cache and idle loop
+    // tables are only ever shortcuts, so they're rebuilt rather than saved. Neither are lastOpcode and
+    // the lazy flags - every instruction sets them up before using them, and whatever they hold in
+    // between depends on which shortcuts ran last. addrModeResult is the one scratch value read before
+    // the next instruction runs (for the PPU register timing in Update), so PrimeNextInstruction
+    // dry-runs that instruction again once the rest of the machine is loaded
+    StoreLazyFlags();
+    state.Write(elapsedCycles, "elapsedCycles");
+    state.Write(registers, "registers");
+    state.Write(nmi, "nmi");
+    state.Write(delayNMI, "delayNMI");
+    state.Write(dma, "dma");
+    state.Write(irq, "irq");
+    state.Write(iFlagReady, "iFlagReady");
+    state.Write(iFlagNextSetState, "iFlagNextSetState");
+    state.Write(nextInstructionReady, "nextInstructionReady");
+    state.Write(delayedDMA, "delayedDMA");
+    state.Write(ppuCycleCounter, "ppuCycleCounter");
+    state.Write(nextInstructionPPUCycles, "nextInstructionPPUCycles");
+    state.Write(irqFired, "irqFired");
+    state.Write(nmiFired, "nmiFired");
+    state.Write(didMapperWrite, "didMapperWrite");
+    state.Write(wasLastInstructionAMapperWrite, "wasLastInstructionAMapperWrite");
+}
+
+void NESDL_CPU::LoadState(NESDL_StateReader& state)
+{
+    state.Read(elapsedCycles);
+    state.Read(registers);
+    state.Read(nmi);
+    state.Read(delayNMI);
+    state.Read(dma);
+    state.Read(irq);
+    state.Read(iFlagReady);
+    state.Read(iFlagNextSetState);
+    state.Read(nextInstructionReady);
+    state.Read(delayedDMA);
+    state.Read(ppuCycleCounter);
+    state.Read(nextInstructionPPUCycles);
+    state.Read(irqFired);
+    state.Read(nmiFired);
+    state.Read(didMapperWrite);
+    state.Read(wasLastInstructionAMapperWrite);
+    LoadLazyFlags();
+
+    StopIdleLoop();
+    decoded = nullptr;
+    InvalidateAllDecodedCode();
+}
+
+void NESDL_CPU::PrimeNextInstruction()
+{
+    // Same dry run Update finishes every instruction with, just to leave addrModeResult pointing where
+    // the next instruction goes. Its cycle count is already in nextInstructionPPUCycles
+    GetCyclesForNextInstruction();
+}
+
+void NESDL_CPU::SetFastPaths(bool enabled)
+{
+    // Nothing already decoded or recorded carries over either way
+    fastPaths = enabled;
+    StopIdleLoop();
+    decoded = nullptr;
+    InvalidateAllDecodedCode();
 }
 
 void NESDL_CPU::Update(uint32_t ppuCycles)
@@ -82,6 +158,10 @@ void NESDL_CPU::Update(uint32_t ppuCycles)
             }
             
             EvaluateNintendulatorDebug();
+            if (traceWriter.IsOpen())
+            {
+                WriteTraceRecord();
+            }
 
             // Debug Nintendulator format
             // printf("\n%s", DebugMakeCurrentStateLine().c_str());
@@ -105,6 +185,7 @@ void NESDL_CPU::Update(uint32_t ppuCycles)
             }
 
             uint8_t ppuCyclesElapsed = nextInstructionPPUCycles;
+            const CPUDecodedInstruction* fusedFirst = nullptr;
             if (nmiFired)
             {
                 nmiFired = false;
@@ -118,7 +199,22 @@ void NESDL_CPU::Update(uint32_t ppuCycles)
             else
             {
                 ppuCycleCounter -= nextInstructionPPUCycles;
-                RunNextInstruction();
+                if (idleLoopActive)
+                {
+                    SkipIdleLoopInstruction();
+                }
+                else
+                {
+                    CPURegisters before = registers;
+                    if (idleLoopWatching)
+                    {
+                        // Loop iterations are compared (and replayed) with P as a whole
+                        before.p = flags.Apply(registers.p);
+                    }
+                    RunNextInstruction();
+                    TrackIdleLoop(before, (uint8_t)(elapsedCycles - prevElapsedCycles));
+                    fusedFirst = decoded != nullptr && decoded->fusion != FUSION_NONE ? decoded : nullptr;
+                }
             }
 
             // Handle IRQ line pulled low after instruction (next instruction may be interrupted)
@@ -140,10 +236,25 @@ void NESDL_CPU::Update(uint32_t ppuCycles)
             {
                 iFlagReady = false;
                 registers.p = iFlagNextSetState;
+                LoadLazyFlags();
             }
 
             // Figure out how long our new next instruction will take
-            nextInstructionPPUCycles = GetCyclesForNextInstruction() * 3;
+            // (an idle loop already knows - and doesn't need addrModeResult, it never touches registers.
+            // Neither does the second half of a superinstruction, if it can be worked out directly)
+            uint8_t fusedCycles = fusedFirst != nullptr ? GetCyclesForFusedInstruction(fusedFirst) : 0;
+            if (idleLoopActive)
+            {
+                nextInstructionPPUCycles = idleLoopPPUCycles[idleLoopIndex];
+            }
+            else if (fusedCycles != 0)
+            {
+                nextInstructionPPUCycles = fusedCycles * 3;
+            }
+            else
+            {
+                nextInstructionPPUCycles = GetCyclesForNextInstruction() * 3;
+            }
 
             wasLastInstructionAMapperWrite = didMapperWrite;
             didMapperWrite = false;
@@ -159,6 +270,7 @@ uint8_t NESDL_CPU::GetCyclesForNextInstruction()
 {
     // Run next instruction to see how long it'll take, then reset the CPU state
     CPURegisters regState = registers;
+    CPUFlags flagState = flags;
     uint64_t prevElapsedCycles = elapsedCycles;
     // TODO
     // Well... a better solution to this would be nice. It helps to simulate the
@@ -167,6 +279,7 @@ uint8_t NESDL_CPU::GetCyclesForNextInstruction()
     RunNextInstruction();
     ignoreChanges = false;
     registers = regState;
+    flags = flagState;
     uint8_t result = (uint8_t)(elapsedCycles - prevElapsedCycles); // No cycle counting ever goes above 255
     elapsedCycles = prevElapsedCycles;
     return result;
@@ -175,7 +288,18 @@ uint8_t NESDL_CPU::GetCyclesForNextInstruction()
 void NESDL_CPU::RunNextInstruction()
 {
     // Get next instruction from memory according to current program counter
-    uint8_t opcode = core->ram->ReadByte(registers.pc++);
+    // (from the decode cache if we've seen it before - operands then come from there too)
+    decoded = GetDecodedInstruction(registers.pc);
+    decodedPC = registers.pc;
+    uint8_t opcode = decoded != nullptr ? decoded->opcode : core->ram->ReadByte(registers.pc);
+    lastOpcode = opcode;
+    // (GetCyclesForNextInstruction dry-runs every instruction with ignoreChanges set - only count the real run)
+    if (!ignoreChanges)
+    {
+        core->flightRecorder->RecordInstruction(elapsedCycles, registers, flags, opcode);
+    }
+    NESDL_HOTSPOT_SCOPE(registers.pc, opcode, elapsedCycles, !ignoreChanges);
+    registers.pc++;
 
     switch (CPU_OPCODES[opcode])
     {
@@ -353,21 +477,216 @@ void NESDL_CPU::RunNextInstruction()
     }
 }
 
-// Returns 1 if the value > 0, -1 if the value is < 0, and 0 if the value is 0.
-template <typename T> int8_t sign(T val) {
-    return (T(0) < val) - (val < T(0));
+void NESDL_CPU::SetPSFlag(uint8_t flag, bool on)
+{
+    // Branchless - on becomes 0x00 or 0xFF
+    registers.p = (registers.p & ~flag) | (flag & (uint8_t)-(int8_t)on);
+}
+
+// N, Z, C and V aren't worked out as each instruction goes - instructions just record what they come
+// from in flags, and branches test those directly. P only gets put together when something reads it
+// whole: PHP, BRK and interrupts pushing it, and the debugger, traces and save states. Anything that
+// sets P whole (RTI, PLP, reset, loading a state) has to load flags back out of it
+void NESDL_CPU::LoadLazyFlags()
+{
+    flags.n = registers.p;
+    flags.z = ~registers.p & PSTATUS_ZERO;
+    flags.c = registers.p & PSTATUS_CARRY;
+    flags.v = registers.p;
 }
 
+void NESDL_CPU::StoreLazyFlags()
+{
+    registers.p = flags.Apply(registers.p);
+}
 
-void NESDL_CPU::SetPSFlag(uint8_t flag, bool on)
+const CPUDecodedInstruction* NESDL_CPU::GetDecodedInstruction(uint16_t pc)
+{
+    // Only code in internal RAM or cartridge space is cached - the bytes have to come from
+    // plain reads (not I/O registers), including the 2 after the opcode
+    uint16_t key;
+    if (!fastPaths)
+    {
+        return nullptr;
+    }
+    else if (pc < 0x2000 - 2)
+    {
+        key = pc % 0x800;
+    }
+    else if (pc >= 0x6000)
+    {
+        key = pc;
+    }
+    else
+    {
+        return nullptr;
+    }
+    CPUDecodedInstruction* entry = &decodeCache[key];
+    if (entry->tag != decodeGeneration)
+    {
+        entry->tag = decodeGeneration;
+        entry->opcode = core->ram->ReadByte(pc);
+        entry->operand0 = core->ram->ReadByte(pc + 1);
+        entry->operand1 = core->ram->ReadByte(pc + 2);
+        // Peek at the next opcode for superinstructions, as long as it's in plain memory too
+        AddrMode mode = CPU_ADDRMODES[entry->opcode];
+        uint16_t nextPC = pc + (mode == IMPLICIT || mode == ACCUMULATOR ? 1 :
+                                mode == ABSOLUTEADDR || mode == ABSOLUTEX || mode == ABSOLUTEY ? 3 : 2);
+        bool nextIsPlain = pc < 0x2000 ? nextPC < 0x2000 : nextPC >= 0x6000;
+        entry->fusion = nextIsPlain ? GetFusion(entry->opcode, core->ram->ReadByte(nextPC)) : FUSION_NONE;
+    }
+    return entry;
+}
+
+CPUFusion NESDL_CPU::GetFusion(uint8_t opcode, uint8_t nextOpcode)
+{
+    // What the second instruction would be as part of a pair
+    CPUFusion second = FUSION_NONE;
+    if ((nextOpcode & 0x1F) == 0x10)
+    {
+        second = FUSION_BRANCH;
+    }
+    else if (nextOpcode == 0xC9 || nextOpcode == 0xE0 || nextOpcode == 0xC0)
+    {
+        second = FUSION_COMPARE;
+    }
+    else if (nextOpcode == 0x85 || nextOpcode == 0x8D || nextOpcode == 0x9D || nextOpcode == 0x99)
+    {
+        second = FUSION_STORE;
+    }
+
+    // ...and whether the first one starts a pair like that
+    switch (CPU_OPCODES[opcode])
+    {
+        case LDA:
+            return second;
+        case LDX:
+        case LDY:
+        case BIT:
+        case CMP:
+        case CPX:
+        case CPY:
+            return second == FUSION_BRANCH ? second : FUSION_NONE;
+        case INX:
+        case INY:
+        case DEX:
+        case DEY:
+            return second == FUSION_BRANCH || second == FUSION_COMPARE ? second : FUSION_NONE;
+        default:
+            return FUSION_NONE;
+    }
+}
+
+uint8_t NESDL_CPU::GetCyclesForFusedInstruction(const CPUDecodedInstruction* first)
+{
+    // The first instruction of a pair just ran - work out the second's cycles from its bytes and
+    // the registers, leaving addrModeResult just as GetCyclesForNextInstruction would have.
+    // Returns 0 if it has to be dry-run after all
+    const CPUDecodedInstruction* next = GetDecodedInstruction(registers.pc);
+    if (next == nullptr || GetFusion(first->opcode, next->opcode) != first->fusion)
+    {
+        // Code changed underneath us since the pair was decoded
+        return 0;
+    }
+
+    switch (first->fusion)
+    {
+        case FUSION_BRANCH:
+        {
+            // Branch opcodes are xxy10000 - xx picks N/V/C/Z, y is the state it branches on
+            static const uint8_t branchFlags[4] = { PSTATUS_NEGATIVE, PSTATUS_OVERFLOW, PSTATUS_CARRY, PSTATUS_ZERO };
+            bool flagSet = (flags.Apply(registers.p) & branchFlags[next->opcode >> 6]) != 0;
+            bool didBranch = flagSet == ((next->opcode & 0x20) != 0);
+            uint16_t oldAddr = registers.pc + 2;
+            uint16_t newAddr = oldAddr + (int8_t)next->operand0;
+            bool newPage = didBranch && (oldAddr / 0x100) != (newAddr / 0x100);
+            addrModeResult->value = next->operand0;
+            addrModeResult->address = 0;
+            return 2 + didBranch + newPage;
+        }
+        case FUSION_COMPARE:
+            addrModeResult->value = next->operand0;
+            addrModeResult->address = 0;
+            return 2;
+        case FUSION_STORE:
+        {
+            uint16_t addr = next->operand0;
+            uint8_t cycles = 3;
+            if (next->opcode != 0x85)
+            {
+                addr |= next->operand1 << 8;
+                addr += next->opcode == 0x9D ? registers.x : next->opcode == 0x99 ? registers.y : 0;
+                cycles = next->opcode == 0x8D ? 4 : 5;
+            }
+            // A dry run reads the target first - only skip that where the read can't have side effects
+            // (internal RAM, or PPUDATA which just hands back its buffer)
+            if (addr >= 0x2000 && !(addr < 0x4000 && (addr % 0x8) == 0x7))
+            {
+                return 0;
+            }
+            // The dry run reads the target, but then OP_STA puts A over what it read - so value ends up as A
+            addrModeResult->value = registers.a;
+            addrModeResult->address = addr;
+            return cycles;
+        }
+        default:
+            return 0;
+    }
+}
+
+uint8_t NESDL_CPU::FetchOperandByte()
+{
+    // Same as reading the byte at PC (and advancing), but from the decode cache when possible
+    uint16_t offset = registers.pc - decodedPC;
+    if (decoded != nullptr && (offset == 1 || offset == 2))
+    {
+        registers.pc++;
+        return offset == 1 ? decoded->operand0 : decoded->operand1;
+    }
+    return core->ram->ReadByte(registers.pc++);
+}
+
+uint16_t NESDL_CPU::FetchOperandWord()
 {
-    if (on)
+    // Same as NESDL_RAM::ReadWord at PC (including its "oops" for words straddling a page)
+    if (decoded != nullptr && registers.pc - decodedPC == 1)
     {
-        registers.p |= flag;
+        uint16_t addr = registers.pc < 0x2000 ? registers.pc % 0x800 : registers.pc;
+        core->ram->oops = (addr / 0x100) != ((addr + 1) / 0x100);
+        return decoded->operand0 | (decoded->operand1 << 8);
+    }
+    return core->ram->ReadWord(registers.pc);
+}
+
+void NESDL_CPU::InvalidateDecodedCode(uint16_t addr)
+{
+    // Drop any instruction this byte could be part of (opcode or either operand)
+    if (addr < 0x2000)
+    {
+        decodeCache[addr & 0x7FF].tag = 0;
+        decodeCache[(addr - 1) & 0x7FF].tag = 0;
+        decodeCache[(addr - 2) & 0x7FF].tag = 0;
+    }
+    else if (addr < 0x8000)
+    {
+        decodeCache[addr].tag = 0;
+        decodeCache[addr - 1].tag = 0;
+        decodeCache[addr - 2].tag = 0;
     }
     else
     {
-        registers.p &= ~flag;
+        // Writes to ROM space are mapper register writes - any bank might have moved
+        InvalidateAllDecodedCode();
+    }
+}
+
+void NESDL_CPU::InvalidateAllDecodedCode()
+{
+    // Tag 0 is never valid, so clear everything out when the generation wraps around to it
+    if (++decodeGeneration == 0)
+    {
+        memset(decodeCache, 0, sizeof(decodeCache));
+        decodeGeneration = 1;
     }
 }
 
@@ -386,19 +705,19 @@ void NESDL_CPU::GetByteForAddressMode(AddrMode mode, AddressModeResult* result)
             break;
         case AddrMode::RELATIVEADDR:
         case AddrMode::IMMEDIATE:
-            result->value = core->ram->ReadByte(registers.pc++);
+            result->value = FetchOperandByte();
             result->address = 0;
             break;
         case AddrMode::ZEROPAGE:
         {
-            uint8_t addr = core->ram->ReadByte(registers.pc++);
+            uint8_t addr = FetchOperandByte();
             result->value = core->ram->ReadByte(addr);
             result->address = addr;
             break;
         }
         case AddrMode::ZEROPAGEX:
         {
-            uint8_t addr = core->ram->ReadByte(registers.pc++);
+            uint8_t addr = FetchOperandByte();
             addr = (addr + registers.x) % 256;
             result->value = core->ram->ReadByte(addr);
             result->address = addr;
@@ -406,7 +725,7 @@ void NESDL_CPU::GetByteForAddressMode(AddrMode mode, AddressModeResult* result)
         }
         case AddrMode::ZEROPAGEY:
         {
-            uint8_t addr = core->ram->ReadByte(registers.pc++);
+            uint8_t addr = FetchOperandByte();
             addr = (addr + registers.y) % 256;
             result->value = core->ram->ReadByte(addr);
             result->address = addr;
@@ -414,7 +733,7 @@ void NESDL_CPU::GetByteForAddressMode(AddrMode mode, AddressModeResult* result)
         }
         case AddrMode::ABSOLUTEADDR:
         {
-            uint16_t addr = core->ram->ReadWord(registers.pc);
+            uint16_t addr = FetchOperandWord();
             result->value = core->ram->ReadByte(addr);
             registers.pc += 2;
             result->address = addr;
@@ -422,7 +741,7 @@ void NESDL_CPU::GetByteForAddressMode(AddrMode mode, AddressModeResult* result)
         }
         case AddrMode::ABSOLUTEX:
         {
-            uint16_t addr = core->ram->ReadWord(registers.pc);
+            uint16_t addr = FetchOperandWord();
             // Trigger an "oops" if this mode crossed page bounds
             core->ram->oops = (addr / 0x100) != ((addr + registers.x) / 0x100);
             addr += registers.x;
@@ -433,7 +752,7 @@ void NESDL_CPU::GetByteForAddressMode(AddrMode mode, AddressModeResult* result)
         }
         case AddrMode::ABSOLUTEY:
         {
-            uint16_t addr = core->ram->ReadWord(registers.pc);
+            uint16_t addr = FetchOperandWord();
             // Trigger an "oops" if this mode crossed page bounds
             core->ram->oops = (addr / 0x100) != ((addr + registers.y) / 0x100);
             addr += registers.y;
@@ -444,7 +763,7 @@ void NESDL_CPU::GetByteForAddressMode(AddrMode mode, AddressModeResult* result)
         }
         case AddrMode::INDIRECTX:
         {
-            uint8_t addr = core->ram->ReadByte(registers.pc++);
+            uint8_t addr = FetchOperandByte();
             uint16_t lsb = core->ram->ReadByte((addr + registers.x) % 256);
             uint16_t hsb = core->ram->ReadByte((addr + registers.x + 1) % 256) << 8;
             result->value = core->ram->ReadByte(hsb + lsb);
@@ -453,7 +772,7 @@ void NESDL_CPU::GetByteForAddressMode(AddrMode mode, AddressModeResult* result)
         }
         case AddrMode::INDIRECTY:
         {
-            uint8_t addr = core->ram->ReadByte(registers.pc++);
+            uint8_t addr = FetchOperandByte();
             uint16_t lsb = core->ram->ReadByte(addr);
             uint16_t hsb = (core->ram->ReadByte((addr + 1) % 256) << 8);
             uint16_t resultAddr = hsb + lsb;
@@ -551,23 +870,20 @@ void NESDL_CPU::OP_ADC(uint8_t opcode, bool sbc)
     {
         val = ~val;
     }
-    uint8_t carry = registers.p & PSTATUS_CARRY;
-    uint8_t result = oldAcc + val + carry; // A+M+C
+    uint16_t sum = oldAcc + val + flags.c; // A+M+C
+    uint8_t result = (uint8_t)sum;
     registers.a = result;
     
     // Set the flags as a result of this operation
     
-    // If the result of A+M < A, or (A+M)+C < (A+M), then we have a carry (C)
-    SetPSFlag(PSTATUS_CARRY, (oldAcc + val) < oldAcc || result < (oldAcc + val));
+    // Anything past 8 bits is the carry (C)
+    flags.c = sum >> 8;
 
-    // Gonna cheat on this one and just check if the value goes beyond the range of an int8
-    // (I'm not terribly clever but it is terribly late and I'm terribly tired)
-    int16_t result16 = (int8_t)oldAcc + (int8_t)val + carry;
-    SetPSFlag(PSTATUS_OVERFLOW, result16 < -128 || result16 > 127);
+    // Overflow is when A and M had the same sign but the result's sign is different (bit 7 -> bit 6)
+    flags.v = ((oldAcc ^ result) & (val ^ result)) >> 1;
     
     // Set zero and negative flags as usual
-    SetPSFlag(PSTATUS_ZERO, result == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)result) < 0);
+    SetNZ(result);
 }
 
 void NESDL_CPU::OP_AND(uint8_t opcode)
@@ -580,8 +896,7 @@ void NESDL_CPU::OP_AND(uint8_t opcode)
     uint8_t val = addrModeResult->value;
     registers.a &= val;
     
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.a) < 0);
-    SetPSFlag(PSTATUS_ZERO, registers.a == 0);
+    SetNZ(registers.a);
 }
 
 void NESDL_CPU::OP_ASL(uint8_t opcode)
@@ -607,9 +922,10 @@ void NESDL_CPU::OP_ASL(uint8_t opcode)
     }
     AdvanceCyclesForAddressMode(opcode, mode, false, true, false);
     
-    SetPSFlag(PSTATUS_CARRY, (oldValue & 0x80) >> 6); // Set to old value bit 7
-    SetPSFlag(PSTATUS_ZERO, registers.a == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, (value & 0x80) >> 6); // Set to new value bit 7
+    flags.c = oldValue >> 7; // Set to old value bit 7
+    // N comes from the shifted value but Z has always been taken from A, even when shifting memory
+    flags.n = value;
+    flags.z = registers.a;
 }
 
 void NESDL_CPU::OP_BCC(uint8_t opcode)
@@ -623,7 +939,7 @@ void NESDL_CPU::OP_BCC(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_CARRY) == 0x0)
+    if (flags.c == 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -645,7 +961,7 @@ void NESDL_CPU::OP_BCS(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_CARRY) == PSTATUS_CARRY)
+    if (flags.c != 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -667,7 +983,7 @@ void NESDL_CPU::OP_BEQ(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_ZERO) == PSTATUS_ZERO)
+    if (flags.z == 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -685,9 +1001,10 @@ void NESDL_CPU::OP_BIT(uint8_t opcode)
     GetByteForAddressMode(mode, addrModeResult);
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
     uint8_t result = registers.a & addrModeResult->value;
-    SetPSFlag(PSTATUS_ZERO, result == 0);
-    SetPSFlag(PSTATUS_OVERFLOW, (addrModeResult->value & PSTATUS_OVERFLOW) >> 5);
-    SetPSFlag(PSTATUS_NEGATIVE, (addrModeResult->value & PSTATUS_NEGATIVE) >> 6);
+    // Z is from A & M, but N and V are bits 7 and 6 of M itself
+    flags.z = result;
+    flags.n = addrModeResult->value;
+    flags.v = addrModeResult->value;
 }
 
 void NESDL_CPU::OP_BMI(uint8_t opcode)
@@ -701,7 +1018,7 @@ void NESDL_CPU::OP_BMI(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_NEGATIVE) == PSTATUS_NEGATIVE)
+    if ((flags.n & PSTATUS_NEGATIVE) != 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -723,7 +1040,7 @@ void NESDL_CPU::OP_BNE(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_ZERO) == 0x0)
+    if (flags.z != 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -745,7 +1062,7 @@ void NESDL_CPU::OP_BPL(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_NEGATIVE) == 0x0)
+    if ((flags.n & PSTATUS_NEGATIVE) == 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -764,6 +1081,7 @@ void NESDL_CPU::OP_BRK(uint8_t opcode)
     core->ram->WriteByte(STACK_PTR + (registers.sp--), (registers.pc >> 8));
     core->ram->WriteByte(STACK_PTR + (registers.sp--), (uint8_t)registers.pc);
     // Push P onto stack
+    StoreLazyFlags();
     core->ram->WriteByte(STACK_PTR + (registers.sp--), registers.p);
     // Read interrupt vector from FFFE/F into PC
     uint16_t lsb = core->ram->ReadByte(ADDR_IRQ);
@@ -786,7 +1104,7 @@ void NESDL_CPU::OP_BVC(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_OVERFLOW) == 0x0)
+    if ((flags.v & PSTATUS_OVERFLOW) == 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -808,7 +1126,7 @@ void NESDL_CPU::OP_BVS(uint8_t opcode)
     bool didBranch = false;
     
     // After fetching opcode and offset, check if we branch
-    if ((registers.p & PSTATUS_OVERFLOW) == PSTATUS_OVERFLOW)
+    if ((flags.v & PSTATUS_OVERFLOW) != 0)
     {
         registers.pc = newAddr;
         didBranch = true;
@@ -823,7 +1141,7 @@ void NESDL_CPU::OP_CLC(uint8_t opcode)
 {
     AddrMode mode = CPU_ADDRMODES[opcode];
 
-    SetPSFlag(PSTATUS_CARRY, false);
+    flags.c = 0;
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
 
@@ -844,7 +1162,7 @@ void NESDL_CPU::OP_CLI(uint8_t opcode)
     if (ignoreChanges == false)
     {
         iFlagReady = true;
-        iFlagNextSetState = registers.p & (~PSTATUS_INTERRUPTDISABLE);
+        iFlagNextSetState = flags.Apply(registers.p) & (~PSTATUS_INTERRUPTDISABLE);
     }
 }
 
@@ -852,7 +1170,7 @@ void NESDL_CPU::OP_CLV(uint8_t opcode)
 {
     AddrMode mode = CPU_ADDRMODES[opcode];
 
-    SetPSFlag(PSTATUS_OVERFLOW, false);
+    flags.v = 0;
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
 
@@ -863,10 +1181,8 @@ void NESDL_CPU::OP_CMP(uint8_t opcode)
     GetByteForAddressMode(mode, addrModeResult);
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
-    SetPSFlag(PSTATUS_CARRY, registers.a >= addrModeResult->value);
-    SetPSFlag(PSTATUS_ZERO, registers.a == addrModeResult->value);
-    int8_t result = registers.a - addrModeResult->value;
-    SetPSFlag(PSTATUS_NEGATIVE, result < 0);
+    flags.c = registers.a >= addrModeResult->value;
+    SetNZ(registers.a - addrModeResult->value);
 }
 
 void NESDL_CPU::OP_CPX(uint8_t opcode)
@@ -876,10 +1192,8 @@ void NESDL_CPU::OP_CPX(uint8_t opcode)
     GetByteForAddressMode(mode, addrModeResult);
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
-    SetPSFlag(PSTATUS_CARRY, registers.x >= addrModeResult->value);
-    SetPSFlag(PSTATUS_ZERO, registers.x == addrModeResult->value);
-    int8_t result = registers.x - addrModeResult->value;
-    SetPSFlag(PSTATUS_NEGATIVE, result < 0);
+    flags.c = registers.x >= addrModeResult->value;
+    SetNZ(registers.x - addrModeResult->value);
 }
 
 void NESDL_CPU::OP_CPY(uint8_t opcode)
@@ -889,10 +1203,8 @@ void NESDL_CPU::OP_CPY(uint8_t opcode)
     GetByteForAddressMode(mode, addrModeResult);
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
-    SetPSFlag(PSTATUS_CARRY, registers.y >= addrModeResult->value);
-    SetPSFlag(PSTATUS_ZERO, registers.y == addrModeResult->value);
-    int8_t result = registers.y - addrModeResult->value;
-    SetPSFlag(PSTATUS_NEGATIVE, result < 0);
+    flags.c = registers.y >= addrModeResult->value;
+    SetNZ(registers.y - addrModeResult->value);
 }
 
 void NESDL_CPU::OP_DEC(uint8_t opcode)
@@ -905,8 +1217,7 @@ void NESDL_CPU::OP_DEC(uint8_t opcode)
     uint8_t val = addrModeResult->value - 1;
     core->ram->WriteByte(addrModeResult->address, val);
     
-    SetPSFlag(PSTATUS_ZERO, val == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)val) < 0);
+    SetNZ(val);
 }
 
 void NESDL_CPU::OP_DEX(uint8_t opcode)
@@ -915,8 +1226,7 @@ void NESDL_CPU::OP_DEX(uint8_t opcode)
 
     registers.x--;
 
-    SetPSFlag(PSTATUS_ZERO, registers.x == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.x) < 0);
+    SetNZ(registers.x);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -927,8 +1237,7 @@ void NESDL_CPU::OP_DEY(uint8_t opcode)
 
     registers.y--;
     
-    SetPSFlag(PSTATUS_ZERO, registers.y == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.y) < 0);
+    SetNZ(registers.y);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -941,8 +1250,7 @@ void NESDL_CPU::OP_EOR(uint8_t opcode)
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
     registers.a ^= addrModeResult->value;
-    SetPSFlag(PSTATUS_ZERO, registers.a == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.a) < 0);
+    SetNZ(registers.a);
 }
 
 void NESDL_CPU::OP_INC(uint8_t opcode)
@@ -955,8 +1263,7 @@ void NESDL_CPU::OP_INC(uint8_t opcode)
     uint8_t val = addrModeResult->value + 1;
     core->ram->WriteByte(addrModeResult->address, val);
     
-    SetPSFlag(PSTATUS_ZERO, val == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)val) < 0);
+    SetNZ(val);
 }
 
 void NESDL_CPU::OP_INX(uint8_t opcode)
@@ -965,8 +1272,7 @@ void NESDL_CPU::OP_INX(uint8_t opcode)
 
     registers.x++;
     
-    SetPSFlag(PSTATUS_ZERO, registers.x == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.x) < 0);
+    SetNZ(registers.x);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -977,8 +1283,7 @@ void NESDL_CPU::OP_INY(uint8_t opcode)
 
     registers.y++;
     
-    SetPSFlag(PSTATUS_ZERO, registers.y == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.y) < 0);
+    SetNZ(registers.y);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -987,7 +1292,7 @@ void NESDL_CPU::OP_JMP(uint8_t opcode, bool indirect)
 {
     AddrMode mode = CPU_ADDRMODES[opcode];
 
-    uint16_t addr = core->ram->ReadWord(registers.pc);
+    uint16_t addr = FetchOperandWord();
     if (indirect)
     {
         // Indirect jump has a bug on addresses at the end of pages (eg. 0x##FF) where
@@ -1016,7 +1321,8 @@ void NESDL_CPU::OP_JSR(uint8_t opcode)
     AddrMode mode = CPU_ADDRMODES[opcode];
 
     // Retrieve the address (operand) and advance PC
-    uint16_t addr = core->ram->ReadWord(registers.pc++);
+    uint16_t addr = FetchOperandWord();
+    registers.pc++;
     
     // Push this PC onto the stack to return to later
     core->ram->WriteByte(STACK_PTR + (registers.sp--), (registers.pc >> 8));
@@ -1036,8 +1342,7 @@ void NESDL_CPU::OP_LDA(uint8_t opcode)
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
     registers.a = addrModeResult->value;
-    SetPSFlag(PSTATUS_ZERO, registers.a == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.a) < 0);
+    SetNZ(registers.a);
 }
 
 void NESDL_CPU::OP_LDX(uint8_t opcode)
@@ -1048,8 +1353,7 @@ void NESDL_CPU::OP_LDX(uint8_t opcode)
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
     registers.x = addrModeResult->value;
-    SetPSFlag(PSTATUS_ZERO, registers.x == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.x) < 0);
+    SetNZ(registers.x);
 }
 
 void NESDL_CPU::OP_LDY(uint8_t opcode)
@@ -1060,8 +1364,7 @@ void NESDL_CPU::OP_LDY(uint8_t opcode)
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
     registers.y = addrModeResult->value;
-    SetPSFlag(PSTATUS_ZERO, registers.y == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.y) < 0);
+    SetNZ(registers.y);
 }
 
 void NESDL_CPU::OP_LSR(uint8_t opcode)
@@ -1087,9 +1390,8 @@ void NESDL_CPU::OP_LSR(uint8_t opcode)
     }
     AdvanceCyclesForAddressMode(opcode, mode, false, true, false);
     
-    SetPSFlag(PSTATUS_CARRY, (oldValue & 0x01)); // Set to old value bit 0
-    SetPSFlag(PSTATUS_ZERO, value == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, (value & 0x80) >> 6); // Set to new value bit 7
+    flags.c = oldValue & 0x01; // Set to old value bit 0
+    SetNZ(value);
 }
 
 void NESDL_CPU::OP_NOP(uint8_t opcode)
@@ -1112,8 +1414,7 @@ void NESDL_CPU::OP_ORA(uint8_t opcode)
     AdvanceCyclesForAddressMode(opcode, mode, core->ram->oops, false, false);
     
     registers.a |= addrModeResult->value;
-    SetPSFlag(PSTATUS_ZERO, registers.a == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.a) < 0);
+    SetNZ(registers.a);
 }
 
 void NESDL_CPU::OP_PHA(uint8_t opcode)
@@ -1131,6 +1432,7 @@ void NESDL_CPU::OP_PHP(uint8_t opcode)
 
     // Break flag pushes as 1 but physically isn't a stored bit (status is a 6 bit register)
     // Additionally, mysterious bit 6 ("undefined") always pushes to stack as 1 too
+    StoreLazyFlags();
     core->ram->WriteByte(STACK_PTR + (registers.sp--), registers.p | PSTATUS_BREAK | PSTATUS_UNDEFINED);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
@@ -1142,8 +1444,7 @@ void NESDL_CPU::OP_PLA(uint8_t opcode)
 
     uint8_t stackVal = core->ram->ReadByte(STACK_PTR + (++registers.sp));
     registers.a = stackVal;
-    SetPSFlag(PSTATUS_ZERO, stackVal == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)stackVal) < 0);
+    SetNZ(stackVal);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -1174,7 +1475,7 @@ void NESDL_CPU::OP_ROL(uint8_t opcode)
     {
         oldValue = registers.a;
         registers.a *= 2;
-        registers.a += (registers.p & PSTATUS_CARRY);
+        registers.a += flags.c;
         value = registers.a;
     }
     else
@@ -1183,15 +1484,14 @@ void NESDL_CPU::OP_ROL(uint8_t opcode)
         uint8_t val = addrModeResult->value;
         oldValue = val;
         val *= 2;
-        val += (registers.p & PSTATUS_CARRY);
+        val += flags.c;
         value = val;
         core->ram->WriteByte(addrModeResult->address, val);
     }
     AdvanceCyclesForAddressMode(opcode, mode, false, true, false);
     
-    SetPSFlag(PSTATUS_CARRY, (oldValue & 0x80) >> 6); // Set to old value bit 7
-    SetPSFlag(PSTATUS_ZERO, value == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, (value & 0x80) >> 6); // Set to new value bit 7
+    flags.c = oldValue >> 7; // Set to old value bit 7
+    SetNZ(value);
 }
 
 void NESDL_CPU::OP_ROR(uint8_t opcode)
@@ -1205,7 +1505,7 @@ void NESDL_CPU::OP_ROR(uint8_t opcode)
     {
         oldValue = registers.a;
         registers.a /= 2;
-        registers.a += (registers.p & PSTATUS_CARRY) << 7;
+        registers.a += flags.c << 7;
         value = registers.a;
     }
     else
@@ -1214,15 +1514,14 @@ void NESDL_CPU::OP_ROR(uint8_t opcode)
         uint8_t val = addrModeResult->value;
         oldValue = val;
         val /= 2;
-        val += (registers.p & PSTATUS_CARRY) << 7;
+        val += flags.c << 7;
         value = val;
         core->ram->WriteByte(addrModeResult->address, val);
     }
     AdvanceCyclesForAddressMode(opcode, mode, false, true, false);
     
-    SetPSFlag(PSTATUS_CARRY, (oldValue & 0x01)); // Set to old value bit 0
-    SetPSFlag(PSTATUS_ZERO, value == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, (value & 0x80) >> 6); // Set to new value bit 7
+    flags.c = oldValue & 0x01; // Set to old value bit 0
+    SetNZ(value);
 }
 
 void NESDL_CPU::OP_RTI(uint8_t opcode)
@@ -1232,6 +1531,7 @@ void NESDL_CPU::OP_RTI(uint8_t opcode)
     // Pull P from stack
     uint8_t p = core->ram->ReadByte(STACK_PTR + (++registers.sp));
     registers.p = p;
+    LoadLazyFlags();
     // Pull PC from stack
     uint16_t pc = core->ram->ReadByte(STACK_PTR + (++registers.sp));
     pc += core->ram->ReadByte(STACK_PTR + (++registers.sp)) << 8;
@@ -1264,7 +1564,7 @@ void NESDL_CPU::OP_SEC(uint8_t opcode)
 {
     AddrMode mode = CPU_ADDRMODES[opcode];
 
-    SetPSFlag(PSTATUS_CARRY, true);
+    flags.c = 1;
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
 
@@ -1285,7 +1585,7 @@ void NESDL_CPU::OP_SEI(uint8_t opcode)
     if (ignoreChanges == false)
     {
         iFlagReady = true;
-        iFlagNextSetState = registers.p | PSTATUS_INTERRUPTDISABLE;
+        iFlagNextSetState = flags.Apply(registers.p) | PSTATUS_INTERRUPTDISABLE;
     }
 }
 
@@ -1339,8 +1639,7 @@ void NESDL_CPU::OP_TAX(uint8_t opcode)
     AddrMode mode = CPU_ADDRMODES[opcode];
 
     registers.x = registers.a;
-    SetPSFlag(PSTATUS_ZERO, registers.x == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.x) < 0);
+    SetNZ(registers.x);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -1350,8 +1649,7 @@ void NESDL_CPU::OP_TAY(uint8_t opcode)
     AddrMode mode = CPU_ADDRMODES[opcode];
 
     registers.y = registers.a;
-    SetPSFlag(PSTATUS_ZERO, registers.y == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.y) < 0);
+    SetNZ(registers.y);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -1361,8 +1659,7 @@ void NESDL_CPU::OP_TSX(uint8_t opcode)
     AddrMode mode = CPU_ADDRMODES[opcode];
 
     registers.x = registers.sp;
-    SetPSFlag(PSTATUS_ZERO, registers.x == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.x) < 0);
+    SetNZ(registers.x);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -1372,8 +1669,7 @@ void NESDL_CPU::OP_TXA(uint8_t opcode)
     AddrMode mode = CPU_ADDRMODES[opcode];
 
     registers.a = registers.x;
-    SetPSFlag(PSTATUS_ZERO, registers.a == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.a) < 0);
+    SetNZ(registers.a);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
@@ -1392,19 +1688,24 @@ void NESDL_CPU::OP_TYA(uint8_t opcode)
     AddrMode mode = CPU_ADDRMODES[opcode];
 
     registers.a = registers.y;
-    SetPSFlag(PSTATUS_ZERO, registers.a == 0);
-    SetPSFlag(PSTATUS_NEGATIVE, sign((int8_t)registers.a) < 0);
+    SetNZ(registers.a);
     
     AdvanceCyclesForAddressMode(opcode, mode, false, false, false);
 }
 
 void NESDL_CPU::OP_KIL()
 {
+    // Leave some history behind before we go down
+    core->flightRecorder->Dump(string_format("KIL opcode at $%04X", (uint16_t)(registers.pc - 1)));
     throw domain_error("ILLEGAL OPCODE");
 }
 
 void NESDL_CPU::NMI()
 {
+    NESDL_TRACE_EMU_INSTANT("NMI", core->ppu->elapsedCycles * 4, registers.pc);
+    core->flightRecorder->RecordInterrupt(FlightRecorderEvent::NMI, elapsedCycles, registers, flags);
+    StopIdleLoop(); // The handler is what the loop has been waiting on
+    
     // Push PC to stack
     core->ram->WriteByte(STACK_PTR + (registers.sp--), (registers.pc >> 8));
     core->ram->WriteByte(STACK_PTR + (registers.sp--), (uint8_t)registers.pc);
@@ -1413,6 +1714,7 @@ void NESDL_CPU::NMI()
     SetPSFlag(PSTATUS_BREAK, false);
     
     // Push P to stack
+    StoreLazyFlags();
     core->ram->WriteByte(STACK_PTR + (registers.sp--), registers.p);
     
     // Set interrupt flag
@@ -1428,6 +1730,10 @@ void NESDL_CPU::NMI()
 
 void NESDL_CPU::IRQ()
 {
+    NESDL_TRACE_EMU_INSTANT("IRQ", core->ppu->elapsedCycles * 4, registers.pc);
+    core->flightRecorder->RecordInterrupt(FlightRecorderEvent::IRQ, elapsedCycles, registers, flags);
+    StopIdleLoop();
+    
     // Push PC to stack
     core->ram->WriteByte(STACK_PTR + (registers.sp--), (registers.pc >> 8));
     core->ram->WriteByte(STACK_PTR + (registers.sp--), (uint8_t)registers.pc);
@@ -1436,6 +1742,7 @@ void NESDL_CPU::IRQ()
     SetPSFlag(PSTATUS_BREAK, false);
 
     // Push P to stack
+    StoreLazyFlags();
     core->ram->WriteByte(STACK_PTR + (registers.sp--), registers.p);
 
     // Set interrupt flag
@@ -1449,9 +1756,111 @@ void NESDL_CPU::IRQ()
     ppuCycleCounter = -21; // 7 cycles * 3
 }
 
+bool NESDL_CPU::IsIdleLoopInstruction(uint8_t opcode)
+{
+    // Instructions that only read memory and change registers - no writes, no stack,
+    // no I flag changes (CLI/SEI/PLP take effect late, see iFlagReady)
+    switch (CPU_OPCODES[opcode])
+    {
+        case LDA: case LDX: case LDY:
+        case CMP: case CPX: case CPY: case BIT:
+        case AND: case ORA: case EOR: case ADC: case SBC:
+        case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS:
+        case INX: case INY: case DEX: case DEY:
+        case TAX: case TAY: case TXA: case TYA: case TSX:
+        case CLC: case SEC: case CLV: case CLD: case SED:
+        case NOP:
+            return true;
+        case JMP:
+            return opcode == 0x4C; // Absolute only, indirect reads its pointer from memory
+        default:
+            return false;
+    }
+}
+
+void NESDL_CPU::TrackIdleLoop(const CPURegisters& before, uint8_t cycles)
+{
+    uint8_t opcode = lastOpcode;
+    if (!fastPaths || !IsIdleLoopInstruction(opcode))
+    {
+        idleLoopWatching = false;
+        return;
+    }
+    // Reads have to be plain memory (RAM or cartridge) - PPU/APU/controller reads can change
+    // from one iteration to the next, or have side effects of their own
+    AddrMode mode = CPU_ADDRMODES[opcode];
+    bool readsMemory = mode != AddrMode::IMPLICIT && mode != AddrMode::ACCUMULATOR &&
+                       mode != AddrMode::IMMEDIATE && mode != AddrMode::RELATIVEADDR &&
+                       CPU_OPCODES[opcode] != JMP;
+    if (readsMemory && addrModeResult->address >= 0x2000 && addrModeResult->address < 0x4020)
+    {
+        idleLoopWatching = false;
+        return;
+    }
+    
+    if (idleLoopWatching)
+    {
+        idleLoopRegisters[idleLoopLength] = before;
+        idleLoopCycles[idleLoopLength] = cycles;
+        idleLoopPPUCycles[idleLoopLength] = nextInstructionPPUCycles;
+        idleLoopOpcodes[idleLoopLength] = opcode;
+        idleLoopLength++;
+        if (registers.pc == idleLoopHead)
+        {
+            // Back at the top - if nothing changed, the next iteration will play out identically
+            const CPURegisters& start = idleLoopRegisters[0];
+            if (registers.a == start.a && registers.x == start.x && registers.y == start.y &&
+                flags.Apply(registers.p) == start.p && registers.sp == start.sp)
+            {
+                idleLoopWatching = false;
+                idleLoopActive = true;
+                idleLoopIndex = 0;
+                return;
+            }
+            // Otherwise give it another iteration from here
+            idleLoopLength = 0;
+        }
+        else if (idleLoopLength == CPU_IDLE_LOOP_MAX_INSTRUCTIONS)
+        {
+            idleLoopWatching = false;
+        }
+        return;
+    }
+    
+    // Start watching when a branch or jump lands a short way back
+    bool jumped = mode == AddrMode::RELATIVEADDR || CPU_OPCODES[opcode] == JMP;
+    if (jumped && registers.pc <= before.pc && before.pc - registers.pc < CPU_IDLE_LOOP_MAX_BYTES)
+    {
+        idleLoopWatching = true;
+        idleLoopHead = registers.pc;
+        idleLoopLength = 0;
+    }
+}
+
+void NESDL_CPU::SkipIdleLoopInstruction()
+{
+    // Same bookkeeping as actually running the instruction, minus the running
+    const CPURegisters& current = idleLoopRegisters[idleLoopIndex];
+    core->flightRecorder->RecordInstruction(elapsedCycles, current, flags, idleLoopOpcodes[idleLoopIndex]);
+    {
+        NESDL_HOTSPOT_SCOPE(current.pc, idleLoopOpcodes[idleLoopIndex], elapsedCycles, true);
+        elapsedCycles += idleLoopCycles[idleLoopIndex];
+    }
+    idleLoopIndex = (idleLoopIndex + 1) % idleLoopLength;
+    registers = idleLoopRegisters[idleLoopIndex];
+    LoadLazyFlags();
+}
+
+void NESDL_CPU::StopIdleLoop()
+{
+    idleLoopWatching = false;
+    idleLoopActive = false;
+}
+
 void NESDL_CPU::HaltCPUForDMAWrite()
 {
     uint16_t delay = elapsedCycles % 2 == 0 ? 514 : 513;
+    NESDL_TRACE_EMU_SPAN("OAM DMA", core->ppu->elapsedCycles * 4, delay * 12, delay);
     elapsedCycles += delay;
     ppuCycleCounter -= delay*3;
 }
@@ -1460,6 +1869,7 @@ void NESDL_CPU::HaltCPUForDMC(bool isReload)
 {
     uint8_t delay = 0;
     delay = elapsedCycles % 2 == 0 ? 4 : 3;
+    NESDL_TRACE_EMU_SPAN("DMC DMA stall", core->ppu->elapsedCycles * 4, delay * 12, isReload);
     elapsedCycles += delay;
     ppuCycleCounter -= delay*3;
 }
@@ -1476,43 +1886,176 @@ bool NESDL_CPU::IsConsecutiveMapperWrite()
 
 void NESDL_CPU::DebugBindNintendulator(const char* path)
 {
-    if (nintendulatorDebugging)
-    {
-        nintendulatorLog.clear();
-    }
+    DebugUnbindNintendulator();
 
     printf("Attaching Nintendulator log: %s\n", path);
 
-    ifstream logStream;
-    logStream.open(path);
-    
-    string line;
-    uint64_t lineCount = 0;
-    while (getline(logStream, line))
+    // Logs from long runs can be several GB - map the file and only parse lines as we reach them
+    if (!nintendulatorLog.Open(path))
     {
-        nintendulatorLog.push_back(line);
-        lineCount++;
+        printf("Couldn't open log!\n");
+        return;
     }
 
-    logStream.close();
-
     nintendulatorDebugging = true;
     nintendulatorLogIndex = 0;
-    nintendulatorLogCount = lineCount;
+    nintendulatorLogOffset = 0;
 
-    printf("Attachment done! (%llu lines)", lineCount);
+    printf("Attachment done! (%llu bytes)", (unsigned long long)nintendulatorLog.GetSize());
 }
 
 void NESDL_CPU::DebugUnbindNintendulator()
 {
     if (nintendulatorDebugging)
     {
-        nintendulatorLog.clear();
+        nintendulatorLog.Close();
         nintendulatorDebugging = false;
         printf("Detached Nintendulator log.");
     }
 }
 
+bool NESDL_CPU::DebugStartTrace(const char* path)
+{
+    if (!traceWriter.Open(path))
+    {
+        printf("Couldn't open CPU trace file: %s\n", path);
+        return false;
+    }
+    printf("Writing CPU trace: %s\n", path);
+    return true;
+}
+
+void NESDL_CPU::DebugStopTrace()
+{
+    if (traceWriter.IsOpen())
+    {
+        traceWriter.Close();
+        printf("CPU trace finished.\n");
+    }
+}
+
+void NESDL_CPU::WriteTraceRecord()
+{
+    // Same state as a Nintendulator line, minus the disassembly (see tools/NESDL_TraceTool.cpp
+    // for turning these back into text)
+    CPUTraceRecord record = {};
+    record.masterCycle = core->ppu->elapsedCycles * 4;
+    record.cpuCycle = elapsedCycles;
+    record.pc = registers.pc;
+    record.ppuScanline = core->ppu->currentScanline;
+    record.ppuDot = core->ppu->currentScanlineCycle;
+    ignoreChanges = true;
+    record.opcode = core->ram->ReadByte(registers.pc);
+    record.param0 = core->ram->ReadByte(registers.pc + 1);
+    record.param1 = core->ram->ReadByte(registers.pc + 2);
+    ignoreChanges = false;
+    record.a = registers.a;
+    record.x = registers.x;
+    record.y = registers.y;
+    StoreLazyFlags();
+    record.p = registers.p;
+    record.sp = registers.sp;
+    traceWriter.Write(record);
+}
+
+// Helpers for pulling fields out of a Nintendulator log line, eg.
+// "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7"
+static bool LogExpect(const char*& p, const char* end, const char* token)
+{
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    for (; *token != '\0'; ++token, ++p)
+    {
+        if (p >= end || *p != *token)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool LogNumber(const char*& p, const char* end, int base, uint64_t& value)
+{
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    const char* start = p;
+    value = 0;
+    while (p < end)
+    {
+        char c = *p;
+        int digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (base == 16 && c >= 'A' && c <= 'F')
+        {
+            digit = c - 'A' + 10;
+        }
+        else if (base == 16 && c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else
+        {
+            break;
+        }
+        value = value * base + digit;
+        p++;
+    }
+    return p != start;
+}
+
+bool NESDL_CPU::ParseNextNintendulatorLine(DebugCPUState& state, string& lineText)
+{
+    const char* data = (const char*)nintendulatorLog.GetData();
+    const char* fileEnd = data + nintendulatorLog.GetSize();
+    const char* line = data + nintendulatorLogOffset;
+    const char* end = (const char*)memchr(line, '\n', fileEnd - line);
+    if (end == nullptr)
+    {
+        end = fileEnd;
+    }
+    nintendulatorLogOffset = (end - data) + 1;
+    // Keep the text around in case it needs printing (minus any CR from Windows line endings)
+    const char* textEnd = (end > line && end[-1] == '\r') ? end - 1 : end;
+    lineText.assign(line, textEnd - line);
+
+    const char* p = line;
+    uint64_t v;
+    bool ok = LogNumber(p, end, 16, v);
+    state.registers.pc = (uint16_t)v;
+    ok = ok && LogNumber(p, end, 16, v);
+    state.nextOpcode = (uint8_t)v;
+
+    // The register section is the only place "A:" shows up
+    while (p + 1 < end && !(p[0] == 'A' && p[1] == ':'))
+    {
+        p++;
+    }
+    ok = ok && LogExpect(p, end, "A:") && LogNumber(p, end, 16, v);
+    state.registers.a = (uint8_t)v;
+    ok = ok && LogExpect(p, end, "X:") && LogNumber(p, end, 16, v);
+    state.registers.x = (uint8_t)v;
+    ok = ok && LogExpect(p, end, "Y:") && LogNumber(p, end, 16, v);
+    state.registers.y = (uint8_t)v;
+    ok = ok && LogExpect(p, end, "P:") && LogNumber(p, end, 16, v);
+    state.registers.p = (uint8_t)v;
+    ok = ok && LogExpect(p, end, "SP:") && LogNumber(p, end, 16, v);
+    state.registers.sp = (uint8_t)v;
+    ok = ok && LogExpect(p, end, "PPU:") && LogNumber(p, end, 10, v);
+    state.ppuScanline = (uint16_t)v;
+    ok = ok && LogExpect(p, end, ",") && LogNumber(p, end, 10, v);
+    state.ppuScanlineCycle = (uint16_t)v;
+    ok = ok && LogExpect(p, end, "CYC:") && LogNumber(p, end, 10, v);
+    state.elapsedCycles = v;
+    return ok;
+}
+
 string NESDL_CPU::DebugMakeCurrentStateLine()
 {
     static stringstream returnStr;
@@ -1520,6 +2063,7 @@ string NESDL_CPU::DebugMakeCurrentStateLine()
 
     // Memory reads cause side effects, we need to flag that we don't want those
     ignoreChanges = true;
+    StoreLazyFlags();
 
     // Something to help us is the cached addrModeResult from simulating the next instruction.
     // Our memory fetches were already done for us!
@@ -1646,27 +2190,42 @@ void NESDL_CPU::EvaluateNintendulatorDebug()
     {
         return;
     }
-
-    string ourCurrentLine = DebugMakeCurrentStateLine();
-    //printf("\n%s", ourCurrentLine.c_str());
-    if (nintendulatorLogIndex < nintendulatorLogCount)
+    if (nintendulatorLogOffset >= nintendulatorLog.GetSize())
     {
-        // Construct and store CPU state before running next instruction
-
-        // Compare state to Nintendulator line - if it's off, we can print
-        // a line comparison and try to debug
-        string nintendulatorLine = nintendulatorLog[nintendulatorLogIndex];
-
-        // The "quickest" way I could think of validating against Nintendulator is
-        // comparing string-to-string outright
-        if (ourCurrentLine != nintendulatorLine)
+        if (nintendulatorLogOffset == nintendulatorLog.GetSize())
         {
-            printf("\nLines differ!\n  Ours:%s\nTheirs:%s\n", ourCurrentLine.c_str(), nintendulatorLine.c_str());
+            printf("Nintendulator out of lines!\n");
+            nintendulatorLogOffset++; // Only say so once
         }
-        nintendulatorLogIndex++;
+        return;
     }
-    else if (nintendulatorLogIndex == nintendulatorLogCount)
+
+    // Compare state to the next Nintendulator line field by field - only if something's off
+    // do we bother building our own line of text to print next to theirs
+    DebugCPUState theirs;
+    string theirLine;
+    bool parsed = ParseNextNintendulatorLine(theirs, theirLine);
+    nintendulatorLogIndex++;
+
+    ignoreChanges = true;
+    uint8_t opcode = core->ram->ReadByte(registers.pc);
+    ignoreChanges = false;
+
+    StoreLazyFlags();
+    bool matches = parsed &&
+        theirs.registers.pc == registers.pc &&
+        theirs.nextOpcode == opcode &&
+        theirs.registers.a == registers.a &&
+        theirs.registers.x == registers.x &&
+        theirs.registers.y == registers.y &&
+        theirs.registers.p == registers.p &&
+        theirs.registers.sp == registers.sp &&
+        theirs.ppuScanline == core->ppu->currentScanline &&
+        theirs.ppuScanlineCycle == core->ppu->currentScanlineCycle &&
+        theirs.elapsedCycles == elapsedCycles;
+    if (!matches)
     {
-        printf("Nintendulator out of lines!\n");
+        string ourLine = DebugMakeCurrentStateLine();
+        printf("\nLines differ! (line %llu)\n  Ours:%s\nTheirs:%s\n", (unsigned long long)nintendulatorLogIndex, ourLine.c_str(), theirLine.c_str());
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,94 @@
+#include "NESDL.h"
+
+bool NESDL_CPUTraceWriter::Open(const char* path)
+{
+    Close();
+    
+    file.open(path, ofstream::out | ofstream::binary | ofstream::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    CPUTraceFileHeader header = {};
+    memcpy(header.magic, NESDL_CPUTRACE_MAGIC, sizeof(header.magic));
+    header.version = NESDL_CPUTRACE_VERSION;
+    header.recordSize = sizeof(CPUTraceRecord);
+    file.write((const char*)&header, sizeof(header));
+    
+    currentBlock = make_unique<CPUTraceRecord[]>(NESDL_CPUTRACE_BLOCK);
+    current = currentBlock.get();
+    currentCount = 0;
+    stopRequested = false;
+    writerThread = thread(&NESDL_CPUTraceWriter::WriterThread, this);
+    isOpen = true;
+    return true;
+}
+
+void NESDL_CPUTraceWriter::Close()
+{
+    if (!isOpen)
+    {
+        return;
+    }
+    
+    // Hand over whatever's left, then let the writer finish everything queued up
+    if (currentCount > 0)
+    {
+        SubmitBlock();
+    }
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopRequested = true;
+    }
+    queueSignal.notify_one();
+    writerThread.join();
+    
+    file.close();
+    currentBlock.reset();
+    current = nullptr;
+    freeBlocks.clear();
+    isOpen = false;
+}
+
+void NESDL_CPUTraceWriter::SubmitBlock()
+{
+    lock_guard<mutex> lock(queueMutex);
+    fullBlocks.push({ std::move(currentBlock), currentCount });
+    
+    // Reuse a block the writer is done with if there is one
+    if (!freeBlocks.empty())
+    {
+        currentBlock = std::move(freeBlocks.back());
+        freeBlocks.pop_back();
+    }
+    else
+    {
+        currentBlock = make_unique<CPUTraceRecord[]>(NESDL_CPUTRACE_BLOCK);
+    }
+    current = currentBlock.get();
+    currentCount = 0;
+    queueSignal.notify_one();
+}
+
+void NESDL_CPUTraceWriter::WriterThread()
+{
+    unique_lock<mutex> lock(queueMutex);
+    while (true)
+    {
+        queueSignal.wait(lock, [this] { return stopRequested || !fullBlocks.empty(); });
+        if (fullBlocks.empty())
+        {
+            // Stop requested and nothing left to write
+            break;
+        }
+        Block block = std::move(fullBlocks.front());
+        fullBlocks.pop();
+        
+        // Don't hold the emulator up while we're on disk
+        lock.unlock();
+        file.write((const char*)block.records.get(), block.count * sizeof(CPUTraceRecord));
+        lock.lock();
+        
+        freeBlocks.push_back(std::move(block.records));
+    }
+}
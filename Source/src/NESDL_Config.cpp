@@ -44,7 +44,8 @@ unordered_map<string, unordered_map<string, string>> NESDL_Config::GetConfigDefa
         { ConfigSection::GENERAL,
             {
                 { ConfigKey::LASTROM, "" },
-                { ConfigKey::LASTLOG, "" }
+                { ConfigKey::LASTLOG, "" },
+                { ConfigKey::LASTLIBRARY, "" }
             }
         },
         {
@@ -123,6 +124,11 @@ void NESDL_Config::ReadFromFile()
         else
         {
             pair<string, string> keyVal = GetKeyValuePair(currentLine);
+            // Header fixes are keyed by CRC32 - match it however the hex was typed in
+            if (currentSection == ConfigSection::HEADERFIXES)
+            {
+                transform(keyVal.first.begin(), keyVal.first.end(), keyVal.first.begin(), [](unsigned char ch) { return (char)tolower(ch); });
+            }
             data[currentSection][keyVal.first] = keyVal.second;
         }
     }
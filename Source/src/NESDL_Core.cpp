@@ -18,6 +18,11 @@ void NESDL_Core::Init(NESDL_SDL* sdl)
     apu = new NESDL_APU();
     input = new NESDL_Input();
     config = new NESDL_Config();
+    flightRecorder = new NESDL_FlightRecorder();
+    romLibrary = new NESDL_ROMLibrary();
+    saveStates = new NESDL_SaveStates();
+    movie = new NESDL_Movie();
+    divergence = new NESDL_Divergence();
 
     cpu->Init(this);
     ppu->Init(this);
@@ -25,6 +30,11 @@ void NESDL_Core::Init(NESDL_SDL* sdl)
     apu->Init(this, sdlCtx);
     input->Init(this);
     config->Init(this);
+    flightRecorder->Init(this);
+    romLibrary->Init(this); // After config - header fixes are read from there
+    saveStates->Init(this);
+    movie->Init(this);
+    divergence->Init(this);
     
     // Connect player 1 controller from the start
     input->SetControllerConnected(true, false);
@@ -32,16 +42,57 @@ void NESDL_Core::Init(NESDL_SDL* sdl)
 
 void NESDL_Core::Exit()
 {
+    cpu->DebugStopTrace();
+    NESDL_TRACE_STOP();
+    NESDL_HOTSPOT_END();
+    if (romLoaded)
+    {
+        movie->Stop();
+        SaveStateToSlot(NESDL_STATE_AUTOSAVE_SLOT);
+        delete mapper;
+        romFile.Close();
+        batteryRAM.Close();
+    }
+#ifdef NESDL_PROFILING
+    // Leave the last few seconds of timings behind for offline comparison
+    NESDL_Profiler::WriteCSV("nesdl_profile.csv");
+#endif
     delete cpu;
     delete ppu;
     delete ram;
     delete apu;
     delete input;
     delete config;
+    delete flightRecorder;
+    romLibrary->Exit(); // A scan that's still going finishes writing the index first
+    delete romLibrary;
+    saveStates->Exit(); // Waits for the autosave (and anything else queued) to finish writing
+    delete saveStates;
+    delete movie;
+    delete divergence;
 }
 
 void NESDL_Core::Update(double deltaTime)
 {
+    NESDL_TRACE_SCOPE("Update");
+
+    // Save states finish writing in the background - say how it went once they have
+    string saveReport;
+    if (saveStates->TakeReport(saveReport))
+    {
+        sdlCtx->ShowTextNotice(saveReport);
+    }
+    string movieReport;
+    if (movie->TakeReport(movieReport))
+    {
+        sdlCtx->ShowTextNotice(movieReport);
+    }
+    string libraryReport;
+    if (romLibrary->TakeReport(libraryReport))
+    {
+        sdlCtx->ShowTextNotice(libraryReport);
+    }
+    
     // Convert deltaTime to the amount of cycles we need to advance on this frame
     uint64_t ppuTiming1 = (uint64_t)((NESDL_PPU_CLOCK / 1000) * timeSinceStartup);
     timeSinceStartup += deltaTime;
@@ -64,9 +115,21 @@ void NESDL_Core::Update(double deltaTime)
     for (uint32_t i = 0; i < ppuCycles; ++i)
     {
         // Send PPU cycles (finest clock cycle in the hardware) to handle their own cycle updates
-        cpu->Update(1);
-        ppu->Update(1);
-        apu->Update(1);
+#ifdef NESDL_PROFILING
+        bool sampleDot = (i & (NESDL_PROFILE_SAMPLE_RATE - 1)) == 0;
+#endif
+        {
+            NESDL_PROFILE_SCOPE_SAMPLED(CPU, sampleDot);
+            cpu->Update(1);
+        }
+        {
+            NESDL_PROFILE_SCOPE_SAMPLED(PPU, sampleDot);
+            ppu->Update(1);
+        }
+        {
+            NESDL_PROFILE_SCOPE_SAMPLED(APU, sampleDot);
+            apu->Update(1);
+        }
         
         // Only update SDL screen texture IF the visible screen has finished being drawn to
         // Prevents visible screen tearing from mid-frame drawing
@@ -75,6 +138,20 @@ void NESDL_Core::Update(double deltaTime)
             ppu->frameDataReady = false;
             ppu->UpdateNTFrameData();
             sdlCtx->UpdateScreenTexture();
+            flightRecorder->EndFrame();
+            movie->EndFrame();
+            NESDL_HOTSPOT_END_FRAME();
+
+            // States get saved here so the thumbnail is the frame that was just finished
+            if (stateSaveRequested)
+            {
+                stateSaveRequested = false;
+                SaveStateToSlot(stateSlot);
+            }
+            else if (++framesSinceAutosave >= NESDL_STATE_AUTOSAVE_FRAMES)
+            {
+                SaveStateToSlot(NESDL_STATE_AUTOSAVE_SLOT);
+            }
         }
         // We ignore the paused flag if we're CPU stepping,
         // UNTIL the next instruction is ready.
@@ -101,29 +178,54 @@ void NESDL_Core::Update(double deltaTime)
 
 void NESDL_Core::LoadROM(const char* path)
 {
-    ifstream file;
-    file.open(path, ifstream::in | ifstream::binary);
+    // Map the ROM file read-only. PRG and CHR-ROM are handed to the mapper as pointers straight into
+    // it rather than copied anywhere, and romFile keeps it mapped until the ROM is closed
+    if (!romFile.Open(path, false) || romFile.GetSize() < sizeof(FileHeader_INES))
+    {
+        romFile.Close();
+        return;
+    }
+    const uint8_t* romData = romFile.GetData();
 
     // Attempt to read file as a ROM with a valid 16-byte header
-    // (TODO what if the file is < 16 bytes, or empty? This would surely fail)
     FileHeader_INES header;
-    file.read((char*)&header, sizeof(header));
+    memcpy(&header, romData, sizeof(header));
 
     // If header doesn't say "NES" with an EOF char, surely this isn't a valid ROM file
     if (header.id != 0x1A53454E)
     {
+        romFile.Close();
         return;
     }
+
+    // If the ROM's in the library, its (possibly corrected) mapper, mirroring and battery flags win
+    if (romLibrary->ApplyHeaderFixes(path, header))
+    {
+        printf("Using corrected header from the ROM library\n");
+    }
     
     // Get the program bank count and VROM bank count. We'll be reading this data soon
     uint8_t romBankCount = header.banks;
     uint8_t vromBankCount = header.vbanks;
+    uint64_t prgROMSize = romBankCount * 0x4000;
+    uint64_t chrROMSize = vromBankCount * 0x2000;
 
     // TODO read header for any trainer or mapping data! Then skip ahead if needed
     // Check for trainer flag in bit 2, skip it if detected
+    uint64_t prgROMOffset = sizeof(header);
     if ((header.ctrl1 & 0x4) == 0x4) 
     {
-        file.seekg(512, ios_base::cur);
+        prgROMOffset += 512;
+    }
+
+    // PRG-ROM (16KB banks) then CHR-ROM (8KB banks) - both have to actually be in the file,
+    // since the mapper reads them in place
+    if (prgROMOffset + prgROMSize + chrROMSize > romFile.GetSize())
+    {
+        sdlCtx->ShowTextNotice("ROM file is shorter than its header says!");
+        printf("ROM file is shorter than its header says!\n");
+        romFile.Close();
+        return;
     }
     
     // Set up mapper
@@ -137,10 +239,21 @@ void NESDL_Core::LoadROM(const char* path)
         case 1:
             mapper = new NESDL_Mapper_1(this);
             break;
+        case 2:
+            mapper = new NESDL_Mapper_2(this);
+            mapper->SetMirroringData(header.ctrl1 & INES_NTMIRROR);
+            break;
+        case 3:
+            mapper = new NESDL_Mapper_3(this);
+            mapper->SetMirroringData(header.ctrl1 & INES_NTMIRROR);
+            break;
         case 4:
             mapper = new NESDL_Mapper_4(this);
             ((NESDL_Mapper_4*)mapper)->SetFourWayMirroring(header.ctrl1 & INES_NTLAYOUT);
             break;
+        case 7:
+            mapper = new NESDL_Mapper_7(this);
+            break;
         case 9:
             mapper = new NESDL_Mapper_9(this);
             break;
@@ -150,42 +263,34 @@ void NESDL_Core::LoadROM(const char* path)
             sdlCtx->ShowTextNotice(ss.str().c_str());
             ss << "\n";
             printf(ss.str().c_str());
-            file.close();
+            romFile.Close();
             return;
     }
     mapper->mapperNumber = mapperNum;
 
-    // Read off the 16KB allocated PRG-ROM banks
-    shared_ptr<vector<uint8_t>> prgROM;
-    shared_ptr<vector<uint8_t>> chrROM;
-    if (romBankCount > 0)
-    {
-        prgROM = make_shared<vector<uint8_t>>(romBankCount * 0x4000);
-        file.read((char*)prgROM->data(), romBankCount * 0x4000);
-    }
-
-    // Read off the 8KB allocated CHR-ROM banks
-    if (vromBankCount > 0)
-    {
-        chrROM = make_shared<vector<uint8_t>>(vromBankCount * 0x2000);
-        file.read((char*)chrROM->data(), vromBankCount * 0x2000);
-    }
-    
-    // Done with file -- we can close it now
-    file.close();
-    
     // Initialize mapper with all of its pertinent data
-    uint8_t* prgPtr = nullptr;
-    if (romBankCount > 0)
-    {
-        prgPtr = prgROM->data();
-    }
-    uint8_t* chrPtr = nullptr;
-    if (vromBankCount > 0)
+    const uint8_t* prgPtr = romBankCount > 0 ? romData + prgROMOffset : nullptr;
+    const uint8_t* chrPtr = vromBankCount > 0 ? romData + prgROMOffset + prgROMSize : nullptr;
+    mapper->InitROMData(prgPtr, romBankCount, chrPtr, vromBankCount);
+
+    // Battery-backed PRG-RAM lives in a .sav file next to the ROM. If that can't be opened the game
+    // still runs, it just won't remember anything
+    if (header.ctrl1 & INES_SAVEDATA)
     {
-        chrPtr = chrROM->data();
+        string savePath = GetSavePathOf(path);
+        if (batteryRAM.Open(savePath.c_str(), 0x2000))
+        {
+            mapper->SetBatteryRAM(&batteryRAM);
+        }
+        else
+        {
+            sdlCtx->ShowTextNotice("Couldn't open save file - progress won't be saved!");
+            printf("Couldn't open save file %s\n", savePath.c_str());
+        }
     }
-    mapper->InitROMData(prgPtr, romBankCount, chrPtr, vromBankCount);
+    NESDL_HOTSPOT_BEGIN(mapper, romBankCount * 0x4000);
+    romPath = path;
+    framesSinceAutosave = 0;
     
     // Let components know we exist
     ram->SetMapper(mapper);
@@ -200,6 +305,82 @@ void NESDL_Core::HandleEvent(SDL_EventType eventType, SDL_KeyCode eventKeyCode)
     {
         input->RegisterKey(eventKeyCode, eventType == SDL_KEYDOWN);
     }
+    // Save state hotkeys
+    if (eventType == SDL_KEYDOWN)
+    {
+        switch (eventKeyCode)
+        {
+            case SDLK_F5:
+                Action_SaveState();
+                break;
+            case SDLK_F6:
+                Action_NextStateSlot();
+                break;
+            case SDLK_F7:
+                Action_LoadState();
+                break;
+            case SDLK_F8:
+                Action_RecordMovie();
+                break;
+            case SDLK_F9:
+                Action_PlayMovie();
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void NESDL_Core::SaveState(NESDL_StateWriter& state)
+{
+    cpu->SaveState(state);
+    ppu->SaveState(state);
+    apu->SaveState(state);
+    ram->SaveState(state);
+    input->SaveState(state);
+    mapper->SaveState(state);
+}
+
+void NESDL_Core::LoadState(NESDL_StateReader& state)
+{
+    cpu->LoadState(state);
+    ppu->LoadState(state);
+    apu->LoadState(state);
+    ram->LoadState(state);
+    input->LoadState(state);
+    mapper->LoadState(state);
+    cpu->PrimeNextInstruction();
+}
+
+void NESDL_Core::SaveStatePart(StateHashPart part, NESDL_StateWriter& state)
+{
+    switch (part)
+    {
+        case StateHashPart::CPU:
+            cpu->SaveState(state);
+            break;
+        case StateHashPart::PPU:
+            ppu->SaveState(state);
+            break;
+        case StateHashPart::APU:
+            apu->SaveState(state);
+            break;
+        case StateHashPart::RAM:
+            ram->SaveState(state);
+            break;
+        case StateHashPart::Input:
+            input->SaveState(state);
+            break;
+        case StateHashPart::Mapper:
+            mapper->SaveState(state);
+            break;
+        case StateHashPart::Frame:
+            state.Write(ppu->frameData, "frameData");
+            state.Write(ppu->frameEmphasis, "frameEmphasis");
+            break;
+        default:
+            break;
+    }
 }
 
 bool NESDL_Core::IsROMLoaded()
@@ -241,23 +422,130 @@ void NESDL_Core::Action_OpenROM()
         Action_ResetHard();
     }
 }
+void NESDL_Core::Action_ScanROMLibrary()
+{
+    nfdchar_t* libraryPath = NULL;
+    string defLibraryPath = config->ReadValue<string>(ConfigSection::GENERAL, ConfigKey::LASTLIBRARY, "");
+    nfdresult_t result = NFD_PickFolder(defLibraryPath.c_str(), &libraryPath);
+    if (result != NFD_OKAY || strcmp(libraryPath, "") == 0)
+    {
+        return;
+    }
+    config->WriteValue(ConfigSection::GENERAL, ConfigKey::LASTLIBRARY, string(libraryPath));
+
+    // Hashing a big library takes a while - the game keeps running, and Update says when it's done
+    bool started = romLibrary->StartScan(libraryPath);
+    free(libraryPath);
+    sdlCtx->ShowTextNotice(started ? "Scanning library..." : "Library scan already running");
+}
 void NESDL_Core::Action_CloseROM()
 {
     if (romLoaded)
     {
         // Leave all states intact but "unplug" all cartridge data
-        free(mapper);
+        NESDL_HOTSPOT_END();
         ram->SetMapper(nullptr);
         ppu->SetMapper(nullptr);
+        movie->Stop();
+        SaveStateToSlot(NESDL_STATE_AUTOSAVE_SLOT);
+        stateSaveRequested = false;
+        // The mapper points into the ROM and save files, so it has to go first
+        delete mapper;
+        mapper = nullptr;
+        romFile.Close();
+        batteryRAM.Close();
         romLoaded = false;
         
         // Clear screen on ROM close (better signifier of ROM no longer running than not)
-        memset(ppu->frameData, 0x00, sizeof(ppu->frameData));
+        memset(ppu->frameData, 0x0F, sizeof(ppu->frameData)); // 0x0F is palette black
+        memset(ppu->frameEmphasis, 0x00, sizeof(ppu->frameEmphasis));
         sdlCtx->UpdateScreenTexture();
     }
 }
+void NESDL_Core::Action_SaveState()
+{
+    // Done at the end of the current frame (see Update) - or now, if nothing's running to get there
+    if (romLoaded)
+    {
+        if (paused)
+        {
+            SaveStateToSlot(stateSlot);
+        }
+        else
+        {
+            stateSaveRequested = true;
+        }
+    }
+}
+void NESDL_Core::Action_LoadState()
+{
+    if (!romLoaded)
+    {
+        return;
+    }
+    string error;
+    if (!saveStates->Load(GetStatePathOf(romPath, stateSlot), romFile.GetSize(), error))
+    {
+        sdlCtx->ShowTextNotice(error);
+        return;
+    }
+    // Recorded history leads up to a point the machine isn't at any more
+    movie->Stop();
+    stateSaveRequested = false;
+    flightRecorder->Reset();
+    sdlCtx->UpdateScreenTexture();
+
+    char text[64];
+    snprintf(text, sizeof(text), "State loaded in %.1fms", saveStates->GetStats().loadTime);
+    sdlCtx->ShowTextNotice(text);
+}
+void NESDL_Core::Action_NextStateSlot()
+{
+    // 0-9, then the autosave, then back around
+    stateSlot = stateSlot == NESDL_STATE_SLOTS - 1 ? NESDL_STATE_AUTOSAVE_SLOT : stateSlot + 1;
+    sdlCtx->ShowTextNotice(stateSlot == NESDL_STATE_AUTOSAVE_SLOT ? string("State slot: autosave") : "State slot: " + to_string(stateSlot));
+}
+void NESDL_Core::Action_RecordMovie()
+{
+    // Starts recording from right here, or stops (and saves) the recording already going
+    if (!romLoaded)
+    {
+        return;
+    }
+    if (movie->GetMode() == MovieMode::Recording)
+    {
+        movie->Stop();
+        return;
+    }
+    movie->StartRecording(GetSavePathOf(romPath, ".nmv"), romFile.GetSize());
+    sdlCtx->ShowTextNotice("Recording movie");
+}
+void NESDL_Core::Action_PlayMovie()
+{
+    if (!romLoaded)
+    {
+        return;
+    }
+    if (movie->GetMode() == MovieMode::Playing)
+    {
+        movie->Stop();
+        sdlCtx->ShowTextNotice("Movie stopped");
+        return;
+    }
+    string error;
+    if (!movie->StartPlayback(GetSavePathOf(romPath, ".nmv"), romFile.GetSize(), error))
+    {
+        sdlCtx->ShowTextNotice(error);
+        return;
+    }
+    stateSaveRequested = false;
+    flightRecorder->Reset();
+    sdlCtx->UpdateScreenTexture();
+    sdlCtx->ShowTextNotice("Playing movie");
+}
 void NESDL_Core::Action_ResetSoft()
 {
+    movie->Stop(); // Resets aren't part of a movie
     cpu->Reset(false);
     ppu->Reset(false);
     apu->Reset();
@@ -265,10 +553,12 @@ void NESDL_Core::Action_ResetSoft()
 }
 void NESDL_Core::Action_ResetHard()
 {
+    movie->Stop();
     timeSinceStartup = 0;
     cpu->Reset(true);
     ppu->Reset(true);
     apu->Reset();
+    flightRecorder->Reset();
     sdlCtx->UpdateScreenTexture();
 }
 void NESDL_Core::Action_ViewFrameInfo()
@@ -340,10 +630,101 @@ void NESDL_Core::Action_DetachNintendulatorLog()
 {
     cpu->DebugUnbindNintendulator();
 }
+void NESDL_Core::Action_StartCPUTrace()
+{
+    nfdchar_t* traceFilePath = NULL;
+    nfdresult_t result = NFD_SaveDialog("nestrace", NULL, &traceFilePath);
+    if (result != NFD_OKAY || strcmp(traceFilePath, "") == 0)
+    {
+        return;
+    }
+    cpu->DebugStartTrace(traceFilePath);
+}
+void NESDL_Core::Action_StopCPUTrace()
+{
+    cpu->DebugStopTrace();
+}
+void NESDL_Core::Action_ToggleCPUFastPaths()
+{
+    // Off gives the plain interpreter, to record a CPU trace to diff a normal one against
+    cpu->SetFastPaths(!cpu->fastPaths);
+    sdlCtx->ShowTextNotice(cpu->fastPaths ? "CPU fast paths on" : "CPU fast paths off (plain interpreter)");
+}
+void NESDL_Core::Action_DumpFlightRecorder()
+{
+    flightRecorder->Dump("Requested from menu");
+}
+void NESDL_Core::Action_FindMovieDivergence()
+{
+    if (!romLoaded)
+    {
+        return;
+    }
+
+    // Plays this ROM's movie with the CPU's fast paths against the plain interpreter, and narrows
+    // down where they first disagree (see NESDL_Divergence).
+    // A recording that's going gets saved first, so that's the one it checks
+    movie->Stop();
+    MovieFileHeader header;
+    vector<uint8_t> startState;
+    vector<MovieFrame> frames;
+    string error;
+    if (!NESDL_Movie::ReadMovie(GetSavePathOf(romPath, ".nmv"), romFile.GetSize(), mapper->mapperNumber, header, startState, frames, error))
+    {
+        sdlCtx->ShowTextNotice(error);
+        return;
+    }
+
+    NESDL_StateWriter backup;
+    SaveState(backup);
+    bool fastPaths = cpu->fastPaths;
+    DivergenceConfig configA = { "fast paths", true };
+    DivergenceConfig configB = { "reference", false };
+    DivergenceReport report;
+    divergence->Run(startState, frames, configA, configB, report);
+
+    // Back to exactly where the game was
+    cpu->SetFastPaths(fastPaths);
+    ram->SetMapper(mapper);
+    ppu->SetMapper(mapper);
+    NESDL_StateReader restore(backup.data.data(), backup.data.size(), false);
+    LoadState(restore);
+    input->UnlatchInput();
+    flightRecorder->Reset();
+    sdlCtx->ClearAudio();
+    sdlCtx->UpdateScreenTexture();
+
+    string text = NESDL_Divergence::FormatReport(report, configA, configB);
+    ofstream out(NESDL_DIVERGENCE_FILE, ios::trunc);
+    out << text;
+    printf("%s", text.c_str());
+    sdlCtx->ShowTextNotice(report.diverged ? string_format("Diverged at frame %u, see " NESDL_DIVERGENCE_FILE, report.frames)
+                                           : "No divergence in " + to_string(report.frames) + " frames");
+}
 
 // https://stackoverflow.com/questions/8518743/get-directory-from-file-path-c
 string NESDL_Core::GetDirectoryOf(const string& filePath)
 {
     size_t pos = filePath.find_last_of("\\/");
     return (string::npos == pos) ? "" : filePath.substr(0, pos);
+}
+
+void NESDL_Core::SaveStateToSlot(int slot)
+{
+    framesSinceAutosave = 0;
+    saveStates->Save(GetStatePathOf(romPath, slot), romFile.GetSize());
+}
+
+string NESDL_Core::GetStatePathOf(const string& romPath, int slot)
+{
+    return GetSavePathOf(romPath, slot == NESDL_STATE_AUTOSAVE_SLOT ? ".sta" : ".st" + to_string(slot));
+}
+
+string NESDL_Core::GetSavePathOf(const string& romPath, const string& extension)
+{
+    // Same name as the ROM, with .sav (or whatever's given) in place of its extension (if it has one)
+    size_t dot = romPath.find_last_of('.');
+    size_t slash = romPath.find_last_of("\\/");
+    bool hasExtension = dot != string::npos && (slash == string::npos || dot > slash);
+    return (hasExtension ? romPath.substr(0, dot) : romPath) + extension;
 }
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include "NESDL.h"
+
+void NESDL_Divergence::Init(NESDL_Core* c)
+{
+    core = c;
+    frames = nullptr;
+    frameIndex = 0;
+}
+
+void NESDL_Divergence::Run(const vector<uint8_t>& startState, const vector<MovieFrame>& movieFrames,
+                           const DivergenceConfig& configA, const DivergenceConfig& configB, DivergenceReport& report)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    frames = &movieFrames;
+    report = {};
+
+    // Interval by interval, both from the same checkpoint, until some frame comes out differently
+    Checkpoint checkpoint = { 0, startState };
+    uint32_t total = (uint32_t)movieFrames.size();
+    vector<uint64_t> hashesA;
+    vector<uint64_t> hashesB;
+    uint32_t divergedFrame = total;
+    while (checkpoint.frame < total)
+    {
+        uint32_t count = min<uint32_t>(NESDL_DIVERGENCE_INTERVAL, total - checkpoint.frame);
+        Restore(checkpoint, configA);
+        RunFrames(count, &hashesA);
+        Checkpoint next = Capture();
+        Restore(checkpoint, configB);
+        RunFrames(count, &hashesB);
+
+        size_t firstDiff = mismatch(hashesA.begin(), hashesA.end(), hashesB.begin()).first - hashesA.begin();
+        if (firstDiff < hashesA.size())
+        {
+            divergedFrame = checkpoint.frame + (uint32_t)(firstDiff / (int)StateHashPart::Count);
+            break;
+        }
+        checkpoint = move(next);
+    }
+    report.frames = divergedFrame;
+    if (divergedFrame == total)
+    {
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return;
+    }
+
+    // Everything up to the end of the frame before matched, so that's where both start from
+    Restore(checkpoint, configA);
+    RunFrames(divergedFrame - checkpoint.frame, nullptr);
+    Checkpoint frameStart = Capture();
+
+    // Both are identical 0 dots in and differ by the end of the frame - find the dot where that changes.
+    // If they differ briefly and come back together earlier on, this can land on a later difference
+    // instead, but it's always a dot where identical machines went different ways
+    Restore(frameStart, configA);
+    uint32_t dotsA = CountFrameDots();
+    Restore(frameStart, configB);
+    uint32_t dotsB = CountFrameDots();
+    uint32_t low = 0;
+    uint32_t high = max(dotsA, dotsB);
+    while (high - low > 1)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (RunToDot(frameStart, configA, middle) == RunToDot(frameStart, configB, middle))
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    report.diverged = true;
+    report.dot = high;
+
+    // Where the machine was just before it happened...
+    PartState before[(int)StateHashPart::Count];
+    RunToDot(frameStart, configA, low);
+    CaptureParts(before);
+    const PartState& cpuBefore = before[(int)StateHashPart::CPU];
+    const PartState& ppuBefore = before[(int)StateHashPart::PPU];
+    const StateField* field = FindField(cpuBefore, "registers");
+    report.pc = field != nullptr ? (uint16_t)ReadValue(&cpuBefore.data[field->offset + offsetof(CPURegisters, pc)], 2) : 0;
+    // (Code doesn't run from I/O registers, and reading one could change it)
+    report.opcode = report.pc < 0x2000 || report.pc >= 0x4020 ? core->ram->ReadByte(report.pc) : 0;
+    field = FindField(cpuBefore, "elapsedCycles");
+    report.cpuCycle = field != nullptr ? ReadValue(&cpuBefore.data[field->offset], field->size) : 0;
+    field = FindField(ppuBefore, "currentScanline");
+    report.scanline = field != nullptr ? (uint16_t)ReadValue(&ppuBefore.data[field->offset], field->size) : 0;
+    field = FindField(ppuBefore, "currentScanlineCycle");
+    report.scanlineCycle = field != nullptr ? (uint16_t)ReadValue(&ppuBefore.data[field->offset], field->size) : 0;
+
+    // ...and what each configuration made of the next dot
+    PartState afterA[(int)StateHashPart::Count];
+    PartState afterB[(int)StateHashPart::Count];
+    RunToDot(frameStart, configA, high);
+    CaptureParts(afterA);
+    RunToDot(frameStart, configB, high);
+    CaptureParts(afterB);
+    CompareParts(afterA, afterB, report);
+
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+string NESDL_Divergence::FormatReport(const DivergenceReport& report, const DivergenceConfig& a, const DivergenceConfig& b)
+{
+    stringstream ss;
+    ss << "NESDL divergence: \"" << a.name << "\" vs \"" << b.name << "\"\n";
+    if (!report.diverged)
+    {
+        ss << "No divergence - all " << report.frames << " frames matched (" << string_format("%.2fs", report.seconds) << ")\n";
+        return ss.str();
+    }
+    ss << "First differing frame: " << report.frames << ", " << report.dot << " dots in"
+       << " (scanline " << report.scanline << ", dot " << report.scanlineCycle << ")\n";
+    ss << string_format("CPU: next instruction %02X %s at $%04X, cycle %llu\n", report.opcode,
+                        CPU_OPCODE_STR[CPU_OPCODES[report.opcode]], report.pc, (unsigned long long)report.cpuCycle);
+    ss << "Fields that differ after that dot (" << a.name << " vs " << b.name << "):\n";
+    for (const DivergenceField& f : report.fields)
+    {
+        ss << "  " << f.name << ": " << f.valueA << " vs " << f.valueB << "\n";
+    }
+    if (report.fields.size() == NESDL_DIVERGENCE_MAX_FIELDS)
+    {
+        ss << "  (and maybe more)\n";
+    }
+    ss << string_format("Took %.2fs\n", report.seconds);
+    return ss.str();
+}
+
+void NESDL_Divergence::Restore(const Checkpoint& checkpoint, const DivergenceConfig& config)
+{
+    // Mapper first - setting it resets IRQ timing that the state then puts back
+    core->cpu->SetFastPaths(config.cpuFastPaths);
+    core->ram->SetMapper(core->mapper);
+    core->ppu->SetMapper(core->mapper);
+    NESDL_StateReader reader(checkpoint.state.data(), checkpoint.state.size(), true);
+    core->LoadState(reader);
+
+    frameIndex = checkpoint.frame;
+    if (frameIndex < frames->size())
+    {
+        core->input->LatchInput((*frames)[frameIndex].input[0], (*frames)[frameIndex].input[1]);
+    }
+}
+
+NESDL_Divergence::Checkpoint NESDL_Divergence::Capture()
+{
+    NESDL_StateWriter state;
+    core->SaveState(state);
+    Checkpoint checkpoint;
+    checkpoint.frame = frameIndex;
+    NESDL_SaveStates::CompressBlocks(state.data, checkpoint.state);
+    return checkpoint;
+}
+
+bool NESDL_Divergence::StepDot()
+{
+    // Same as one pass of Core::Update's loop, minus everything that's there for the screen
+    core->cpu->Update(1);
+    core->ppu->Update(1);
+    core->apu->Update(1);
+    if (!core->ppu->frameDataReady)
+    {
+        return false;
+    }
+
+    // Next frame's input goes in at the boundary, just like movie playback
+    core->ppu->frameDataReady = false;
+    frameIndex++;
+    if (frameIndex < frames->size())
+    {
+        core->input->LatchInput((*frames)[frameIndex].input[0], (*frames)[frameIndex].input[1]);
+    }
+    return true;
+}
+
+void NESDL_Divergence::RunFrames(uint32_t count, vector<uint64_t>* hashes)
+{
+    if (hashes != nullptr)
+    {
+        hashes->resize((size_t)count * (int)StateHashPart::Count);
+    }
+    for (uint32_t i = 0; i < count;)
+    {
+        if (StepDot())
+        {
+            if (hashes != nullptr)
+            {
+                core->movie->HashState(hashes->data() + (size_t)i * (int)StateHashPart::Count);
+            }
+            i++;
+        }
+    }
+}
+
+uint32_t NESDL_Divergence::CountFrameDots()
+{
+    uint32_t dots = 1;
+    while (!StepDot())
+    {
+        dots++;
+    }
+    return dots;
+}
+
+vector<uint8_t> NESDL_Divergence::RunToDot(const Checkpoint& frameStart, const DivergenceConfig& config, uint32_t dots)
+{
+    Restore(frameStart, config);
+    for (uint32_t i = 0; i < dots; i++)
+    {
+        StepDot();
+    }
+    NESDL_StateWriter state;
+    core->SaveState(state);
+    return move(state.data);
+}
+
+void NESDL_Divergence::CaptureParts(PartState* parts)
+{
+    for (int i = 0; i < (int)StateHashPart::Count; i++)
+    {
+        NESDL_StateWriter state;
+        state.layout = &parts[i].layout;
+        core->SaveStatePart((StateHashPart)i, state);
+        parts[i].data = move(state.data);
+    }
+}
+
+void NESDL_Divergence::CompareParts(const PartState* a, const PartState* b, DivergenceReport& report)
+{
+    // Both sides were written by the same code, so the layouts line up - only the bytes can differ
+    for (int i = 0; i < (int)StateHashPart::Count; i++)
+    {
+        // The picture's in the PPU's state too - no point listing every pixel twice
+        if ((StateHashPart)i == StateHashPart::Frame)
+        {
+            continue;
+        }
+        const char* partName = NESDL_Movie::GetHashPartName((StateHashPart)i);
+        for (const StateField& field : a[i].layout)
+        {
+            const uint8_t* bytesA = &a[i].data[field.offset];
+            const uint8_t* bytesB = &b[i].data[field.offset];
+            size_t reported = SIZE_MAX; // Start of the element/member last reported, so each is listed once
+            for (size_t pos = 0; pos < field.size && report.fields.size() < NESDL_DIVERGENCE_MAX_FIELDS; pos++)
+            {
+                if (bytesA[pos] == bytesB[pos])
+                {
+                    continue;
+                }
+
+                // Narrow it down to the array element, then the member of that element (if it has a table)
+                size_t element = pos / field.elementSize;
+                size_t unitStart = element * field.elementSize;
+                size_t unitSize = field.elementSize;
+                const StateMember* member = nullptr;
+                for (size_t m = 0; m < field.memberCount; m++)
+                {
+                    const StateMember& candidate = field.members[m];
+                    if (pos - unitStart >= candidate.offset && pos - unitStart < candidate.offset + candidate.size)
+                    {
+                        member = &candidate;
+                        break;
+                    }
+                }
+                if (member != nullptr)
+                {
+                    unitStart += member->offset;
+                    unitSize = member->size;
+                }
+                else if (field.memberCount > 0)
+                {
+                    // Padding between members
+                    unitStart = pos;
+                    unitSize = 1;
+                }
+                else if (unitSize > 8)
+                {
+                    // Some big block without members - just the byte
+                    unitStart = pos;
+                    unitSize = 1;
+                }
+                if (unitStart == reported)
+                {
+                    continue;
+                }
+                reported = unitStart;
+
+                DivergenceField diff;
+                diff.name = string(partName) + " " + field.name;
+                if (field.size != field.elementSize)
+                {
+                    diff.name += string_format("[0x%X]", (unsigned)element);
+                }
+                if (member != nullptr)
+                {
+                    diff.name += string(" ") + member->name;
+                }
+                else if (field.memberCount > 0 || unitSize != field.elementSize)
+                {
+                    diff.name += string_format(" +0x%X", (unsigned)(pos - element * field.elementSize));
+                }
+                diff.valueA = string_format("%0*llX", (int)unitSize * 2, (unsigned long long)ReadValue(bytesA + unitStart, unitSize));
+                diff.valueB = string_format("%0*llX", (int)unitSize * 2, (unsigned long long)ReadValue(bytesB + unitStart, unitSize));
+                report.fields.push_back(diff);
+                pos = unitStart + unitSize - 1;
+            }
+        }
+    }
+}
+
+const StateField* NESDL_Divergence::FindField(const PartState& part, const char* name)
+{
+    for (const StateField& field : part.layout)
+    {
+        if (strcmp(field.name, name) == 0)
+        {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+uint64_t NESDL_Divergence::ReadValue(const uint8_t* src, size_t size)
+{
+    // Little-endian, like everything it was copied out of
+    uint64_t value = 0;
+    memcpy(&value, src, min<size_t>(size, sizeof(value)));
+    return value;
+}
@@ -0,0 +1,150 @@
+#include "NESDL.h"
+
+void NESDL_FlightRecorder::Init(NESDL_Core* c)
+{
+    core = c;
+    Reset();
+}
+
+void NESDL_FlightRecorder::Reset()
+{
+    memset(entries, 0, sizeof(entries));
+    next = 0;
+    watched = 0;
+    inHandler = false;
+    handlerSP = 0;
+    mainMinPC = 0xFFFF;
+    mainMaxPC = 0x0000;
+    mainWrote = false;
+    sawInterrupt = false;
+    stuckMinPC = 0xFFFF;
+    stuckMaxPC = 0x0000;
+    stuckFrames = 0;
+}
+
+void NESDL_FlightRecorder::Watch()
+{
+    // Where the main program has been this frame, and whether it changed anything. A handler's done
+    // once the stack is back where it was when it was entered (however it got there)
+    watched = max(watched, next > NESDL_FLIGHTREC_SIZE ? next - NESDL_FLIGHTREC_SIZE : 0);
+    for (; watched < next; ++watched)
+    {
+        const FlightRecorderEntry& e = entries[watched & (NESDL_FLIGHTREC_SIZE - 1)];
+        if (e.type == FlightRecorderEvent::NMI || e.type == FlightRecorderEvent::IRQ)
+        {
+            if (!inHandler)
+            {
+                inHandler = true;
+                handlerSP = e.sp;
+            }
+            sawInterrupt = true;
+            continue;
+        }
+        if (e.type != FlightRecorderEvent::Instruction)
+        {
+            continue;
+        }
+        if (inHandler && e.sp >= handlerSP)
+        {
+            inHandler = false;
+        }
+        if (!inHandler)
+        {
+            mainMinPC = min(mainMinPC, e.addr);
+            mainMaxPC = max(mainMaxPC, e.addr);
+            mainWrote |= NESDL_FLIGHTREC_WRITES[CPU_OPCODES[e.data]];
+            // BRK goes into the IRQ handler same as an interrupt
+            if (CPU_OPCODES[e.data] == BRK)
+            {
+                inHandler = true;
+                handlerSP = e.sp;
+            }
+        }
+    }
+}
+
+void NESDL_FlightRecorder::EndFrame()
+{
+    Watch();
+
+    // Hang watchdog - only what the main program does counts. NMIs keep firing (and keep the PPU and APU
+    // busy) in most hangs, while the main loop sits waiting on a flag that never changes. So it's a hang
+    // when the main program has spent several seconds inside a few bytes of code without writing anything.
+    // The one exception is a lone JMP to itself with interrupts still coming in - games that do all their
+    // work in the NMI handler just park the main program like that
+    bool ranMain = mainMinPC <= mainMaxPC;
+    uint16_t minPC = min(stuckMinPC, mainMinPC);
+    uint16_t maxPC = max(stuckMaxPC, mainMaxPC);
+    bool parked = ranMain && mainMinPC == mainMaxPC && sawInterrupt;
+    bool stuck = !ranMain || (!mainWrote && !parked && maxPC - minPC < NESDL_FLIGHTREC_HANG_BYTES);
+    if (stuck)
+    {
+        stuckMinPC = minPC;
+        stuckMaxPC = maxPC;
+        // Only dump once per hang, the ring won't have anything new in it after that
+        if (++stuckFrames == NESDL_FLIGHTREC_HANG_FRAMES)
+        {
+            if (minPC <= maxPC)
+            {
+                Dump(string_format("Hang watchdog (main program stuck at $%04X-$%04X for %d frames)",
+                                   minPC, maxPC, NESDL_FLIGHTREC_HANG_FRAMES));
+            }
+            else
+            {
+                Dump(string_format("Hang watchdog (main program never got back from an interrupt in %d frames)",
+                                   NESDL_FLIGHTREC_HANG_FRAMES));
+            }
+        }
+    }
+    else
+    {
+        stuckMinPC = 0xFFFF;
+        stuckMaxPC = 0x0000;
+        stuckFrames = 0;
+    }
+    mainMinPC = 0xFFFF;
+    mainMaxPC = 0x0000;
+    mainWrote = false;
+    sawInterrupt = false;
+}
+
+bool NESDL_FlightRecorder::Dump(const string& reason)
+{
+    ofstream file;
+    file.open(NESDL_FLIGHTREC_FILE, ofstream::out | ofstream::trunc);
+    if (!file.is_open())
+    {
+        printf("Couldn't write flight recorder dump to %s\n", NESDL_FLIGHTREC_FILE);
+        return false;
+    }
+
+    uint64_t count = next < NESDL_FLIGHTREC_SIZE ? next : NESDL_FLIGHTREC_SIZE;
+    file << "NESDL flight recorder: " << reason << "\n";
+    file << "Frame " << core->ppu->currentFrame << ", last " << count << " events (oldest first)\n\n";
+    for (uint64_t i = next - count; i < next; ++i)
+    {
+        const FlightRecorderEntry& e = entries[i & (NESDL_FLIGHTREC_SIZE - 1)];
+        switch (e.type)
+        {
+            case FlightRecorderEvent::Instruction:
+                file << string_format("%12llu  %04X  %02X %-4s A:%02X X:%02X Y:%02X P:%02X SP:%02X\n",
+                                      e.cpuCycle, e.addr, e.data, CPU_OPCODE_STR[CPU_OPCODES[e.data]],
+                                      e.a, e.x, e.y, e.flags.Apply(e.p), e.sp);
+                break;
+            case FlightRecorderEvent::PPUWrite:
+            case FlightRecorderEvent::APUWrite:
+                file << string_format("%12llu        %s $%04X = %02X\n", e.cpuCycle,
+                                      e.type == FlightRecorderEvent::PPUWrite ? "PPU" : "APU", e.addr, e.data);
+                break;
+            case FlightRecorderEvent::NMI:
+            case FlightRecorderEvent::IRQ:
+                file << string_format("%12llu  %04X  -- %-4s A:%02X X:%02X Y:%02X P:%02X SP:%02X\n",
+                                      e.cpuCycle, e.addr, e.type == FlightRecorderEvent::NMI ? "NMI" : "IRQ",
+                                      e.a, e.x, e.y, e.flags.Apply(e.p), e.sp);
+                break;
+        }
+    }
+    file.close();
+    printf("Flight recorder dumped to %s: %s\n", NESDL_FLIGHTREC_FILE, reason.c_str());
+    return true;
+}
@@ -0,0 +1,133 @@
+#include "NESDL.h"
+
+#ifdef NESDL_HOTSPOTS
+
+NESDL_Mapper* NESDL_HotSpots::mapper = nullptr;
+vector<NESDL_HotSpotEntry> NESDL_HotSpots::entries;
+vector<uint64_t> NESDL_HotSpots::frameCycles;
+vector<uint64_t> NESDL_HotSpots::history;
+uint32_t NESDL_HotSpots::historyIndex = 0;
+uint32_t NESDL_HotSpots::historyCount = 0;
+uint64_t NESDL_HotSpots::frameNumber = 0;
+
+void NESDL_HotSpots::Begin(NESDL_Mapper* m, uint32_t prgROMSize)
+{
+    // Everything is sized up front so counting never allocates
+    uint32_t bankCount = (prgROMSize + NESDL_HOTSPOT_BANK_SIZE - 1) / NESDL_HOTSPOT_BANK_SIZE;
+    entries.assign(NESDL_HOTSPOT_NONROM_SIZE + prgROMSize, NESDL_HotSpotEntry());
+    frameCycles.assign(1 + bankCount, 0);
+    history.assign(NESDL_HOTSPOT_HISTORY * frameCycles.size(), 0);
+    historyIndex = 0;
+    historyCount = 0;
+    frameNumber = 0;
+    mapper = m;
+}
+
+void NESDL_HotSpots::End()
+{
+    if (mapper == nullptr)
+    {
+        return;
+    }
+    WriteReport(NESDL_HOTSPOT_REPORT_FILE);
+    WriteFrameCSV(NESDL_HOTSPOT_FRAMES_FILE);
+    mapper = nullptr;
+}
+
+void NESDL_HotSpots::EndFrame()
+{
+    if (mapper == nullptr)
+    {
+        return;
+    }
+    memcpy(&history[historyIndex * frameCycles.size()], frameCycles.data(), frameCycles.size() * sizeof(uint64_t));
+    fill(frameCycles.begin(), frameCycles.end(), 0);
+    historyIndex = (historyIndex + 1) % NESDL_HOTSPOT_HISTORY;
+    if (historyCount < NESDL_HOTSPOT_HISTORY)
+    {
+        historyCount++;
+    }
+    frameNumber++;
+}
+
+bool NESDL_HotSpots::WriteReport(const char* path)
+{
+    ofstream file;
+    file.open(path, ofstream::out | ofstream::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Sort just the indices of addresses that ever ran, hottest (by cycles) first
+    vector<uint32_t> hot;
+    uint64_t totalInstructions = 0;
+    uint64_t totalCycles = 0;
+    for (uint32_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].instructions > 0)
+        {
+            hot.push_back(i);
+            totalInstructions += entries[i].instructions;
+            totalCycles += entries[i].cycles;
+        }
+    }
+    sort(hot.begin(), hot.end(), [](uint32_t a, uint32_t b) { return entries[a].cycles > entries[b].cycles; });
+
+    file << "NESDL hot spots - " << frameNumber << " frames, " << totalInstructions << " instructions, "
+         << totalCycles << " cycles\n\n";
+    file << " bank:addr   opcode        instructions          cycles   %cycles\n";
+    size_t count = min(hot.size(), (size_t)NESDL_HOTSPOT_REPORT_COUNT);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t index = hot[i];
+        const NESDL_HotSpotEntry& e = entries[index];
+        string location = index < NESDL_HOTSPOT_NONROM_SIZE ? string_format("  RAM:%04X", e.cpuAddr) :
+            string_format("  $%02X:%04X", (index - NESDL_HOTSPOT_NONROM_SIZE) / NESDL_HOTSPOT_BANK_SIZE, e.cpuAddr);
+        file << location
+             << string_format("   %02X %-4s   %18llu  %14llu  %7.3f%%\n",
+                              e.opcode, CPU_OPCODE_STR[CPU_OPCODES[e.opcode]],
+                              e.instructions, e.cycles, totalCycles ? 100.0 * e.cycles / totalCycles : 0.0);
+    }
+    file.close();
+    return true;
+}
+
+bool NESDL_HotSpots::WriteFrameCSV(const char* path)
+{
+    ofstream file;
+    file.open(path, ofstream::out | ofstream::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // One row per frame (oldest first), CPU cycles spent executing from RAM and each 8KB PRG bank
+    size_t columns = frameCycles.size();
+    file << "frame,total,ram";
+    for (size_t b = 1; b < columns; ++b)
+    {
+        file << ",bank" << (b - 1);
+    }
+    file << "\n";
+    uint32_t first = historyCount < NESDL_HOTSPOT_HISTORY ? 0 : historyIndex;
+    for (uint32_t f = 0; f < historyCount; ++f)
+    {
+        const uint64_t* row = &history[((first + f) % NESDL_HOTSPOT_HISTORY) * columns];
+        uint64_t total = 0;
+        for (size_t b = 0; b < columns; ++b)
+        {
+            total += row[b];
+        }
+        file << (frameNumber - historyCount + f) << "," << total;
+        for (size_t b = 0; b < columns; ++b)
+        {
+            file << "," << row[b];
+        }
+        file << "\n";
+    }
+    file.close();
+    return true;
+}
+
+#endif
@@ -7,6 +7,21 @@ void NESDL_Input::Init(NESDL_Core* c)
     player2 = {0}; // Initialize values to 0
     
     readBit = 0; // Start "unloaded", AKA all reads will return a default (1)
+    readInputStrobe = false;
+    inputLatched = false;
+}
+
+void NESDL_Input::SaveState(NESDL_StateWriter& state)
+{
+    // Only where the game is in reading the controllers - which buttons are down is up to the player
+    state.Write(readBit, "readBit");
+    state.Write(readInputStrobe, "readInputStrobe");
+}
+
+void NESDL_Input::LoadState(NESDL_StateReader& state)
+{
+    state.Read(readBit);
+    state.Read(readInputStrobe);
 }
 
 void NESDL_Input::SetControllerConnected(bool connected, bool isPlayer2)
@@ -68,7 +83,18 @@ void NESDL_Input::RegisterKey(SDL_KeyCode keyCode, bool keyDown)
     }
 }
 
-// Unused function?
+void NESDL_Input::LatchInput(uint8_t player1Byte, uint8_t player2Byte)
+{
+    inputLatched = true;
+    latchedInput[0] = player1Byte;
+    latchedInput[1] = player2Byte;
+}
+
+void NESDL_Input::UnlatchInput()
+{
+    inputLatched = false;
+}
+
 uint8_t NESDL_Input::PlayerInputToByte(bool isPlayer2)
 {
     uint8_t result = 0;
@@ -125,6 +151,11 @@ bool NESDL_Input::GetNextPlayerInputBit(bool isPlayer2)
 
 bool NESDL_Input::GetPlayerInputBit(uint8_t index, bool isPlayer2)
 {
+    if (inputLatched && index < 8)
+    {
+        return (latchedInput[isPlayer2 ? 1 : 0] >> index) & 1;
+    }
+
     PlayerInput player = isPlayer2 ? player2 : player1;
     
     switch (index)
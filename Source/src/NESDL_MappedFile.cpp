@@ -0,0 +1,108 @@
+#include "NESDL.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+NESDL_MappedFile::NESDL_MappedFile()
+{
+    data = nullptr;
+    size = 0;
+#ifdef _WIN32
+    fileHandle = INVALID_HANDLE_VALUE;
+    mappingHandle = NULL;
+#else
+    fileDescriptor = -1;
+#endif
+}
+
+NESDL_MappedFile::~NESDL_MappedFile()
+{
+    Close();
+}
+
+bool NESDL_MappedFile::Open(const char* path, bool sequential)
+{
+    Close();
+    
+#ifdef _WIN32
+    fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+    size = (uint64_t)fileSize.QuadPart;
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle == NULL)
+    {
+        Close();
+        return false;
+    }
+    data = (uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        Close();
+        return false;
+    }
+    size = (uint64_t)fileStat.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    data = mapped == MAP_FAILED ? nullptr : (uint8_t*)mapped;
+    if (data != nullptr && sequential)
+    {
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+#endif
+    if (data == nullptr)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void NESDL_MappedFile::Close()
+{
+#ifdef _WIN32
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != NULL)
+    {
+        CloseHandle(mappingHandle);
+        mappingHandle = NULL;
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (data != nullptr)
+    {
+        munmap(data, size);
+    }
+    if (fileDescriptor >= 0)
+    {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
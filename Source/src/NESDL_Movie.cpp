@@ -0,0 +1,349 @@
+#include "NESDL.h"
+
+// Same primes and mixing as xxHash64
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+#define HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t RotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t HashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * HASH_PRIME2;
+    acc = RotateLeft(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+static inline uint64_t HashMerge(uint64_t hash, uint64_t lane)
+{
+    hash ^= HashRound(0, lane);
+    return hash * HASH_PRIME1 + HASH_PRIME4;
+}
+
+static inline uint64_t Read64(const uint8_t* src)
+{
+    uint64_t value;
+    memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+void NESDL_Movie::Init(NESDL_Core* c)
+{
+    core = c;
+    mode = MovieMode::Off;
+    header = {};
+    frameIndex = 0;
+    latchedInput[0] = 0;
+    latchedInput[1] = 0;
+}
+
+bool NESDL_Movie::StartRecording(const string& moviePath, uint64_t romSize)
+{
+    Stop();
+    path = moviePath;
+
+    // Everything the movie needs to start from the same place, however the machine got here
+    NESDL_StateWriter state;
+    core->SaveState(state);
+    startState.clear();
+    NESDL_SaveStates::CompressBlocks(state.data, startState);
+
+    header = {};
+    header.magic = NESDL_MOVIE_MAGIC;
+    header.version = NESDL_MOVIE_VERSION;
+    header.romSize = romSize;
+    header.startStateSize = (uint32_t)state.data.size();
+    header.startStatePackedSize = (uint32_t)startState.size();
+    header.mapper = core->mapper->mapperNumber;
+    frames.clear();
+
+    // From here the game sees whatever the keys were at the start of each frame
+    LatchInput(core->input->PlayerInputToByte(false), core->input->PlayerInputToByte(true));
+    mode = MovieMode::Recording;
+    return true;
+}
+
+bool NESDL_Movie::StartPlayback(const string& moviePath, uint64_t romSize, string& error)
+{
+    Stop();
+
+    MovieFileHeader fileHeader;
+    vector<uint8_t> fileStartState;
+    vector<MovieFrame> fileFrames;
+    if (!ReadMovie(moviePath, romSize, core->mapper->mapperNumber, fileHeader, fileStartState, fileFrames, error))
+    {
+        return false;
+    }
+
+    // Same as loading a save state - if the snapshot's no good, put things back how they were
+    NESDL_StateWriter backup;
+    core->SaveState(backup);
+    NESDL_StateReader reader(fileStartState.data(), fileStartState.size(), true);
+    core->LoadState(reader);
+    if (reader.Failed() || !reader.AtEnd())
+    {
+        NESDL_StateReader restore(backup.data.data(), backup.data.size(), false);
+        core->LoadState(restore);
+        error = "Movie is damaged";
+        return false;
+    }
+
+    header = fileHeader;
+    path = moviePath;
+    startState = move(fileStartState);
+    frames = move(fileFrames);
+    frameIndex = 0;
+    LatchInput(frames[0].input[0], frames[0].input[1]);
+    mode = MovieMode::Playing;
+    return true;
+}
+
+bool NESDL_Movie::ReadMovie(const string& moviePath, uint64_t romSize, uint8_t mapperNumber, MovieFileHeader& fileHeader,
+                            vector<uint8_t>& fileStartState, vector<MovieFrame>& fileFrames, string& error)
+{
+    NESDL_MappedFile file;
+    if (!file.Open(moviePath.c_str(), true))
+    {
+        error = "No movie recorded for this ROM";
+        return false;
+    }
+    if (file.GetSize() < sizeof(fileHeader))
+    {
+        error = "Movie is damaged";
+        return false;
+    }
+    memcpy(&fileHeader, file.GetData(), sizeof(fileHeader));
+    if (fileHeader.magic != NESDL_MOVIE_MAGIC || fileHeader.version != NESDL_MOVIE_VERSION)
+    {
+        error = "Movie is from a different version of NESDL";
+        return false;
+    }
+    if (fileHeader.romSize != romSize || fileHeader.mapper != mapperNumber)
+    {
+        error = "Movie is for a different ROM";
+        return false;
+    }
+    uint64_t framesOffset = sizeof(fileHeader) + (uint64_t)fileHeader.startStatePackedSize;
+    if (fileHeader.frameCount == 0 ||
+        framesOffset + (uint64_t)fileHeader.frameCount * sizeof(MovieFrame) > file.GetSize())
+    {
+        error = "Movie is damaged";
+        return false;
+    }
+
+    const uint8_t* data = file.GetData();
+    fileStartState.assign(data + sizeof(fileHeader), data + framesOffset);
+    fileFrames.resize(fileHeader.frameCount);
+    memcpy(fileFrames.data(), data + framesOffset, fileHeader.frameCount * sizeof(MovieFrame));
+    return true;
+}
+
+void NESDL_Movie::Stop()
+{
+    if (mode == MovieMode::Recording)
+    {
+        header.frameCount = (uint32_t)frames.size();
+        report = WriteMovie() ? "Movie saved - " + to_string(frames.size()) + " frames" : "Couldn't save movie";
+        printf("%s\n", report.c_str());
+    }
+    if (mode != MovieMode::Off)
+    {
+        core->input->UnlatchInput();
+    }
+    mode = MovieMode::Off;
+    frames.clear();
+    startState.clear();
+}
+
+void NESDL_Movie::EndFrame()
+{
+    if (mode == MovieMode::Off)
+    {
+        return;
+    }
+
+    MovieFrame frame = {};
+    HashState(frame.hashes);
+    if (mode == MovieMode::Recording)
+    {
+        // What was latched for this frame goes in the record - the keys as they are now are next frame's
+        frame.input[0] = latchedInput[0];
+        frame.input[1] = latchedInput[1];
+        frames.push_back(frame);
+        LatchInput(core->input->PlayerInputToByte(false), core->input->PlayerInputToByte(true));
+        return;
+    }
+
+    // Playing back - everything has to match what was recorded, or it's not deterministic
+    const MovieFrame& expected = frames[frameIndex];
+    string parts;
+    for (int i = 0; i < (int)StateHashPart::Count; i++)
+    {
+        if (frame.hashes[i] != expected.hashes[i])
+        {
+            parts += (parts.empty() ? "" : ", ") + string(GetHashPartName((StateHashPart)i));
+            printf("Frame %u %s: recorded %016llX, got %016llX\n", frameIndex, GetHashPartName((StateHashPart)i),
+                   (unsigned long long)expected.hashes[i], (unsigned long long)frame.hashes[i]);
+        }
+    }
+    if (!parts.empty())
+    {
+        report = "Replay diverged at frame " + to_string(frameIndex) + ": " + parts;
+        printf("%s\n", report.c_str());
+        Stop();
+        return;
+    }
+    if (++frameIndex == frames.size())
+    {
+        report = "Replay matched all " + to_string(frames.size()) + " frames";
+        printf("%s\n", report.c_str());
+        Stop();
+        return;
+    }
+    LatchInput(frames[frameIndex].input[0], frames[frameIndex].input[1]);
+}
+
+void NESDL_Movie::LatchInput(uint8_t player1, uint8_t player2)
+{
+    latchedInput[0] = player1;
+    latchedInput[1] = player2;
+    core->input->LatchInput(player1, player2);
+}
+
+bool NESDL_Movie::TakeReport(string& out)
+{
+    if (report.empty())
+    {
+        return false;
+    }
+    out = move(report);
+    report.clear();
+    return true;
+}
+
+uint64_t NESDL_Movie::Hash(const uint8_t* src, size_t size, uint64_t seed)
+{
+    const uint8_t* end = src + size;
+    uint64_t hash;
+    if (size >= 32)
+    {
+        // The four lanes don't depend on each other until the very end
+        uint64_t lane0 = seed + HASH_PRIME1 + HASH_PRIME2;
+        uint64_t lane1 = seed + HASH_PRIME2;
+        uint64_t lane2 = seed;
+        uint64_t lane3 = seed - HASH_PRIME1;
+        const uint8_t* lastStripe = end - 32;
+        do
+        {
+            lane0 = HashRound(lane0, Read64(src));
+            lane1 = HashRound(lane1, Read64(src + 8));
+            lane2 = HashRound(lane2, Read64(src + 16));
+            lane3 = HashRound(lane3, Read64(src + 24));
+            src += 32;
+        }
+        while (src <= lastStripe);
+
+        hash = RotateLeft(lane0, 1) + RotateLeft(lane1, 7) + RotateLeft(lane2, 12) + RotateLeft(lane3, 18);
+        hash = HashMerge(hash, lane0);
+        hash = HashMerge(hash, lane1);
+        hash = HashMerge(hash, lane2);
+        hash = HashMerge(hash, lane3);
+    }
+    else
+    {
+        hash = seed + HASH_PRIME5;
+    }
+    hash += size;
+
+    // Whatever's left over that doesn't fill a stripe
+    for (; src + 8 <= end; src += 8)
+    {
+        hash ^= HashRound(0, Read64(src));
+        hash = RotateLeft(hash, 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    if (src + 4 <= end)
+    {
+        uint32_t value;
+        memcpy(&value, src, sizeof(value));
+        hash ^= value * HASH_PRIME1;
+        hash = RotateLeft(hash, 23) * HASH_PRIME2 + HASH_PRIME3;
+        src += 4;
+    }
+    for (; src < end; src++)
+    {
+        hash ^= *src * HASH_PRIME5;
+        hash = RotateLeft(hash, 11) * HASH_PRIME1;
+    }
+
+    // Final avalanche
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+const char* NESDL_Movie::GetHashPartName(StateHashPart part)
+{
+    switch (part)
+    {
+        case StateHashPart::CPU:
+            return "CPU";
+        case StateHashPart::PPU:
+            return "PPU";
+        case StateHashPart::APU:
+            return "APU";
+        case StateHashPart::RAM:
+            return "RAM";
+        case StateHashPart::Input:
+            return "Input";
+        case StateHashPart::Mapper:
+            return "Mapper";
+        case StateHashPart::Frame:
+            return "Frame";
+        default:
+            return "?";
+    }
+}
+
+void NESDL_Movie::HashState(uint64_t* hashes)
+{
+    // Each part is serialized exactly as a save state would have it, then hashed. hashScratch keeps
+    // its capacity between frames, so after the first one this is a memcpy and a hash per part
+    for (int i = 0; i < (int)StateHashPart::Count; i++)
+    {
+        hashScratch.data.clear();
+        core->SaveStatePart((StateHashPart)i, hashScratch);
+        hashes[i] = Hash(hashScratch.data.data(), hashScratch.data.size());
+    }
+}
+
+bool NESDL_Movie::WriteMovie()
+{
+    // Off to the side and renamed into place, same as save states
+    string tempPath = path + ".tmp";
+    {
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)startState.data(), startState.size());
+        out.write((const char*)frames.data(), frames.size() * sizeof(MovieFrame));
+        out.close();
+        if (!out)
+        {
+            return false;
+        }
+    }
+    error_code ec;
+    filesystem::rename(tempPath, path, ec);
+    return !ec;
+}
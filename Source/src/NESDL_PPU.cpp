@@ -1,16 +1,29 @@
 #include "NESDL.h"
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define NESDL_PPU_SSE2
+#endif
 
 void NESDL_PPU::Init(NESDL_Core* c)
 {
     core = c;
+    mapperIRQAt = UINT64_MAX;
+    BuildDotActionTable();
 }
 
 void NESDL_PPU::Reset(bool hardReset)
 {
+    // Bring MMC3's IRQ counter up to date before the PPU's timeline starts over
+    if (mapper != nullptr && mapper->mapperNumber == 4)
+    {
+        ((NESDL_Mapper_4*)mapper)->SyncIRQ();
+    }
+    
     elapsedCycles = 21;
     currentFrame = 0;
     currentScanline = 0;
     currentScanlineCycle = 21;
+    currentLineType = GetLineType(currentScanline);
     currentDrawX = 0;
     ppuOpenBus = 0x00; // Not always on IRL hardware, but most of the time
     registers.ctrl = 0;
@@ -34,13 +47,90 @@ void NESDL_PPU::Reset(bool hardReset)
     tileFetch.paletteIndex = 0;
     
     incrementV = true; // NESDL flag - a bit hacky though
-    oamN = 0;
-    oamM = 0;
     secondaryOAMNextSlot = 0;
+    sprOverflowCycle = 0;
     disregardVBL = false;
     disregardNMI = false;
 
     irqFiredAt = 0;
+    mapperIRQAt = UINT64_MAX; // Nothing can be clocked until PPUCTRL picks pattern tables
+}
+
+void NESDL_PPU::SaveState(NESDL_StateWriter& state)
+{
+    state.Write(registers, "registers");
+    state.Write(incrementV, "incrementV");
+    state.Write(isWriting, "isWriting");
+    state.Write(currentFrame, "currentFrame");
+    state.Write(currentScanline, "currentScanline");
+    state.Write(currentScanlineCycle, "currentScanlineCycle");
+    state.Write(frameFinished, "frameFinished");
+    state.Write(irqFiredAt, "irqFiredAt");
+    state.Write(mapperIRQAt, "mapperIRQAt");
+    state.Write(nmiFiredAt, "nmiFiredAt");
+    state.Write(elapsedCycles, "elapsedCycles");
+    state.Write(currentLineType, "currentLineType");
+    state.Write(currentDrawX, "currentDrawX");
+    state.Write(compositedX, "compositedX");
+    state.Write(vram, "vram");
+    state.Write(paletteData, "paletteData");
+    state.Write(ppuOpenBus, "ppuOpenBus");
+    state.Write(ppuVramBus, "ppuVramBus");
+    state.Write(tileFetch, "tileFetch");
+    state.Write(tileBuffer, "tileBuffer");
+    state.Write(ppuDataReadBuffer, "ppuDataReadBuffer");
+    state.Write(oam, "oam");
+    state.Write(secondaryOAM, "secondaryOAM");
+    state.Write(sprOverflowCycle, "sprOverflowCycle");
+    state.Write(secondaryOAMNextSlot, "secondaryOAMNextSlot");
+    state.Write(sprFetchIndex, "sprFetchIndex");
+    state.Write(disregardVBL, "disregardVBL");
+    state.Write(disregardNMI, "disregardNMI");
+    state.Write(specialNMI, "specialNMI");
+    // A state can be taken partway through a line - sprite zero hits come out of compositing these
+    state.Write(bgLine, "bgLine");
+    state.Write(sprLine, "sprLine");
+    // The frame isn't needed to carry on, but without it a state loaded while paused shows the wrong picture
+    state.Write(frameData, "frameData");
+    state.Write(frameEmphasis, "frameEmphasis");
+}
+
+void NESDL_PPU::LoadState(NESDL_StateReader& state)
+{
+    state.Read(registers);
+    state.Read(incrementV);
+    state.Read(isWriting);
+    state.Read(currentFrame);
+    state.Read(currentScanline);
+    state.Read(currentScanlineCycle);
+    state.Read(frameFinished);
+    state.Read(irqFiredAt);
+    state.Read(mapperIRQAt);
+    state.Read(nmiFiredAt);
+    state.Read(elapsedCycles);
+    state.Read(currentLineType);
+    state.Read(currentDrawX);
+    state.Read(compositedX);
+    state.Read(vram);
+    state.Read(paletteData);
+    state.Read(ppuOpenBus);
+    state.Read(ppuVramBus);
+    state.Read(tileFetch);
+    state.Read(tileBuffer);
+    state.Read(ppuDataReadBuffer);
+    state.Read(oam);
+    state.Read(secondaryOAM);
+    state.Read(sprOverflowCycle);
+    state.Read(secondaryOAMNextSlot);
+    state.Read(sprFetchIndex);
+    state.Read(disregardVBL);
+    state.Read(disregardNMI);
+    state.Read(specialNMI);
+    state.Read(bgLine);
+    state.Read(sprLine);
+    state.Read(frameData);
+    state.Read(frameEmphasis);
+    frameDataReady = false;
 }
 
 void NESDL_PPU::Update(uint32_t ppuCycles)
@@ -56,6 +146,11 @@ void NESDL_PPU::Update(uint32_t ppuCycles)
 void NESDL_PPU::SetMapper(NESDL_Mapper* m)
 {
     mapper = m;
+    mapperIRQAt = UINT64_MAX;
+    if (m != nullptr && m->mapperNumber == 4)
+    {
+        ((NESDL_Mapper_4*)m)->RestartIRQTiming();
+    }
 }
 
 bool NESDL_PPU::IsPPUReady()
@@ -63,520 +158,453 @@ bool NESDL_PPU::IsPPUReady()
     return elapsedCycles >= NESDL_PPU_READY * 3;
 }
 
-void NESDL_PPU::RunNextCycle()
+void NESDL_PPU::BuildDotActionTable()
 {
-    // Each PPU cycle is one pixel being rendered. There are 341 cycles per scanline,
-    // 262 scanlines per frame. (Although only 256x240 is rendered)
+    // Lay out which dots do what for each type of scanline, so RunNextCycle can look the
+    // work up instead of going through a chain of range checks every cycle
+    memset(dotActions, 0, sizeof(dotActions));
     
-    if (currentScanline < 240) // Visible scanlines (0-239)
+    uint32_t* visible = dotActions[PPU_LINE_VISIBLE];
+    uint32_t* preRender = dotActions[PPU_LINE_PRERENDER];
+    for (uint16_t dot = 0; dot < PPU_DOTS_PER_LINE; ++dot)
     {
-        HandleProcessVisibleScanline();
-    }
-    else if (currentScanline == 240)
-    {
-        // Signal to core that we've finished drawing to our frame data
-        if (currentScanlineCycle == 0)
+        uint8_t pixelInFetchCycle = dot & 0x7;
+        bool isTileDot = (dot > 0 && dot < 256) || (dot > 320 && dot < 337);
+        
+        if (dot < NESDL_SCREEN_WIDTH)
+        {
+            visible[dot] |= PPUDOT_BG_PIXEL;
+        }
+        if (isTileDot)
+        {
+            visible[dot] |= PPUDOT_BG_FETCH;
+            preRender[dot] |= PPUDOT_BG_FETCH;
+            if (pixelInFetchCycle == 7)
+            {
+                // Visible dots render the outgoing tile along with shifting the next one in
+                visible[dot] |= dot < 256 ? PPUDOT_BG_DRAW : PPUDOT_BG_RELOAD;
+                preRender[dot] |= dot < 256 ? 0 : PPUDOT_BG_RELOAD;
+            }
+        }
+        if (dot > 64 && dot < 256)
+        {
+            visible[dot] |= PPUDOT_SPR_OVERFLOW;
+        }
+        if (dot > 256 && dot < 320 && pixelInFetchCycle == 4)
         {
-            frameDataReady = true;
+            visible[dot] |= PPUDOT_SPR_FETCH;
         }
+        if (dot >= 280 && dot <= 304)
+        {
+            preRender[dot] |= PPUDOT_RESET_Y;
+        }
+        if (dot > 336 && (dot & 0x1) == 1)
+        {
+            visible[dot] |= PPUDOT_NT_DUMMY;
+        }
+    }
+    visible[0] |= PPUDOT_LINE_START;
+    visible[63] |= PPUDOT_SPR_CLEAR;
+    visible[64] |= PPUDOT_SPR_EVAL;
+    visible[256] |= PPUDOT_INC_Y | PPUDOT_COMPOSITE;
+    visible[257] |= PPUDOT_RESET_X | PPUDOT_SPR_LINE_CLEAR;
+    
+    preRender[1] |= PPUDOT_FLAGS_CLEAR;
+    preRender[257] |= PPUDOT_PRERENDER_RESET_X;
+    
+    dotActions[PPU_LINE_POSTRENDER][0] |= PPUDOT_FRAME_READY;
+    dotActions[PPU_LINE_VBLANK_START][1] |= PPUDOT_VBLANK_SET;
+}
+
+uint8_t NESDL_PPU::GetLineType(uint16_t scanline)
+{
+    if (scanline < 240)
+    {
+        return PPU_LINE_VISIBLE;
+    }
+    else if (scanline == 240)
+    {
+        return PPU_LINE_POSTRENDER;
     }
-    else if (currentScanline > 240 && currentScanline < 262) // VBLANK scanlines (241-261)
+    else if (scanline == 241)
     {
-        HandleProcessVBlankScanline();
+        return PPU_LINE_VBLANK_START;
+    }
+    else if (scanline < 261)
+    {
+        return PPU_LINE_VBLANK;
+    }
+    return PPU_LINE_PRERENDER;
+}
+
+void NESDL_PPU::RunNextCycle()
+{
+    // Each PPU cycle is one pixel being rendered. There are 341 cycles per scanline,
+    // 262 scanlines per frame. (Although only 256x240 is rendered)
+    uint32_t actions = dotActions[currentLineType][currentScanlineCycle];
+    if (actions != 0)
+    {
+        RunDotActions(actions);
     }
     
     elapsedCycles++;
-    currentScanlineCycle = elapsedCycles % 341;
     
     // Wrap counters around
-    if (currentScanlineCycle == 0)
+    if (++currentScanlineCycle == PPU_DOTS_PER_LINE)
     {
-        currentScanline++;
+        currentScanlineCycle = 0;
+        if (++currentScanline == PPU_LINES_PER_FRAME)
+        {
+            currentScanline = 0;
+            currentFrame++;
+        }
+        currentLineType = GetLineType(currentScanline);
     }
-    if (currentScanline > 0 && currentScanline % 262 == 0)
+
+    // MMC3 only: rather than being clocked at certain times during rendering, it works out which
+    // cycle its IRQ will fire at ahead of time (see NESDL_Mapper_4::ScheduleIRQ)
+    if (elapsedCycles == mapperIRQAt)
     {
-        currentScanline = 0;
-        currentFrame++;
+        ((NESDL_Mapper_4*)mapper)->RunPredictedIRQ();
     }
+}
 
-    // MMC3 only: clock IRQ at certain times during visible rendering
-    if ((currentScanline < 240 || currentScanline > 260) && mapper->mapperNumber == 4)
+void NESDL_PPU::RunDotActions(uint32_t actions)
+{
+    bool bgEnabled = (registers.mask & PPUMASK_BGENABLE) != 0x00;
+    bool sprEnabled = (registers.mask & PPUMASK_SPRENABLE) != 0x00;
+    
+    if (actions & PPUDOT_LINE_START)
     {
-        // 8x16 mode
-        if (registers.ctrl & PPUCTRL_SPRHEIGHT)
+        // Emphasis bits don't fit alongside the 6-bit palette index, so sample them once per line
+        frameEmphasis[currentScanline] = registers.mask >> 5;
+        
+        // This line's sprites were already rendered during the last line's fetch. Sprites aren't
+        // drawn on line 0 (nothing was evaluated for it on the pre-render line)
+        compositedX = 0;
+        if (!sprEnabled || currentScanline == 0)
         {
-            if (registers.ctrl & PPUCTRL_BGTILE && !(registers.ctrl & PPUCTRL_SPRTILE))
-            {
-                // If BG=0x1000 (& Spr = 0x0000), clock IRQ at PPU=324
-                if (currentScanlineCycle == 324)
-                {
-                    //printf("\nIRQ Clock (Scanline 324)");
-                    ((NESDL_Mapper_4*)mapper)->ClockIRQ();
-                }
-            }
-            else if (!(registers.ctrl & PPUCTRL_BGTILE) && registers.ctrl & PPUCTRL_SPRTILE)
-            {
-                // If BG=0x0000 (& Spr = 0x1000), clock IRQ at PPU=260
-                if (currentScanlineCycle == 260)
-                {
-                    //printf("\nIRQ Clock (Scanline 260)");
-                    ((NESDL_Mapper_4*)mapper)->ClockIRQ();
-                }
-            }
+            memset(sprLine.opaque, 0x00, sizeof(sprLine.opaque));
+            memset(sprLine.spriteZero, 0x00, sizeof(sprLine.spriteZero));
         }
-        // 8x8 mode
-        else
+        
+        if (currentScanline == 0)
         {
-            if (registers.ctrl & PPUCTRL_BGTILE && !(registers.ctrl & PPUCTRL_SPRTILE))
+            if (currentFrame > 0)
             {
-                // If BG=0x1000 (& Spr = 0x0000), clock IRQ at PPU=324
-                if (currentScanlineCycle == 324)
-                {
-                    //printf("\nIRQ Clock (Scanline 324)");
-                    ((NESDL_Mapper_4*)mapper)->ClockIRQ();
-                }
+                frameFinished = true;
             }
-            else if (!(registers.ctrl & PPUCTRL_BGTILE) && registers.ctrl & PPUCTRL_SPRTILE)
+            
+            // THE ONLY TIME we advance the cycle count artificially - this cycle is skipped
+            // when the frame count is odd (counting by 0)
+            if (bgEnabled && (currentFrame & 0x1) == 0)
             {
-                // If BG=0x0000 (& Spr = 0x1000), clock IRQ at PPU=260
-                if (currentScanlineCycle == 260)
-                {
-                    //printf("\nIRQ Clock (Scanline 260)");
-                    ((NESDL_Mapper_4*)mapper)->ClockIRQ();
-                }
+                elapsedCycles++;
+                currentScanlineCycle++;
+                actions = dotActions[currentLineType][currentScanlineCycle];
             }
         }
     }
-}
-
-void NESDL_PPU::HandleProcessVisibleScanline()
-{
-    if (currentScanline == 0 && currentScanlineCycle == 0)
+    
+    if (actions & PPUDOT_FRAME_READY)
     {
-        if (currentFrame > 0)
+        // Signal to core that we've finished drawing to our frame data
+        frameDataReady = true;
+    }
+    
+    if (actions & PPUDOT_VBLANK_SET)
+    {
+        // Set VBLANK FLAG at this exact moment (241, 1)
+        if (!disregardVBL)
         {
-            frameFinished = true;
+            registers.status |= PPUSTATUS_VBLANK;
         }
-        
-        // Clear frameDataSprite table for next frame
-        memset(frameDataSprite, 0x3F, sizeof(frameDataSprite));
-        
-        if ((registers.mask & PPUMASK_BGENABLE) != 0x00)
+        if (specialNMI || (!disregardNMI && (registers.ctrl & PPUCTRL_NMIENABLE) != 0x00))
         {
-            // THE ONLY TIME we advance the cycle count artificially - this cycle is skipped
-            // when the frame count is odd (counting by 0)
-            if (currentFrame % 2 == 0)
-            {
-                elapsedCycles++;
-                currentScanlineCycle = elapsedCycles % 341;
-            }
+            specialNMI = false;
+            // Also triggers an NMI (VBlank NMI)
+            core->cpu->nmi = true;
+            nmiFiredAt = elapsedCycles;
         }
+        disregardVBL = false;
+        disregardNMI = false;
+    }
+    
+    if (actions & PPUDOT_FLAGS_CLEAR)
+    {
+        // Pre-render scanline - clear ALL status flags
+        registers.status &= 0x1F;
     }
     
     // TILE LOGIC - don't run if BG rendering is disabled
-    if ((registers.mask & PPUMASK_BGENABLE) != 0x00)
+    if (bgEnabled)
     {
         // Every 8 pixels (skipping px 0) we repeat the same process for tiles
-        uint8_t pixelInFetchCycle = currentScanlineCycle % 8;
+        uint8_t pixelInFetchCycle = currentScanlineCycle & 0x7;
         
-        if (currentScanlineCycle > 0 && currentScanlineCycle < 256)
+        if (actions & PPUDOT_BG_FETCH)
         {
             FetchAndStoreTile(pixelInFetchCycle); // Runs across multiple cycles in order to achieve this
+        }
+        
+        // On the last cycle, render the tile sitting in the shift register and store the loaded tile data in
+        if (actions & PPUDOT_BG_DRAW) // Cycle 7-8 - Fetch pattern table high bytes (finishes on next cycle 0)
+        {
+            // Grab the tile to be rendered (from tileBuffer) and render it, advancing our
+            // currentDrawX index
+            PPUTileFetch toRender = tileBuffer[1];
+            tileBuffer[1] = tileBuffer[0];
+            tileBuffer[0] = tileFetch;
+            
+            uint8_t start = 0;
+            uint8_t end = 8;
             
-            // On the last cycle, render the tile sitting in the shift register and store the loaded tile data in
-            if (pixelInFetchCycle == 7) // Cycle 7-8 - Fetch pattern table high bytes (finishes on next cycle 0)
+            uint8_t tileIndex = currentScanlineCycle >> 3;
+            if (tileIndex == 0)
             {
-                // Grab the tile to be rendered (from tileBuffer) and render it, advancing our
-                // currentDrawX index
-                PPUTileFetch toRender = tileBuffer[1];
-                tileBuffer[1] = tileBuffer[0];
-                tileBuffer[0] = tileFetch;
-                
-                uint8_t start = 0;
-                uint8_t end = 8;
-                
-                uint8_t tileIndex = (currentScanlineCycle - 7) / 8;
-                if (tileIndex == 0)
-                {
-                    start = (registers.x & 0x7);
-                }
-                
-                for (int i = start; i < end; ++i)
-                {
-                    uint16_t currentPixel = (currentScanline * NESDL_SCREEN_WIDTH) + currentDrawX;
-                    // Don't render if we wrote a sprite pixel here, unless the BG tile has priority
-                    uint8_t patternBits = GetPatternBits(toRender.pattern, i);
-                    bool bgPriority = (frameDataSprite[currentPixel] & 0x80) != 0x00;
-                    bool bgOverSprite = bgPriority && patternBits != 0x00;
-                    bool sprDrawn = (frameDataSprite[currentPixel] & 0x40) != 0x00;
-                    if (bgOverSprite || !sprDrawn)
-                    {
-                        uint32_t palette = GetPalette(toRender.paletteIndex, false);
-                        uint32_t color = GetColor(toRender.pattern, palette, i);
-                        if (currentDrawX < 8 && !(registers.mask & PPUMASK_BG_LCOL_ENABLE))
-                        {
-                            color = GetColor(0, palette, 0);
-                        }
-                        // Tile debugging lines
-//                        if (currentScanline % 8 == 0 || currentDrawX % 8 == 0)
-//                        {
-//                            color += 0x00202020;
-//                        }
-                        frameData[currentPixel] = color;
-                        if (patternBits != 0x00)
-                        {
-                            frameDataSprite[currentPixel] = 0x80 | (frameDataSprite[currentPixel] & 0x7F);
-                        }
-                    }
-                    currentDrawX++;
-                }
-                
-                // Coarse X increment (wraps horizontal scroll, technically runs 1 cycle sooner?)
-                // https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
-                if ((registers.v & 0x001F) == 31)   // if coarse X == 31
-                {
-                    registers.v &= ~0x001F;         // coarse X = 0
-                    registers.v ^= 0x0400;          // switch horizontal nametable
-                }
-                else
-                {
-                    registers.v += 1;               // increment coarse X
-                }
-                
-                // Not sure how else to pull this off? We want to render the last tile at 0x#400/0x#C00
-                if (tileIndex == 31 && (registers.x & 0x7) != 0x00)
-                {
-                    FetchAndStoreTile(1);
-                    FetchAndStoreTile(3);
-                    FetchAndStoreTile(5);
-                    
-                    toRender = tileBuffer[1];
-                    
-                    uint8_t i = 0;
-                    while (currentDrawX < 256)
-                    {
-                        uint16_t currentPixel = (currentScanline * NESDL_SCREEN_WIDTH) + currentDrawX;
-
-                        // Don't render if we wrote a sprite pixel here, unless the BG tile has priority
-                        uint8_t patternBits = GetPatternBits(toRender.pattern, i);
-                        bool bgPriority = (frameDataSprite[currentPixel] & 0x80) != 0x00;
-                        bool bgOverSprite = bgPriority && patternBits != 0x00;
-                        bool sprDrawn = (frameDataSprite[currentPixel] & 0x40) != 0x00;
-                        if (bgOverSprite || !sprDrawn)
-                        {
-                            uint32_t palette = GetPalette(toRender.paletteIndex, false);
-                            uint32_t color = GetColor(toRender.pattern, palette, i);
-                            if (currentDrawX < 8 && !(registers.mask & PPUMASK_BG_LCOL_ENABLE))
-                            {
-                                color = GetColor(0, palette, 0);
-                            }
-                            frameData[currentPixel] = color;
-                            if (patternBits != 0x00)
-                            {
-                                frameDataSprite[currentPixel] = 0x80 | (frameDataSprite[currentPixel] & 0x7F);
-                            }
-                        }
-                        currentDrawX++;
-                        i++;
-                    }
-                }
+                start = (registers.x & 0x7);
             }
-        }
-        else if (currentScanlineCycle == 256)
-        {
-            // Coarse Y increment
-            if ((registers.v & 0x7000) != 0x7000)       // if fine Y < 7
+            
+            for (int i = start; i < end; ++i)
             {
-                registers.v += 0x1000;                  // increment fine Y
+                WriteBGPixel(toRender, i);
             }
-            else
+            
+            IncrementCoarseX();
+            
+            // Not sure how else to pull this off? We want to render the last tile at 0x#400/0x#C00
+            if (tileIndex == 31 && (registers.x & 0x7) != 0x00)
             {
-                registers.v &= ~0x7000;                 // fine Y = 0
-                int y = (registers.v & 0x03E0) >> 5;    // let y = coarse Y
-                if (y == 29)
-                {
-                    y = 0;                              // coarse Y = 0
-                    registers.v ^= 0x0800;              // switch vertical nametable
-                }
-                else if (y == 31)
-                {
-                    y = 0;                              // coarse Y = 0, nametable not switched
-                }
-                else
+                FetchAndStoreTile(1);
+                FetchAndStoreTile(3);
+                FetchAndStoreTile(5);
+                
+                toRender = tileBuffer[1];
+                
+                uint8_t i = 0;
+                while (currentDrawX < 256)
                 {
-                    y += 1;                             // increment coarse Y
+                    WriteBGPixel(toRender, i++);
                 }
-                registers.v = (registers.v & ~0x03E0) | (y << 5); // put coarse Y back into v
             }
+            
+            // Composite any finished runs of pixels with this line's sprites
+            CompositeLine(currentDrawX);
         }
-        else if (currentScanlineCycle == 257)
+        
+        if (actions & PPUDOT_BG_RELOAD)
+        {
+            // Run tile fetch for the next two tiles
+            tileBuffer[1] = tileBuffer[0];
+            tileBuffer[0] = tileFetch;
+            IncrementCoarseX();
+        }
+        
+        if (actions & PPUDOT_INC_Y)
+        {
+            IncrementFineY();
+        }
+        
+        if (actions & PPUDOT_RESET_X)
         {
             // Reset horizontal scroll
             registers.v = (registers.v & 0xFBE0) | (registers.t & 0x41F);
             currentDrawX = 0;
         }
-        else if (currentScanlineCycle < 321)
+        
+        if (actions & PPUDOT_NT_DUMMY)
         {
-            // "Tile data for the sprites on the next scanline are fetched here"
+            // Two NT bytes are fetched, replicated for mapper timing purposes (eg. MMC2, MMC5)
+            FetchAndStoreTile(1);
         }
-        else if (currentScanlineCycle < 337)
+    }
+    else if (actions & PPUDOT_BG_PIXEL)
+    {
+        // BG rendering is disabled = we should be rendering backdrop instead
+        bgLine.color[currentScanlineCycle] = GetColor(0, GetPalette(0, false), 0);
+        bgLine.opaque[currentScanlineCycle] = 0x00;
+        CompositeLine(currentScanlineCycle + 1);
+    }
+    
+    if (actions & (PPUDOT_PRERENDER_RESET_X | PPUDOT_RESET_Y))
+    {
+        bool isRenderingEnabled = bgEnabled || sprEnabled;
+        if (actions & PPUDOT_PRERENDER_RESET_X)
         {
-            // Run tile fetch for the next two tiles
-            FetchAndStoreTile(pixelInFetchCycle);
-            
-            if (pixelInFetchCycle == 7)
+            // Reset horizontal scroll
+            if (isRenderingEnabled)
             {
-//                PPUTileFetch toRender = tileBuffer[1];
-                tileBuffer[1] = tileBuffer[0];
-                tileBuffer[0] = tileFetch;
-                if ((registers.v & 0x001F) == 31)   // if coarse X == 31
-                {
-                    registers.v &= ~0x001F;         // coarse X = 0
-                    registers.v ^= 0x0400;          // switch horizontal nametable
-                }
-                else
-                {
-                    registers.v += 1;               // increment coarse X
-                }
+                registers.v = (registers.v & 0xFBE0) | (registers.t & 0x41F);
             }
+            currentDrawX = 0;
         }
-        else if (currentScanlineCycle < 341)
+        // Special case for pre-render scanline: reset vertical scroll (repeatedly)
+        if ((actions & PPUDOT_RESET_Y) && isRenderingEnabled)
         {
-            // Two NT bytes are fetched, replicated for mapper timing purposes (eg. MMC2, MMC5)
-            if (currentScanlineCycle % 2 == 1)
-            {
-                FetchAndStoreTile(1);
-            }
+            registers.v = (registers.v & 0x041F) | (registers.t & 0xFBE0);
         }
     }
-    else
+    
+    // Make sure the whole line made it out, even if BG rendering was toggled mid-line
+    if (actions & PPUDOT_COMPOSITE)
     {
-        // BG rendering is disabled = we should be rendering backdrop instead
-        uint16_t currentPixel = (currentScanline * NESDL_SCREEN_WIDTH) + currentScanlineCycle;
-        frameData[currentPixel] = NESDL_PALETTE[paletteData[0]];
+        CompositeLine(NESDL_SCREEN_WIDTH);
+    }
+    
+    // Next line's sprites get rendered straight into the sprite line buffer as they're fetched.
+    // This line is fully composited by now, so the buffer is free to reuse
+    if (actions & PPUDOT_SPR_LINE_CLEAR)
+    {
+        memset(sprLine.opaque, 0x00, sizeof(sprLine.opaque));
+        memset(sprLine.spriteZero, 0x00, sizeof(sprLine.spriteZero));
     }
     
-    // SPRITE LOGIC - don't run if sprite rendering is disabled (or we're on line 0, we don't run)
-    if ((registers.mask & PPUMASK_SPRENABLE) != 0x00)
+    // SPRITE LOGIC - don't run if sprite rendering is disabled
+    if (sprEnabled)
     {
-        // Draw this line's sprite data
-        if (currentScanlineCycle < 256 && currentScanline > 0)
+        // Secondary OAM is cleared to 0xFF over 64 cycles, but we can get away with just doing it all at once
+        if (actions & PPUDOT_SPR_CLEAR)
         {
-            for (int i = 0; i < sprDataToDrawCount; ++i)
-            {
-                PPUSprFetch sprData = sprDataToDraw[i];
-                
-                // Exit early - we're not rendering (yet)
-                if (currentScanlineCycle < sprData.startX || currentScanlineCycle >= sprData.startX + 8)
-                {
-                    continue;
-                }
-                
-                uint16_t currentPixel = (currentScanline * NESDL_SCREEN_WIDTH) + currentScanlineCycle;
-                uint8_t index = (currentScanlineCycle - sprData.startX) % 8;
-                
-                // We're going out of bounds on screen - don't continue rendering
-                if (currentPixel >= (NESDL_SCREEN_WIDTH * NESDL_SCREEN_HEIGHT))
-                {
-                    continue;
-                }
+            memset(secondaryOAM, 0xFF, sizeof(secondaryOAM));
+            // Reset counters and flags before sprite evaluation
+            secondaryOAMNextSlot = 0;
+            sprFetchIndex = 0;
+            sprOverflowCycle = 0;
+            registers.status &= ~PPUSTATUS_SPROVERFLOW;
+        }
+        
+        if (actions & PPUDOT_SPR_EVAL)
+        {
+            // Evaluation normally walks OAM over cycles 64-255, but the result is the same if we
+            // do it all at once here. The only thing the CPU can see is the overflow flag, so
+            // just remember when it would have been set
+            EvaluateSprites();
+        }
+        
+        if ((actions & PPUDOT_SPR_OVERFLOW) && currentScanlineCycle == sprOverflowCycle)
+        {
+            registers.status |= PPUSTATUS_SPROVERFLOW;
+        }
+        
+        // Sprite fetching! First 4 cycles are for reading, last 4 are for writing
+        if (actions & PPUDOT_SPR_FETCH)
+        {
+            FetchNextSprite();
+        }
+    }
+}
 
-                // We only go further IFF the pixel to render isn't the backdrop index!
-                if (GetPatternBits(sprData.pattern, index) != 0x0)
-                {
-                    // Sprite 0 Hit
-                    bool leftSide = currentScanlineCycle < 8 && (registers.mask & (PPUMASK_BG_LCOL_ENABLE | PPUMASK_SPR_LCOL_ENABLE));
-                    bool lastRow = currentScanline == 255;
-                    bool spr0HitAlready = (registers.status & PPUSTATUS_SPR0HIT) != 0;
-                    // If this is sprite zero, we haven't hit sprite 0 this frame yet, then mark that we rendered it at least one pixel!
-                    if (sprData.oamIndex == 0 && !(leftSide || lastRow || spr0HitAlready))
-                    {
-                        registers.status |= PPUSTATUS_SPR0HIT;
-                    }
+void NESDL_PPU::IncrementCoarseX()
+{
+    // Coarse X increment (wraps horizontal scroll, technically runs 1 cycle sooner?)
+    // https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+    if ((registers.v & 0x001F) == 31)   // if coarse X == 31
+    {
+        registers.v &= ~0x001F;         // coarse X = 0
+        registers.v ^= 0x0400;          // switch horizontal nametable
+    }
+    else
+    {
+        registers.v += 1;               // increment coarse X
+    }
+}
 
-                    if (currentScanlineCycle < 8 && !(registers.mask & PPUMASK_SPR_LCOL_ENABLE))
-                    {
-                        continue;
-                    }
-                    
-                    // We only keep going if this sprite has a lower OAM index than any written before it here
-                    // (AKA this sprite has priority)
-                    uint8_t pixelOAM = frameDataSprite[currentPixel] & 0x3F;
-                    if (sprData.oamIndex > pixelOAM)
-                    {
-                        continue;
-                    }
-                    
-                    // This sprite pixel is significant - mark the OAM index, regardless of if we've written to it or not yet or BG tile priority (used for the "sprite priority quirk")
-                    frameDataSprite[currentPixel] = (frameDataSprite[currentPixel] & 0xC0) | (sprData.oamIndex & 0x3F);
-                    
-                    if (sprData.bgPriority)
-                    {
-                        // Skip if we also drew a tile on this cycle, before we set the priority data,
-                        // but we know the tile sprite wasn't backdrop (aka the tile takes priority)
-                        if ((frameDataSprite[currentPixel] & 0x80) > 0)
-                        {
-                            continue;
-                        }
-                        
-                        frameDataSprite[currentPixel] = 0x80 | (frameDataSprite[currentPixel] & 0x7F);
-                    }
-                    
-                    // We finally get to draw the pixel!
-                    
-                    // Write a bit signifying that we wrote a SPR pixel here
-                    frameDataSprite[currentPixel] = 0x40 | (frameDataSprite[currentPixel] & 0xBF);
-                    
-                    uint32_t palette = GetPalette(sprData.paletteIndex, true);
-                    uint32_t color = GetColor(sprData.pattern, palette, index);
-                    frameData[currentPixel] = color;
-                }
-            }
+void NESDL_PPU::IncrementFineY()
+{
+    // Coarse Y increment
+    if ((registers.v & 0x7000) != 0x7000)       // if fine Y < 7
+    {
+        registers.v += 0x1000;                  // increment fine Y
+    }
+    else
+    {
+        registers.v &= ~0x7000;                 // fine Y = 0
+        int y = (registers.v & 0x03E0) >> 5;    // let y = coarse Y
+        if (y == 29)
+        {
+            y = 0;                              // coarse Y = 0
+            registers.v ^= 0x0800;              // switch vertical nametable
         }
-        
-        // Secondary OAM is cleared to 0xFF over 64 cycles, but we can get away with just doing it all at once
-        if (currentScanlineCycle < 64)
+        else if (y == 31)
         {
-            if (currentScanlineCycle == 63)
-            {
-                memset(secondaryOAM, 0xFF, sizeof(secondaryOAM));
-                // Reset counters and flags before sprite evaluation
-                oamN = 0;
-                oamM = 0;
-                secondaryOAMNextSlot = 0;
-                sprFetchIndex = 0;
-                registers.status &= ~PPUSTATUS_SPROVERFLOW;
-            }
+            y = 0;                              // coarse Y = 0, nametable not switched
         }
-        else if (currentScanlineCycle < 256)
+        else
         {
-            // Fetch next line's sprite data
-            if (currentScanlineCycle % 2 == 0)
-            {
-                // Odd cycle - read from OAM
-                if (secondaryOAMNextSlot < 8)
-                {
-                    secondaryOAM[secondaryOAMNextSlot*5] = oam[oamN*4 + oamM];
-                }
-            }
-            else
-            {
-                // Even cycle - write to secondary OAM (if not full yet, otherwise flag overflow)
-                if (secondaryOAMNextSlot != 8 && oamN < 64)
-                {
-                    // Check the sprite Y we evaluated last. If the sprite falls on this scanline,
-                    // then it's "in range" and we fill secondary OAM with its info before moving on
-                    // to the next slot
-                    uint8_t sprY = secondaryOAM[secondaryOAMNextSlot*5];
-                    uint8_t sprHeight = (registers.ctrl & PPUCTRL_SPRHEIGHT) != 0x00 ? 16 : 8;
-                    if (currentScanline >= sprY && currentScanline < sprY + sprHeight)
-                    {
-                        // Sprite in range - copy the rest of the data to secondary OAM
-                        for (int i = 1; i < 4; ++i)
-                        {
-                            secondaryOAM[secondaryOAMNextSlot*5 + i] = oam[oamN*4 + (++oamM)];
-                            if (oamM == 3)
-                            {
-                                secondaryOAM[secondaryOAMNextSlot*5 + 4] = oamN;
-                                oamM = 0;
-                                oamN++;
-                            }
-                        }
-                        if (++secondaryOAMNextSlot == 8)
-                        {
-                            registers.status |= PPUSTATUS_SPROVERFLOW;
-                        }
-                    }
-                    else
-                    {
-                        // Sprite NOT in range - just increment N
-                        oamN++;
-                    }
-                }
-                else
-                {
-                    oamN++;
-                }
-            }
+            y += 1;                             // increment coarse Y
         }
-        else if (currentScanlineCycle < 320)
+        registers.v = (registers.v & ~0x03E0) | (y << 5); // put coarse Y back into v
+    }
+}
+
+void NESDL_PPU::FetchNextSprite()
+{
+    // The hardware doesn't technically "render" during this time, we just got next scanline's
+    // sprite data ready to go. But we're an emulator, and the wiki isn't clear to me on what
+    // the PPU is doing with these read cycles, so... let's just render!
+    if (sprFetchIndex >= secondaryOAMNextSlot)
+    {
+        return;
+    }
+    
+    // Get sprite info
+    uint8_t sprY        = secondaryOAM[sprFetchIndex*5];
+    uint8_t sprTile     = secondaryOAM[sprFetchIndex*5 + 1];
+    uint8_t sprAttr     = secondaryOAM[sprFetchIndex*5 + 2];
+    uint8_t sprX        = secondaryOAM[sprFetchIndex*5 + 3];
+    uint8_t sprOAMIndex = secondaryOAM[sprFetchIndex*5 + 4];
+    
+    // Get sprite attributes
+    uint8_t sprPaletteIndex = sprAttr & SPR_PALETTE;
+    bool sprTilePriority    = (sprAttr & SPR_PRIORITY) != 0x00;
+    bool sprFlipHorizontal  = (sprAttr & SPR_FLIPX) != 0x00;
+    bool sprFlipVertical    = (sprAttr & SPR_FLIPY) != 0x00;
+    bool sprIs8By16 = (registers.ctrl & PPUCTRL_SPRHEIGHT) != 0x00;
+    
+    // Find out where we'll be starting to render on this line
+    uint16_t sprRow = (currentScanline - sprY) & (sprIs8By16 ? 15 : 7);
+    
+    // Flip tile read if the sprite's vertical flip bit is set
+    if (sprFlipVertical)
+    {
+        sprRow = (sprIs8By16 ? 15 : 7) - sprRow;
+    }
+    
+    // Get pattern for this sprite, decode to a version that can be palettized
+    uint16_t patternAddr = 0;
+    if (sprIs8By16)
+    {
+        // 8x16 sprite works a bit differently - bit 0 selects nametable, the rest
+        // selects the top tile (bottom sprite tile is the next one over)
+        patternAddr = (sprTile & 0x1) * 0x100;
+        // We should be selecting the second (bottom) tile instead
+        if (sprRow >= 8)
         {
-            if (currentScanlineCycle == 257)
-            {
-                sprDataToDrawCount = 0;
-            }
-            // Sprite fetching! First 4 cycles are for reading, last 4 are for writing
-            uint8_t pixelInFetchCycle = currentScanlineCycle % 8;
-            
-            if (pixelInFetchCycle == 4)
-            {
-                // The hardware doesn't technically "render" during this time, we just got next scanline's
-                // sprite data ready to go. But we're an emulator, and the wiki isn't clear to me on what
-                // the PPU is doing with these read cycles, so... let's just render!
-                if (sprFetchIndex < secondaryOAMNextSlot)
-                {
-                    // Get sprite info
-                    uint8_t sprY        = secondaryOAM[sprFetchIndex*5];
-                    uint8_t sprTile     = secondaryOAM[sprFetchIndex*5 + 1];
-                    uint8_t sprAttr     = secondaryOAM[sprFetchIndex*5 + 2];
-                    uint8_t sprX        = secondaryOAM[sprFetchIndex*5 + 3];
-                    uint8_t sprOAMIndex = secondaryOAM[sprFetchIndex*5 + 4];
-                    
-                    // Get sprite attributes
-                    uint8_t sprPaletteIndex = sprAttr & SPR_PALETTE;
-                    bool sprTilePriority    = (sprAttr & SPR_PRIORITY) != 0x00;
-                    bool sprFlipHorizontal  = (sprAttr & SPR_FLIPX) != 0x00;
-                    bool sprFlipVertical    = (sprAttr & SPR_FLIPY) != 0x00;
-                    bool sprIs8By16 = (registers.ctrl & PPUCTRL_SPRHEIGHT) != 0x00;
-                    
-                    // Find out where we'll be starting to render on this line
-                    uint16_t sprRow = (currentScanline - sprY) % (sprIs8By16 ? 16 : 8);
-                    
-                    // Flip tile read if the sprite's vertical flip bit is set
-                    if (sprFlipVertical)
-                    {
-                        sprRow = (sprIs8By16 ? 15 : 7) - sprRow;
-                    }
-                    
-                    // Get pattern for this sprite, decode to a version that can be palettized
-                    uint16_t patternAddr = 0;
-                    if (sprIs8By16)
-                    {
-                        // 8x16 sprite works a bit differently - bit 0 selects nametable, the rest
-                        // selects the top tile (bottom sprite tile is the next one over)
-                        patternAddr = (sprTile & 0x1) * 0x100;
-                        // We should be selecting the second (bottom) tile instead
-                        if (sprRow >= 8)
-                        {
-                            patternAddr += 1;
-                            sprRow -= 8;
-                        }
-                        patternAddr = ((patternAddr + (sprTile & 0xFE)) << 4) + sprRow;
-                    }
-                    else
-                    {
-                        // 8x8 sprite
-                        patternAddr = ((registers.ctrl & PPUCTRL_SPRTILE) >> 3) * 0x100;
-                        patternAddr = ((patternAddr + sprTile) << 4) + sprRow;
-                    }
-                    uint8_t ptrnLow = ReadFromVRAM(patternAddr);
-                    uint8_t ptrnHi = ReadFromVRAM(patternAddr + 8);
-                    uint16_t sprPattern = WeavePatternBits(ptrnLow, ptrnHi, sprFlipHorizontal);
-                    
-                    sprDataToDraw[sprDataToDrawCount].oamIndex = sprOAMIndex;
-                    sprDataToDraw[sprDataToDrawCount].pattern = sprPattern;
-                    sprDataToDraw[sprDataToDrawCount].startX = sprX;
-                    sprDataToDraw[sprDataToDrawCount].paletteIndex = sprPaletteIndex;
-                    sprDataToDraw[sprDataToDrawCount].bgPriority = sprTilePriority;
-                    sprDataToDrawCount++;
-                    
-                    // Advance sprite fetch index since we successfully drew this one
-                    sprFetchIndex++;
-                }
-            }
+            patternAddr += 1;
+            sprRow -= 8;
         }
-        // The rest of the cycles are unused by the sprite evaluation/rendering loop
+        patternAddr = ((patternAddr + (sprTile & 0xFE)) << 4) + sprRow;
+    }
+    else
+    {
+        // 8x8 sprite
+        patternAddr = ((registers.ctrl & PPUCTRL_SPRTILE) >> 3) * 0x100;
+        patternAddr = ((patternAddr + sprTile) << 4) + sprRow;
     }
+    uint8_t ptrnLow = ReadFromVRAM(patternAddr);
+    uint8_t ptrnHi = ReadFromVRAM(patternAddr + 8);
+    uint16_t sprPattern = WeavePatternBits(ptrnLow, ptrnHi, sprFlipHorizontal);
+    
+    PPUSprFetch sprData;
+    sprData.oamIndex = sprOAMIndex;
+    sprData.pattern = sprPattern;
+    sprData.startX = sprX;
+    sprData.paletteIndex = sprPaletteIndex;
+    sprData.bgPriority = sprTilePriority;
+    RenderSprite(sprData);
+    
+    // Advance sprite fetch index since we successfully drew this one
+    sprFetchIndex++;
 }
 
 void NESDL_PPU::FetchAndStoreTile(uint8_t pixelInFetchCycle)
@@ -632,111 +660,6 @@ void NESDL_PPU::FetchAndStoreTile(uint8_t pixelInFetchCycle)
     }
 }
 
-void NESDL_PPU::HandleProcessVBlankScanline()
-{
-    // Every 8 pixels (skipping px 0) we repeat the same process for tiles
-    uint8_t pixelInFetchCycle = currentScanlineCycle % 8;
-    
-    if (currentScanline == 241)
-    {
-        // Set VBLANK FLAG at this exact moment (241, 1)
-        if (currentScanlineCycle == 1)
-        {
-            if (!disregardVBL)
-            {
-                registers.status |= PPUSTATUS_VBLANK;
-            }
-            if (specialNMI || (!disregardNMI && (registers.ctrl & PPUCTRL_NMIENABLE) != 0x00))
-            {
-                specialNMI = false;
-                // Also triggers an NMI (VBlank NMI)
-                core->cpu->nmi = true;
-				nmiFiredAt = elapsedCycles;
-            }
-            disregardVBL = false;
-            disregardNMI = false;
-        }
-    }
-    else if (currentScanline == 261)
-    {
-        // Pre-render scanline
-        bool isRenderingEnabled = (registers.mask & PPUMASK_BGENABLE) != 0x00 || (registers.mask & PPUMASK_SPRENABLE) != 0x00;
-        
-        // Clear ALL status flags
-        if (currentScanlineCycle == 1)
-        {
-            registers.status &= 0x1F;
-        }
-        
-        if (currentScanlineCycle > 0 && currentScanlineCycle < 256)
-        {
-            // Don't run logic if BG rendering is disabled
-            if ((registers.mask & PPUMASK_BGENABLE) == 0x00)
-            {
-                return;
-            }
-            
-            FetchAndStoreTile(pixelInFetchCycle); // Runs across multiple cycles in order to achieve this
-        }
-        else if (currentScanlineCycle == 256)
-        {
-        }
-        else if (currentScanlineCycle == 257)
-        {
-            // Reset horizontal scroll
-            if (isRenderingEnabled)
-            {
-                registers.v = (registers.v & 0xFBE0) | (registers.t & 0x41F);
-            }
-            currentDrawX = 0;
-        }
-        else if (currentScanlineCycle < 321)
-        {
-            if (isRenderingEnabled)
-            {
-                // Special case for pre-render scanline: reset vertical scroll (repeatedly)
-                if (currentScanlineCycle >= 280 && currentScanlineCycle <= 304)
-                {
-                    registers.v = (registers.v & 0x041F) | (registers.t & 0xFBE0);
-                }
-            }
-        }
-        else if (currentScanlineCycle < 337)
-        {
-            // Tile data for the sprites on the next scanline begin fetching here
-            // (Important to do so we're not offset by 2 tiles on the first line)
-
-            if ((registers.mask & PPUMASK_BGENABLE) != 0x00)
-            {
-                FetchAndStoreTile(pixelInFetchCycle);
-
-                // On the last tile fetch cycle, store the loaded tile data and increment V register
-                if (pixelInFetchCycle == 7)
-                {
-                    tileBuffer[1] = tileBuffer[0];
-                    tileBuffer[0] = tileFetch;
-
-                    // Coarse X increment (wraps horizontal scroll, technically runs 1 cycle sooner?)
-                    // https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
-                    if ((registers.v & 0x001F) == 31)   // if coarse X == 31
-                    {
-                        registers.v &= ~0x001F;         // coarse X = 0
-                        registers.v ^= 0x0400;          // switch horizontal nametable
-                    }
-                    else
-                    {
-                        registers.v += 1;               // increment coarse X
-                    }
-                }
-            }
-        }
-        else if (currentScanlineCycle < 341)
-        {
-            // Two NT bytes are fetched but is really not necessary (except for MMC5, we can write a special case in for that)
-        }
-    }
-}
-
 void NESDL_PPU::PreprocessPPUForReadInstructionTiming(uint8_t instructionPPUTime)
 {
     // We mostly care about cycles after instruction because the effective read
@@ -871,7 +794,17 @@ void NESDL_PPU::WriteToRegister(uint16_t registerAddr, uint8_t data)
                 }
                 disregardNMI = false;
             }
+            // MMC3's IRQ counter is clocked off the pattern table addresses, so it has to catch up
+            // under the old ones and then predict again under the new
+            if (mapper->mapperNumber == 4)
+            {
+                ((NESDL_Mapper_4*)mapper)->SyncIRQ();
+            }
             registers.ctrl = data;
+            if (mapper->mapperNumber == 4)
+            {
+                ((NESDL_Mapper_4*)mapper)->ScheduleIRQ();
+            }
             // Write nametable bits to register t
             registers.t = (registers.t & 0xF3FF) | ((uint16_t(data) & 0x3) << 10);
             break;
@@ -968,11 +901,21 @@ void NESDL_PPU::WriteToRegister(uint16_t registerAddr, uint8_t data)
             // Since we're an emulator and the STA/X instruction is still running, if we alter
             // the CPU's elapsed cycle count now it will effectively halt the very next instruction
             core->cpu->dma = true;
-            // Transfer data from 0x##00 - 0x##FF
-            uint16_t targetAddr = data << 8;
-            for (int i = 0; i < 256; ++i)
+            // Transfer data from 0x##00 - 0x##FF. RAM and ROM/PRG-RAM pages are copied straight across,
+            // anything else (registers, open bus) is read byte by byte in case reading has side effects.
+            // Either way the CPU stall is the same (see HaltCPUForDMAWrite)
+            const uint8_t* page = core->ram->GetDMAPage(data);
+            if (page != nullptr)
             {
-                oam[i] = core->ram->ReadByte(targetAddr + i);
+                memcpy(oam, page, 256);
+            }
+            else
+            {
+                uint16_t targetAddr = data << 8;
+                for (int i = 0; i < 256; ++i)
+                {
+                    oam[i] = core->ram->ReadByte(targetAddr + i);
+                }
             }
             break;
     }
@@ -1173,10 +1116,13 @@ uint16_t NESDL_PPU::GetMirroredAddress(uint16_t addr)
             }
             break;
         case MirroringMode::One_LowerBank:
-        case MirroringMode::One_UpperBank:
-            // Both versions map to NT 0
+            // Every NT maps to physical NT 0
             addr = 0x2000 | (addr % 0x400);
             break;
+        case MirroringMode::One_UpperBank:
+            // Every NT maps to physical NT 1
+            addr = 0x2400 | (addr % 0x400);
+            break;
         case MirroringMode::Four:
             // 4-way means NO mirroring!
             break;
@@ -1214,23 +1160,20 @@ uint32_t NESDL_PPU::GetPalette(uint8_t index, bool spriteLayer)
     return paletteData[spriteLayer ? 0x10 : 0] << 24 | paletteData[i+1] << 16 | paletteData[i+2] << 8 | paletteData[i+3];
 }
 
-uint32_t NESDL_PPU::GetColor(uint16_t pattern, uint32_t palette, uint8_t pixelIndex)
+uint8_t NESDL_PPU::GetColor(uint16_t pattern, uint32_t palette, uint8_t pixelIndex)
 {
     // Use pixel index to select 2 bits of pattern - 0 selects 2 highest, 7 selects 2 lowest
     uint8_t patternBits = GetPatternBits(pattern, pixelIndex);
     // Take this 0-3 index and select the palette byte
     uint32_t paletteShifted = palette >> (24 - patternBits*8);
-    uint8_t paletteIndex = paletteShifted & 0xFF;
+    uint8_t paletteIndex = paletteShifted & 0x3F;
     if ((registers.mask & PPUMASK_GREYSCALE) != 0x00) // Only select from four greyscale palette values
     {
         paletteIndex &= 0x30;
     }
-    // Get color from palette index!
-    uint32_t resultColor = NESDL_PALETTE[paletteIndex];
-    // TODO implement tinting via PPUMASK. I'm not keen on perfectly recreating
-    // tinting via accurate video signal manipulation, a fast approx will do
-    
-    return resultColor;
+    // We only store the palette index - SDL turns it into an actual color (with
+    // the scanline's emphasis/tint applied) once per displayed frame
+    return paletteIndex;
 }
 
 uint8_t NESDL_PPU::GetPatternBits(uint16_t pattern, uint8_t pixelIndex)
@@ -1238,3 +1181,130 @@ uint8_t NESDL_PPU::GetPatternBits(uint16_t pattern, uint8_t pixelIndex)
     uint8_t index = ((7 - pixelIndex) * 2);
     return (pattern & (0x3 << index)) >> index;
 }
+
+void NESDL_PPU::WriteBGPixel(const PPUTileFetch& tile, uint8_t pixelIndex)
+{
+    if (currentDrawX < NESDL_SCREEN_WIDTH)
+    {
+        // Transparent pixels resolve to the backdrop color (palette byte 0)
+        uint32_t palette = GetPalette(tile.paletteIndex, false);
+        bgLine.color[currentDrawX] = GetColor(tile.pattern, palette, pixelIndex);
+        bgLine.opaque[currentDrawX] = GetPatternBits(tile.pattern, pixelIndex) != 0x00 ? 0xFF : 0x00;
+    }
+    currentDrawX++;
+}
+
+void NESDL_PPU::EvaluateSprites()
+{
+    uint8_t sprHeight = (registers.ctrl & PPUCTRL_SPRHEIGHT) != 0x00 ? 16 : 8;
+    for (int n = 0; n < 64; ++n)
+    {
+        // Every OAM entry costs a read + write cycle pair, in range or not
+        uint8_t sprY = oam[n*4];
+        if (currentScanline >= sprY && currentScanline < sprY + sprHeight)
+        {
+            // Sprite in range - copy its data to secondary OAM
+            memcpy(&secondaryOAM[secondaryOAMNextSlot*5], &oam[n*4], 4);
+            secondaryOAM[secondaryOAMNextSlot*5 + 4] = n;
+            if (++secondaryOAMNextSlot == 8)
+            {
+                // Filling the last slot flags overflow on that entry's write cycle
+                sprOverflowCycle = 65 + (n * 2);
+                break;
+            }
+        }
+    }
+}
+
+void NESDL_PPU::RenderSprite(const PPUSprFetch& sprData)
+{
+    // Sprites are fetched in OAM order, so the first opaque pixel written to an X position wins.
+    // This includes sprites behind the BG, which still hide any sprites after them
+    // (the "sprite priority quirk")
+    uint32_t palette = GetPalette(sprData.paletteIndex, true);
+    for (int p = 0; p < 8; ++p)
+    {
+        uint16_t x = sprData.startX + p;
+        if (x >= NESDL_SCREEN_WIDTH)
+        {
+            break;
+        }
+        if (sprLine.opaque[x] != 0x00 || GetPatternBits(sprData.pattern, p) == 0x00)
+        {
+            continue;
+        }
+        sprLine.color[x] = GetColor(sprData.pattern, palette, p);
+        sprLine.opaque[x] = 0xFF;
+        sprLine.priority[x] = sprData.bgPriority ? 0x00 : 0xFF;
+        sprLine.spriteZero[x] = sprData.oamIndex == 0 ? 0xFF : 0x00;
+    }
+}
+
+void NESDL_PPU::CompositeLine(uint16_t upToX)
+{
+    uint8_t* out = &frameData[currentScanline * NESDL_SCREEN_WIDTH];
+    
+    // Work in runs of 16 pixels, only once both layers are finished for that run
+    while (compositedX + 16 <= upToX && compositedX < NESDL_SCREEN_WIDTH)
+    {
+        uint16_t x = compositedX;
+        
+        // Left column clipping hides either layer's first 8 pixels
+        if (x == 0)
+        {
+            if ((registers.mask & PPUMASK_BG_LCOL_ENABLE) == 0x00)
+            {
+                uint8_t backdrop = GetColor(0, GetPalette(0, false), 0);
+                memset(bgLine.color, backdrop, 8);
+                memset(bgLine.opaque, 0x00, 8);
+            }
+            if ((registers.mask & PPUMASK_SPR_LCOL_ENABLE) == 0x00)
+            {
+                memset(sprLine.opaque, 0x00, 8);
+            }
+        }
+        
+        // A sprite pixel is shown if it's opaque and either in front of the BG or the BG
+        // is transparent. Sprite 0 hits anywhere its opaque pixels overlap opaque BG
+        uint16_t hitMask = 0;
+#ifdef NESDL_PPU_SSE2
+        __m128i bgColor = _mm_load_si128((const __m128i*)&bgLine.color[x]);
+        __m128i bgOpaque = _mm_load_si128((const __m128i*)&bgLine.opaque[x]);
+        __m128i sprColor = _mm_load_si128((const __m128i*)&sprLine.color[x]);
+        __m128i sprOpaque = _mm_load_si128((const __m128i*)&sprLine.opaque[x]);
+        __m128i sprFront = _mm_load_si128((const __m128i*)&sprLine.priority[x]);
+        __m128i sprZero = _mm_load_si128((const __m128i*)&sprLine.spriteZero[x]);
+        
+        __m128i bgCovers = _mm_andnot_si128(sprFront, bgOpaque);
+        __m128i useSpr = _mm_andnot_si128(bgCovers, sprOpaque);
+        __m128i color = _mm_or_si128(_mm_and_si128(useSpr, sprColor), _mm_andnot_si128(useSpr, bgColor));
+        _mm_storeu_si128((__m128i*)&out[x], color);
+        
+        __m128i hit = _mm_and_si128(_mm_and_si128(sprZero, sprOpaque), bgOpaque);
+        hitMask = (uint16_t)_mm_movemask_epi8(hit);
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            uint8_t bgCovers = bgLine.opaque[x + i] & ~sprLine.priority[x + i];
+            uint8_t useSpr = sprLine.opaque[x + i] & ~bgCovers;
+            out[x + i] = (sprLine.color[x + i] & useSpr) | (bgLine.color[x + i] & ~useSpr);
+            if (sprLine.spriteZero[x + i] & sprLine.opaque[x + i] & bgLine.opaque[x + i])
+            {
+                hitMask |= (1 << i);
+            }
+        }
+#endif
+        
+        // Sprite 0 never hits on the last pixel (x=255), or if either layer got disabled mid-line
+        if (x == NESDL_SCREEN_WIDTH - 16)
+        {
+            hitMask &= 0x7FFF;
+        }
+        if (hitMask != 0 && (registers.mask & (PPUMASK_BGENABLE | PPUMASK_SPRENABLE)) == (PPUMASK_BGENABLE | PPUMASK_SPRENABLE))
+        {
+            registers.status |= PPUSTATUS_SPR0HIT;
+        }
+        
+        compositedX += 16;
+    }
+}
@@ -0,0 +1,141 @@
+#include "NESDL.h"
+
+#ifdef NESDL_PROFILING
+
+uint64_t NESDL_Profiler::currentTicks[(int)NESDL_ProfileSection::COUNT];
+double NESDL_Profiler::history[NESDL_PROFILE_HISTORY][(int)NESDL_ProfileSection::COUNT];
+uint32_t NESDL_Profiler::historyIndex = 0;
+uint32_t NESDL_Profiler::historyCount = 0;
+
+void NESDL_Profiler::AddTime(NESDL_ProfileSection section, uint64_t ticks)
+{
+    currentTicks[(int)section] += ticks;
+}
+
+void NESDL_Profiler::EndFrame()
+{
+    // Bank this frame's totals into the history ring, then start over
+    double ticksToMS = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    for (int i = 0; i < (int)NESDL_ProfileSection::COUNT; ++i)
+    {
+        history[historyIndex][i] = currentTicks[i] * ticksToMS;
+        currentTicks[i] = 0;
+    }
+    historyIndex = (historyIndex + 1) % NESDL_PROFILE_HISTORY;
+    if (historyCount < NESDL_PROFILE_HISTORY)
+    {
+        historyCount++;
+    }
+}
+
+NESDL_ProfileStats NESDL_Profiler::GetStats(NESDL_ProfileSection section)
+{
+    NESDL_ProfileStats stats = {};
+    if (historyCount == 0)
+    {
+        return stats;
+    }
+    
+    double total = 0;
+    for (uint32_t i = 0; i < historyCount; ++i)
+    {
+        double ms = history[i][(int)section];
+        total += ms;
+        stats.maxMS = max(stats.maxMS, ms);
+        
+        // Bucket by power of 2 microseconds
+        uint32_t us = (uint32_t)(ms * 1000);
+        int bucket = 0;
+        while (us > 0 && bucket < NESDL_PROFILE_BUCKETS - 1)
+        {
+            us >>= 1;
+            bucket++;
+        }
+        stats.histogram[bucket]++;
+    }
+    stats.averageMS = total / historyCount;
+    return stats;
+}
+
+string NESDL_Profiler::GetOverlayText()
+{
+    // One line per section - average and worst frame over the history window
+    stringstream ss;
+    for (int i = 0; i < (int)NESDL_ProfileSection::COUNT; ++i)
+    {
+        NESDL_ProfileSection section = (NESDL_ProfileSection)i;
+        NESDL_ProfileStats stats = GetStats(section);
+        ss << string_format("\n%-8s %6.2fms (max %6.2f)", GetSectionName(section), stats.averageMS, stats.maxMS);
+    }
+    return ss.str();
+}
+
+bool NESDL_Profiler::WriteCSV(const char* path)
+{
+    ofstream file;
+    file.open(path, ofstream::out | ofstream::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    
+    // Per-frame rows (oldest first), all times in milliseconds
+    file << "frame";
+    for (int i = 0; i < (int)NESDL_ProfileSection::COUNT; ++i)
+    {
+        file << "," << GetSectionName((NESDL_ProfileSection)i);
+    }
+    file << "\n";
+    uint32_t first = historyCount < NESDL_PROFILE_HISTORY ? 0 : historyIndex;
+    for (uint32_t f = 0; f < historyCount; ++f)
+    {
+        double* row = history[(first + f) % NESDL_PROFILE_HISTORY];
+        file << f;
+        for (int i = 0; i < (int)NESDL_ProfileSection::COUNT; ++i)
+        {
+            file << "," << string_format("%.4f", row[i]);
+        }
+        file << "\n";
+    }
+    
+    // Histogram (frame counts per bucket) after a blank line
+    file << "\nbucket_us";
+    for (int i = 0; i < (int)NESDL_ProfileSection::COUNT; ++i)
+    {
+        file << "," << GetSectionName((NESDL_ProfileSection)i);
+    }
+    file << "\n";
+    NESDL_ProfileStats stats[(int)NESDL_ProfileSection::COUNT];
+    for (int i = 0; i < (int)NESDL_ProfileSection::COUNT; ++i)
+    {
+        stats[i] = GetStats((NESDL_ProfileSection)i);
+    }
+    for (int b = 0; b < NESDL_PROFILE_BUCKETS; ++b)
+    {
+        file << "<" << (1u << b);
+        for (int i = 0; i < (int)NESDL_ProfileSection::COUNT; ++i)
+        {
+            file << "," << stats[i].histogram[b];
+        }
+        file << "\n";
+    }
+    
+    file.close();
+    return true;
+}
+
+const char* NESDL_Profiler::GetSectionName(NESDL_ProfileSection section)
+{
+    switch (section)
+    {
+        case NESDL_ProfileSection::CPU:           return "CPU";
+        case NESDL_ProfileSection::PPU:           return "PPU";
+        case NESDL_ProfileSection::APU:           return "APU";
+        case NESDL_ProfileSection::Events:        return "Events";
+        case NESDL_ProfileSection::TextureUpload: return "Texture";
+        case NESDL_ProfileSection::Present:       return "Present";
+        default:                                  return "?";
+    }
+}
+
+#endif
@@ -6,6 +6,20 @@ void NESDL_RAM::Init(NESDL_Core* c)
     oops = false;
 }
 
+void NESDL_RAM::SaveState(NESDL_StateWriter& state)
+{
+    state.Write(ram, "ram");
+    state.Write(oops, "oops");
+}
+
+void NESDL_RAM::LoadState(NESDL_StateReader& state)
+{
+    state.Read(ram);
+    state.Read(oops);
+    // Code in RAM may well be different now
+    core->cpu->InvalidateAllDecodedCode();
+}
+
 uint8_t NESDL_RAM::ReadByte(uint16_t addr)
 {
     // Filter byte according to target
@@ -79,19 +93,23 @@ void NESDL_RAM::WriteByte(uint16_t addr, uint8_t data)
     if (addr < 0x2000)
     {
         ram[addr % 0x800] = data;
+        core->cpu->InvalidateDecodedCode(addr);
     }
     // 0x2000 - 0x3FFF, 0x4014 : 8 PPU + OAM registers (+ mirroring)
     else if (addr < 0x4000)
     {
+        core->flightRecorder->RecordWrite(FlightRecorderEvent::PPUWrite, core->cpu->elapsedCycles, 0x2000 + (addr % 8), data);
         core->ppu->WriteToRegister(0x2000 + (addr % 8), data);
     }
     else if (addr == 0x4014)
     {
+        core->flightRecorder->RecordWrite(FlightRecorderEvent::PPUWrite, core->cpu->elapsedCycles, addr, data);
         core->ppu->WriteToRegister(addr, data);
     }
     // 0x4000 - 0x4013, 0x4015 : APU registers
     else if (addr < 0x4016)
     {
+        core->flightRecorder->RecordWrite(FlightRecorderEvent::APUWrite, core->cpu->elapsedCycles, addr, data);
         core->apu->WriteByte(addr, data);
     }
     // 0x4016, 0x4017 : Joystick 1/2 input (fun fact: JOY2 WRITE is APU frame counter info! Weird huh
@@ -105,6 +123,7 @@ void NESDL_RAM::WriteByte(uint16_t addr, uint8_t data)
         else
         {
             // APU frame counter shenanigans
+            core->flightRecorder->RecordWrite(FlightRecorderEvent::APUWrite, core->cpu->elapsedCycles, addr, data);
             core->apu->WriteByte(addr, data);
         }
     }
@@ -116,11 +135,29 @@ void NESDL_RAM::WriteByte(uint16_t addr, uint8_t data)
     // Unmapped (cartridge ram, handled by mapper)
     else
     {
+        core->cpu->InvalidateDecodedCode(addr);
         mapper->WriteByte(addr, data);
     }
 }
 
+const uint8_t* NESDL_RAM::GetDMAPage(uint8_t page)
+{
+    // Internal RAM pages (0x00 - 0x1F) are 256 byte chunks of the 2KB, so mirroring never splits one
+    if (page < 0x20)
+    {
+        return ram + (page % 0x08) * 0x100;
+    }
+    // Cartridge space - let the mapper say if it's plain memory. Registers and open bus (0x20 - 0x5F)
+    // have to be read one byte at a time
+    if (page >= 0x60 && mapper != nullptr)
+    {
+        return mapper->GetPRGPage(page << 8);
+    }
+    return nullptr;
+}
+
 void NESDL_RAM::SetMapper(NESDL_Mapper* m)
 {
     mapper = m;
+    core->cpu->InvalidateAllDecodedCode();
 }
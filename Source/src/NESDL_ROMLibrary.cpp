@@ -0,0 +1,471 @@
+#include "NESDL.h"
+
+// Plain zlib-style CRC32 - passing a previous result back in as crc carries on where it left off
+static uint32_t UpdateCRC32(uint32_t crc, const uint8_t* data, size_t length)
+{
+    // Built the first time through (function-local statics are thread-safe to initialize)
+    static const array<uint32_t, 256> table = []()
+    {
+        array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void SHA1Block(uint32_t h[5], const uint8_t* block)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i)
+    {
+        uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+        w[i] = (x << 1) | (x >> 31);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = (b << 30) | (b >> 2);
+        b = a;
+        a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+// PRG and CHR are each one contiguous run of the mapped file, so there's no need for a streaming version
+static void SHA1(const uint8_t* data, size_t length, uint8_t out[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t fullBlocks = length / 64;
+    for (size_t i = 0; i < fullBlocks; ++i)
+    {
+        SHA1Block(h, data + i * 64);
+    }
+
+    // Whatever's left, then 0x80, zeroes and the length in bits - one block or two
+    uint8_t tail[128] = {};
+    size_t remaining = length % 64;
+    memcpy(tail, data + fullBlocks * 64, remaining);
+    tail[remaining] = 0x80;
+    size_t tailLength = remaining < 56 ? 64 : 128;
+    uint64_t bitLength = (uint64_t)length * 8;
+    for (int i = 0; i < 8; ++i)
+    {
+        tail[tailLength - 1 - i] = (uint8_t)(bitLength >> (i * 8));
+    }
+    for (size_t i = 0; i < tailLength; i += 64)
+    {
+        SHA1Block(h, tail + i);
+    }
+
+    for (int i = 0; i < 20; ++i)
+    {
+        out[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+    }
+}
+
+void NESDL_ROMLibrary::Init(NESDL_Core* c)
+{
+    core = c;
+    scanning = false;
+    ReadIndex();
+}
+
+void NESDL_ROMLibrary::Exit()
+{
+    if (scanThread.joinable())
+    {
+        scanThread.join();
+    }
+}
+
+bool NESDL_ROMLibrary::StartScan(const string& root)
+{
+    if (scanning)
+    {
+        return false;
+    }
+    // The last scan's thread is done by now, it just hasn't been joined
+    if (scanThread.joinable())
+    {
+        scanThread.join();
+    }
+    scanning = true;
+    scanThread = thread([this, root]()
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        size_t hashed = Scan(root);
+        long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        {
+            lock_guard<mutex> lock(reportMutex);
+            report = "Library: " + to_string(GetEntryCount()) + " ROMs, " + to_string(hashed) + " hashed in " + to_string(ms) + "ms";
+            printf("%s\n", report.c_str());
+        }
+        scanning = false;
+    });
+    return true;
+}
+
+bool NESDL_ROMLibrary::TakeReport(string& out)
+{
+    lock_guard<mutex> lock(reportMutex);
+    if (report.empty())
+    {
+        return false;
+    }
+    out = move(report);
+    report.clear();
+    return true;
+}
+
+size_t NESDL_ROMLibrary::GetEntryCount()
+{
+    lock_guard<mutex> lock(entryMutex);
+    return entries.size();
+}
+
+size_t NESDL_ROMLibrary::Scan(const string& root)
+{
+    error_code ec;
+    filesystem::path rootPath = filesystem::weakly_canonical(filesystem::path(root), ec);
+    if (ec)
+    {
+        return 0;
+    }
+
+    // Collect every .nes file. Anything with the same size and mtime as last time keeps its old entry,
+    // the rest get queued up for hashing. Files that have gone away simply aren't carried over
+    vector<ROMLibraryEntry> scanned;
+    vector<size_t> toHash;
+    filesystem::recursive_directory_iterator it(rootPath, filesystem::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != filesystem::recursive_directory_iterator(); it.increment(ec))
+    {
+        const filesystem::directory_entry& file = *it;
+        string extension = file.path().extension().string();
+        transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char ch) { return (char)tolower(ch); });
+        error_code fileEC;
+        if (extension != ".nes" || !file.is_regular_file(fileEC))
+        {
+            continue;
+        }
+
+        ROMLibraryEntry entry;
+        entry.path = file.path().string();
+        entry.record = {};
+        entry.record.size = file.file_size(fileEC);
+        entry.record.mtime = file.last_write_time(fileEC).time_since_epoch().count();
+        if (fileEC)
+        {
+            continue;
+        }
+
+        auto existing = entryIndices.find(entry.path);
+        if (existing != entryIndices.end() &&
+            entries[existing->second].record.size == entry.record.size &&
+            entries[existing->second].record.mtime == entry.record.mtime)
+        {
+            entry.record = entries[existing->second].record;
+        }
+        else
+        {
+            toHash.push_back(scanned.size());
+        }
+        scanned.push_back(move(entry));
+    }
+
+    // Hash on every core. Each worker grabs the next file off a shared counter, so one huge ROM
+    // doesn't hold up a thread's worth of small ones
+    size_t threadCount = min<size_t>(max(thread::hardware_concurrency(), 1u), toHash.size());
+    atomic<size_t> nextFile(0);
+    vector<thread> workers;
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back([&]()
+        {
+            for (size_t n = nextFile.fetch_add(1); n < toHash.size(); n = nextFile.fetch_add(1))
+            {
+                HashEntry(scanned[toHash[n]]);
+            }
+        });
+    }
+    for (thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    unordered_map<string, size_t> scannedIndices;
+    for (size_t i = 0; i < scanned.size(); ++i)
+    {
+        scannedIndices[scanned[i].path] = i;
+    }
+    {
+        lock_guard<mutex> lock(entryMutex);
+        entries = move(scanned);
+        entryIndices = move(scannedIndices);
+    }
+    WriteIndex();
+    return toHash.size();
+}
+
+bool NESDL_ROMLibrary::ApplyHeaderFixes(const string& path, FileHeader_INES& header)
+{
+    // Paths in the index are canonical, since that's how the scan finds them
+    error_code ec;
+    string canonicalPath = filesystem::weakly_canonical(filesystem::path(path), ec).string();
+    lock_guard<mutex> lock(entryMutex);
+    auto existing = entryIndices.find(canonicalPath);
+    if (ec || existing == entryIndices.end())
+    {
+        return false;
+    }
+
+    // Don't trust the entry if the file's been touched since it was hashed
+    const ROMLibraryRecord& record = entries[existing->second].record;
+    uint64_t size;
+    int64_t mtime;
+    if ((record.flags & ROMLIB_VALID) == 0 || !GetFileStamp(canonicalPath, size, mtime) ||
+        size != record.size || mtime != record.mtime)
+    {
+        return false;
+    }
+
+    uint8_t mapper = record.mapper;
+    uint8_t flags = record.flags;
+
+    // Hand-made fixes win over everything: [HeaderFixes] CRC32=<mapper> <H|V|4> <battery 0/1>
+    // (lowercase hex, like the config keeps them - see NESDL_Config::ReadFromFile)
+    char crcKey[9];
+    snprintf(crcKey, sizeof(crcKey), "%08x", record.romCRC32);
+    string fix = core->config->ReadValue<string>(ConfigSection::HEADERFIXES, crcKey, "");
+    if (!fix.empty())
+    {
+        stringstream ss(fix);
+        int fixMapper;
+        char fixMirroring;
+        int fixBattery;
+        if (ss >> fixMapper >> fixMirroring >> fixBattery && fixMapper >= 0 && fixMapper < 256)
+        {
+            mapper = (uint8_t)fixMapper;
+            flags &= ~ROMLIB_HEADER_BITS;
+            flags |= (fixMirroring == 'V' || fixMirroring == 'v') ? ROMLIB_VERTICAL : 0;
+            flags |= fixMirroring == '4' ? ROMLIB_FOURSCREEN : 0;
+            flags |= fixBattery != 0 ? ROMLIB_BATTERY : 0;
+        }
+        else
+        {
+            printf("Ignoring malformed header fix for %s: %s\n", crcKey, fix.c_str());
+        }
+    }
+
+    uint8_t ctrl1 = (header.ctrl1 & ~(INES_MAPPER_LOW | ROMLIB_HEADER_BITS)) | ((mapper & 0x0F) << 4) | (flags & ROMLIB_HEADER_BITS);
+    uint8_t ctrl2 = (header.ctrl2 & ~INES_MAPPER_HI) | (mapper & 0xF0);
+    bool changed = ctrl1 != header.ctrl1 || ctrl2 != header.ctrl2;
+    header.ctrl1 = ctrl1;
+    header.ctrl2 = ctrl2;
+    return changed;
+}
+
+void NESDL_ROMLibrary::ReadIndex()
+{
+    entries.clear();
+    entryIndices.clear();
+
+    // Slurp the whole file and pick it apart in memory - much quicker than thousands of small reads
+    ifstream in(FILENAME, ios::binary | ios::ate);
+    if (!in.is_open())
+    {
+        return;
+    }
+    vector<char> buffer((size_t)in.tellg());
+    in.seekg(0);
+    in.read(buffer.data(), buffer.size());
+    if (!in)
+    {
+        return;
+    }
+
+    const char* p = buffer.data();
+    const char* end = p + buffer.size();
+    uint32_t header[3]; // Magic, version, entry count
+    if (end - p < (ptrdiff_t)sizeof(header))
+    {
+        return;
+    }
+    memcpy(header, p, sizeof(header));
+    p += sizeof(header);
+    if (header[0] != ROMLIB_INDEX_MAGIC || header[1] != ROMLIB_INDEX_VERSION)
+    {
+        // Unknown format - the next scan just rebuilds it from scratch
+        return;
+    }
+
+    entries.reserve(header[2]);
+    for (uint32_t i = 0; i < header[2]; ++i)
+    {
+        ROMLibraryEntry entry;
+        uint16_t pathLength;
+        if (end - p < (ptrdiff_t)(sizeof(entry.record) + sizeof(pathLength)))
+        {
+            break;
+        }
+        memcpy(&entry.record, p, sizeof(entry.record));
+        p += sizeof(entry.record);
+        memcpy(&pathLength, p, sizeof(pathLength));
+        p += sizeof(pathLength);
+        if (end - p < pathLength)
+        {
+            break;
+        }
+        entry.path.assign(p, pathLength);
+        p += pathLength;
+
+        entryIndices[entry.path] = entries.size();
+        entries.push_back(move(entry));
+    }
+}
+
+void NESDL_ROMLibrary::WriteIndex()
+{
+    // Write to the side and swap it in, so a crash mid-write can't leave a half-written index behind
+    string tempPath = string(FILENAME) + ".tmp";
+    {
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out.is_open())
+        {
+            return;
+        }
+        uint32_t header[3] = { ROMLIB_INDEX_MAGIC, ROMLIB_INDEX_VERSION, (uint32_t)entries.size() };
+        out.write((const char*)header, sizeof(header));
+        for (const ROMLibraryEntry& entry : entries)
+        {
+            uint16_t pathLength = (uint16_t)min<size_t>(entry.path.size(), UINT16_MAX);
+            out.write((const char*)&entry.record, sizeof(entry.record));
+            out.write((const char*)&pathLength, sizeof(pathLength));
+            out.write(entry.path.data(), pathLength);
+        }
+        if (!out)
+        {
+            return;
+        }
+    }
+    error_code ec;
+    filesystem::rename(tempPath, FILENAME, ec);
+}
+
+bool NESDL_ROMLibrary::GetFileStamp(const string& path, uint64_t& size, int64_t& mtime)
+{
+    error_code ec;
+    size = filesystem::file_size(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+    mtime = filesystem::last_write_time(path, ec).time_since_epoch().count();
+    return !ec;
+}
+
+void NESDL_ROMLibrary::HashEntry(ROMLibraryEntry& entry)
+{
+    // Sequential hint - each file gets read start to finish exactly once
+    NESDL_MappedFile file;
+    if (!file.Open(entry.path.c_str(), true) || file.GetSize() < sizeof(FileHeader_INES))
+    {
+        return;
+    }
+    const uint8_t* data = file.GetData();
+    FileHeader_INES header;
+    memcpy(&header, data, sizeof(header));
+    if (header.id != 0x1A53454E)
+    {
+        return;
+    }
+
+    // Same layout LoadROM expects: header, optional trainer, PRG-ROM, CHR-ROM
+    uint64_t prgOffset = sizeof(header) + ((header.ctrl1 & INES_TRAINER) ? 512 : 0);
+    uint64_t prgSize = header.banks * 0x4000;
+    uint64_t chrSize = header.vbanks * 0x2000;
+    if (prgOffset + prgSize + chrSize > file.GetSize())
+    {
+        return;
+    }
+    const uint8_t* prg = data + prgOffset;
+    const uint8_t* chr = prg + prgSize;
+
+    ROMLibraryRecord& record = entry.record;
+    record.prgCRC32 = UpdateCRC32(0, prg, prgSize);
+    record.chrCRC32 = UpdateCRC32(0, chr, chrSize);
+    record.romCRC32 = UpdateCRC32(record.prgCRC32, chr, chrSize);
+    SHA1(prg, prgSize, record.prgSHA1);
+    SHA1(chr, chrSize, record.chrSHA1);
+    record.prgBanks = header.banks;
+    record.chrBanks = header.vbanks;
+    FixHeader(header, record);
+}
+
+void NESDL_ROMLibrary::FixHeader(const FileHeader_INES& header, ROMLibraryRecord& record)
+{
+    uint8_t headerMapper = ((header.ctrl1 & INES_MAPPER_LOW) >> 4) | (header.ctrl2 & INES_MAPPER_HI);
+    record.mapper = headerMapper;
+    record.flags = ROMLIB_VALID | (header.ctrl1 & ROMLIB_HEADER_BITS);
+
+    // Old dumping tools scribbled their name ("DiskDude!" being the famous one) over bytes 7-15. That
+    // lands in the upper mapper nibble, so an iNES 1.0 header with junk in the last four (always zero)
+    // bytes gets its upper nibble thrown away - NES 2.0 headers use those bytes, so they're left alone
+    bool isNES20 = (header.ctrl2 & INES_NES20) == 0x08;
+    bool hasJunk = header.unused[1] != 0 || header.unused[2] != 0 || header.unused[3] != 0 || header.unused[4] != 0;
+    if (!isNES20 && hasJunk)
+    {
+        record.mapper &= 0x0F;
+    }
+
+    if (record.mapper != headerMapper)
+    {
+        record.flags |= ROMLIB_CORRECTED;
+    }
+}
@@ -1,5 +1,8 @@
 #include "NESDL.h"
 #include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 // https://stackoverflow.com/questions/35926722/what-is-the-format-specifier-for-binary-in-c
 // (Modified)
@@ -13,9 +16,52 @@ std::string print_bin(uint8_t byte)
     return output;
 }
 
+// Converts one scanline of 6-bit palette indices to ARGB colors. With AVX2 available we
+// gather 8 colors at a time straight out of the palette table
+static void ConvertIndexedLine(const uint8_t* src, uint32_t* dst, const uint32_t* palette)
+{
+    int x = 0;
+#if defined(__AVX2__)
+    const __m256i indexMask = _mm256_set1_epi32(0x3F);
+    for (; x + 8 <= NESDL_SCREEN_WIDTH; x += 8)
+    {
+        __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x)));
+        indices = _mm256_and_si256(indices, indexMask);
+        __m256i colors = _mm256_i32gather_epi32((const int*)palette, indices, 4);
+        _mm256_storeu_si256((__m256i*)(dst + x), colors);
+    }
+#endif
+    for (; x < NESDL_SCREEN_WIDTH; ++x)
+    {
+        dst[x] = palette[src[x] & 0x3F];
+    }
+}
+
 void NESDL_SDL::WriteNextAPUSignal(float signal)
 {
-    SDL_QueueAudio(audioDevice, &signal, 4);
+    // Queue samples up in small batches rather than calling into SDL for every single one
+    audioSamples[audioSampleCount++] = signal;
+    if (audioSampleCount == APU_SAMPLE_BATCH)
+    {
+        FlushAudio();
+    }
+}
+
+void NESDL_SDL::FlushAudio()
+{
+    if (audioSampleCount == 0)
+    {
+        return;
+    }
+    NESDL_TRACE_SCOPE("Audio flush");
+    SDL_QueueAudio(audioDevice, audioSamples, audioSampleCount * sizeof(float));
+    audioSampleCount = 0;
+}
+
+void NESDL_SDL::ClearAudio()
+{
+    audioSampleCount = 0;
+    SDL_ClearQueuedAudio(audioDevice);
 }
 
 void NESDL_SDL::SDLInit()
@@ -25,6 +71,12 @@ void NESDL_SDL::SDLInit()
     
     // Initialize RNG
     dist = uniform_int_distribution<int>(0, INT_MAX);
+    
+    // Build the color tables and start off with a black screen
+    SetPalette(NESDL_PALETTE);
+    memset(frameIndexData, 0x0F, sizeof(frameIndexData));
+    memset(frameEmphasisData, 0x00, sizeof(frameEmphasisData));
+    audioSampleCount = 0;
 
     // Initialize SDL
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
@@ -172,16 +224,26 @@ void NESDL_SDL::SetCore(NESDL_Core* coreRef)
 
 void NESDL_SDL::UpdateScreen(double fps)
 {
+    NESDL_TRACE_SCOPE("UpdateScreen");
+    
+    // Don't leave a partial batch of samples sitting around between frames
+    FlushAudio();
+    
     // Feels a bit hacky - I want some specific NESDL_Text string values to update to specific things
     if (showFrameInfo)
     {
         const char* format = "(%.2fFPS) Frame %llu";
         string s = string_format(format, fps, core->ppu->currentFrame);
+#ifdef NESDL_PROFILING
+        s += NESDL_Profiler::GetOverlayText();
+#endif
         SetScreenTextText("frameinfo", s.c_str());
+        SetScreenTextPosition("frameinfo", 0, NESDL_SCREEN_HEIGHT - GetScreenTextHeight("frameinfo"));
     }
     if (showCPU)
     {
         const char* format = "PC: %04X\nSP: %02X\nA: %02X\nX: %02X\nY: %02X\nP: %s";
+        core->cpu->StoreLazyFlags();
         string s = string_format(format, core->cpu->registers.pc, core->cpu->registers.sp, core->cpu->registers.a, core->cpu->registers.x, core->cpu->registers.y, print_bin(core->cpu->registers.p).c_str());
         SetScreenTextText("cpu", s.c_str());
     }
@@ -202,6 +264,12 @@ void NESDL_SDL::UpdateScreen(double fps)
         }
     }
     
+    // Only convert the frame we're actually about to show (skipped frames are never converted)
+    if (frameTextureDirty)
+    {
+        ConvertFrameTexture();
+    }
+    
     // Draw game's frame data to screen
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
@@ -290,7 +358,10 @@ void NESDL_SDL::UpdateScreen(double fps)
         }
     }
     
-    SDL_RenderPresent(renderer);
+    {
+        NESDL_PROFILE_SCOPE(Present);
+        SDL_RenderPresent(renderer);
+    }
     
     // Debug Window
     SDL_RenderClear(debugRenderer);
@@ -300,10 +371,68 @@ void NESDL_SDL::UpdateScreen(double fps)
 
 void NESDL_SDL::UpdateScreenTexture()
 {
-    SDL_UpdateTexture(texture, NULL, core->ppu->frameData, NESDL_SCREEN_WIDTH * sizeof(uint32_t));
+    NESDL_PROFILE_SCOPE(TextureUpload);
+    // Hold onto the finished frame - the PPU starts drawing over its own copy right away
+    memcpy(frameIndexData, core->ppu->frameData, sizeof(frameIndexData));
+    memcpy(frameEmphasisData, core->ppu->frameEmphasis, sizeof(frameEmphasisData));
+    frameTextureDirty = true;
     SDL_UpdateTexture(debugTexture, NULL, core->ppu->ntFrameData, 64 * sizeof(uint32_t));
 }
 
+void NESDL_SDL::ConvertFrameTexture()
+{
+    NESDL_PROFILE_SCOPE(TextureUpload);
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0)
+    {
+        return;
+    }
+    for (int y = 0; y < NESDL_SCREEN_HEIGHT; ++y)
+    {
+        uint32_t* row = (uint32_t*)((uint8_t*)pixels + y * pitch);
+        const uint32_t* palette = paletteColors[frameEmphasisData[y] & 0x7];
+        ConvertIndexedLine(&frameIndexData[y * NESDL_SCREEN_WIDTH], row, palette);
+    }
+    SDL_UnlockTexture(texture);
+    frameTextureDirty = false;
+}
+
+/// Builds the color lookup tables used to convert PPU palette indices to ARGB. Swapping
+/// palettes is just a matter of calling this again with a different 64-color table
+void NESDL_SDL::SetPalette(const uint32_t* palette)
+{
+    // Emphasis is a fast approximation (not a video signal recreation) - each set
+    // bit darkens the two color channels it doesn't emphasize
+    const float attenuation = 0.816f;
+    for (int emphasis = 0; emphasis < 8; ++emphasis)
+    {
+        for (int i = 0; i < 0x40; ++i)
+        {
+            float r = (float)((palette[i] >> 16) & 0xFF);
+            float g = (float)((palette[i] >> 8) & 0xFF);
+            float b = (float)(palette[i] & 0xFF);
+            if (emphasis & (PPUMASK_TINT_R >> 5))
+            {
+                g *= attenuation;
+                b *= attenuation;
+            }
+            if (emphasis & (PPUMASK_TINT_G >> 5))
+            {
+                r *= attenuation;
+                b *= attenuation;
+            }
+            if (emphasis & (PPUMASK_TINT_B >> 5))
+            {
+                r *= attenuation;
+                g *= attenuation;
+            }
+            paletteColors[emphasis][i] = MakeColor((uint8_t)r, (uint8_t)g, (uint8_t)b);
+        }
+    }
+    frameTextureDirty = true;
+}
+
 void NESDL_SDL::GetCloseWindowEvent(SDL_WindowEvent event)
 {
     uint32_t winID = SDL_GetWindowID(window);
@@ -0,0 +1,472 @@
+#include "NESDL.h"
+
+NESDL_StateReader::NESDL_StateReader(const uint8_t* s, size_t size, bool c)
+{
+    src = s;
+    srcEnd = s + size;
+    compressed = c;
+    blockPos = 0;
+    failed = false;
+}
+
+void NESDL_StateReader::ReadBytes(void* dst, size_t length)
+{
+    uint8_t* out = (uint8_t*)dst;
+    if (!compressed)
+    {
+        if (failed || (size_t)(srcEnd - src) < length)
+        {
+            failed = true;
+            return;
+        }
+        memcpy(out, src, length);
+        src += length;
+        return;
+    }
+
+    while (length > 0)
+    {
+        if (failed || (blockPos == block.size() && !NextBlock()))
+        {
+            failed = true;
+            return;
+        }
+        size_t chunk = min(length, block.size() - blockPos);
+        memcpy(out, block.data() + blockPos, chunk);
+        blockPos += chunk;
+        out += chunk;
+        length -= chunk;
+    }
+}
+
+bool NESDL_StateReader::NextBlock()
+{
+    // Each block is its raw size, its stored size, then the data (stored as-is if LZ didn't shrink it)
+    uint32_t sizes[2];
+    if ((size_t)(srcEnd - src) < sizeof(sizes))
+    {
+        return false;
+    }
+    memcpy(sizes, src, sizeof(sizes));
+    src += sizeof(sizes);
+    if (sizes[0] == 0 || sizes[0] > NESDL_STATE_BLOCK_SIZE || sizes[1] > sizes[0] || (size_t)(srcEnd - src) < sizes[1])
+    {
+        return false;
+    }
+
+    block.resize(sizes[0]);
+    blockPos = 0;
+    bool ok = true;
+    if (sizes[1] == sizes[0])
+    {
+        memcpy(block.data(), src, sizes[0]);
+    }
+    else
+    {
+        ok = NESDL_SaveStates::Decompress(src, sizes[1], block.data(), sizes[0]);
+    }
+    src += sizes[1];
+    return ok;
+}
+
+void NESDL_SaveStates::Init(NESDL_Core* c)
+{
+    core = c;
+    jobRunning = false;
+    stopRequested = false;
+    stats = {};
+    worker = thread(&NESDL_SaveStates::WorkerThread, this);
+}
+
+void NESDL_SaveStates::Exit()
+{
+    {
+        lock_guard<mutex> lock(jobMutex);
+        stopRequested = true;
+    }
+    jobSignal.notify_all();
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+}
+
+void NESDL_SaveStates::Save(const string& path, uint64_t romSize)
+{
+    SaveJob job;
+    job.requested = chrono::steady_clock::now();
+    job.path = path;
+
+    NESDL_StateWriter writer;
+    writer.data.reserve(0x20000);
+    core->SaveState(writer);
+    job.state = move(writer.data);
+
+    // Thumbnail straight from the PPU's palette index frame, so it costs next to nothing here
+    job.thumbnail.resize(NESDL_STATE_THUMB_WIDTH * NESDL_STATE_THUMB_HEIGHT + NESDL_STATE_THUMB_HEIGHT);
+    for (int y = 0; y < NESDL_STATE_THUMB_HEIGHT; ++y)
+    {
+        const uint8_t* line = core->ppu->frameData + (y * 2) * NESDL_SCREEN_WIDTH;
+        for (int x = 0; x < NESDL_STATE_THUMB_WIDTH; ++x)
+        {
+            job.thumbnail[y * NESDL_STATE_THUMB_WIDTH + x] = line[x * 2];
+        }
+        job.thumbnail[NESDL_STATE_THUMB_WIDTH * NESDL_STATE_THUMB_HEIGHT + y] = core->ppu->frameEmphasis[y * 2];
+    }
+
+    job.header = {};
+    job.header.magic = NESDL_STATE_MAGIC;
+    job.header.version = NESDL_STATE_VERSION;
+    job.header.romSize = romSize;
+    job.header.rawSize = (uint32_t)job.state.size();
+    job.header.thumbnailWidth = NESDL_STATE_THUMB_WIDTH;
+    job.header.thumbnailHeight = NESDL_STATE_THUMB_HEIGHT;
+    job.header.mapper = core->mapper->mapperNumber;
+
+    double serializeTime = chrono::duration<double, milli>(chrono::steady_clock::now() - job.requested).count();
+    {
+        lock_guard<mutex> lock(statsMutex);
+        stats.serializeTime = serializeTime;
+    }
+    {
+        lock_guard<mutex> lock(jobMutex);
+        jobs.push(move(job));
+    }
+    jobSignal.notify_one();
+}
+
+bool NESDL_SaveStates::Load(const string& path, uint64_t romSize, string& error)
+{
+    // The slot could still be on its way to disk
+    WaitForWrites();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    NESDL_MappedFile file;
+    if (!file.Open(path.c_str(), true))
+    {
+        error = "No save state in this slot";
+        return false;
+    }
+    SaveStateFileHeader header;
+    if (file.GetSize() < sizeof(header))
+    {
+        error = "Save state is damaged";
+        return false;
+    }
+    memcpy(&header, file.GetData(), sizeof(header));
+    if (header.magic != NESDL_STATE_MAGIC || header.version != NESDL_STATE_VERSION)
+    {
+        error = "Save state is from a different version of NESDL";
+        return false;
+    }
+    if (header.romSize != romSize || header.mapper != core->mapper->mapperNumber)
+    {
+        error = "Save state is for a different ROM";
+        return false;
+    }
+    uint64_t stateOffset = sizeof(header) + (uint64_t)header.thumbnailPackedSize;
+    if (stateOffset + header.packedSize > file.GetSize() ||
+        Checksum(file.GetData() + stateOffset, header.packedSize) != header.packedChecksum)
+    {
+        error = "Save state is damaged";
+        return false;
+    }
+
+    // Loading goes straight into the live machine, so hang onto how things were in case the file
+    // turns out to be damaged partway through
+    NESDL_StateWriter backup;
+    core->SaveState(backup);
+
+    NESDL_StateReader reader(file.GetData() + stateOffset, header.packedSize, true);
+    core->LoadState(reader);
+    if (reader.Failed() || !reader.AtEnd())
+    {
+        NESDL_StateReader restore(backup.data.data(), backup.data.size(), false);
+        core->LoadState(restore);
+        error = "Save state is damaged";
+        return false;
+    }
+
+    lock_guard<mutex> lock(statsMutex);
+    stats.loads++;
+    stats.loadTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+uint32_t NESDL_SaveStates::Checksum(const uint8_t* src, size_t size)
+{
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ src[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+void NESDL_SaveStates::WaitForWrites()
+{
+    unique_lock<mutex> lock(jobMutex);
+    idleSignal.wait(lock, [this]() { return jobs.empty() && !jobRunning; });
+}
+
+SaveStateStats NESDL_SaveStates::GetStats()
+{
+    lock_guard<mutex> lock(statsMutex);
+    return stats;
+}
+
+bool NESDL_SaveStates::TakeReport(string& out)
+{
+    lock_guard<mutex> lock(statsMutex);
+    if (report.empty())
+    {
+        return false;
+    }
+    out = move(report);
+    report.clear();
+    return true;
+}
+
+void NESDL_SaveStates::WorkerThread()
+{
+    unique_lock<mutex> lock(jobMutex);
+    while (true)
+    {
+        jobSignal.wait(lock, [this]() { return stopRequested || !jobs.empty(); });
+        if (jobs.empty())
+        {
+            // Only stops once everything queued before Exit() is on disk
+            break;
+        }
+        SaveJob job = move(jobs.front());
+        jobs.pop();
+        jobRunning = true;
+        lock.unlock();
+
+        double compressTime = 0;
+        double writeTime = 0;
+        bool written = WriteJob(job, compressTime, writeTime);
+        double latency = chrono::duration<double, milli>(chrono::steady_clock::now() - job.requested).count();
+        {
+            lock_guard<mutex> statsLock(statsMutex);
+            char text[128];
+            if (written)
+            {
+                stats.saves++;
+                stats.lastRawSize = job.header.rawSize;
+                stats.lastPackedSize = job.header.packedSize;
+                stats.totalRawSize += job.header.rawSize;
+                stats.totalPackedSize += job.header.packedSize;
+                stats.compressTime = compressTime;
+                stats.writeTime = writeTime;
+                stats.saveLatency = latency;
+                double ratio = job.header.packedSize > 0 ? (double)job.header.rawSize / job.header.packedSize : 0;
+                snprintf(text, sizeof(text), "State saved - %uKB to %uKB (%.1fx) in %.1fms",
+                         job.header.rawSize / 1024, job.header.packedSize / 1024, ratio, latency);
+            }
+            else
+            {
+                snprintf(text, sizeof(text), "Couldn't write save state!");
+            }
+            report = text;
+            printf("%s (serialize %.2fms, compress %.2fms, write %.2fms)\n", report.c_str(), stats.serializeTime, compressTime, writeTime);
+        }
+
+        lock.lock();
+        jobRunning = false;
+        if (jobs.empty())
+        {
+            idleSignal.notify_all();
+        }
+    }
+}
+
+bool NESDL_SaveStates::WriteJob(SaveJob& job, double& compressTime, double& writeTime)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<uint8_t> thumbnail;
+    vector<uint8_t> state;
+    CompressBlocks(job.thumbnail, thumbnail);
+    CompressBlocks(job.state, state);
+    job.header.thumbnailPackedSize = (uint32_t)thumbnail.size();
+    job.header.packedSize = (uint32_t)state.size();
+    job.header.packedChecksum = Checksum(state.data(), state.size());
+    chrono::steady_clock::time_point compressed = chrono::steady_clock::now();
+    compressTime = chrono::duration<double, milli>(compressed - start).count();
+
+    // Written off to the side and renamed over the old one, so a crash (or full disk) mid-write
+    // never costs the state that was already in the slot
+    string tempPath = job.path + ".tmp";
+    {
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+        out.write((const char*)&job.header, sizeof(job.header));
+        out.write((const char*)thumbnail.data(), thumbnail.size());
+        out.write((const char*)state.data(), state.size());
+        out.close();
+        if (!out)
+        {
+            return false;
+        }
+    }
+    error_code ec;
+    filesystem::rename(tempPath, job.path, ec);
+    writeTime = chrono::duration<double, milli>(chrono::steady_clock::now() - compressed).count();
+    return !ec;
+}
+
+void NESDL_SaveStates::CompressBlocks(const vector<uint8_t>& src, vector<uint8_t>& out)
+{
+    out.reserve(src.size() / 2);
+    for (size_t offset = 0; offset < src.size(); offset += NESDL_STATE_BLOCK_SIZE)
+    {
+        uint32_t sizes[2];
+        sizes[0] = (uint32_t)min<size_t>(src.size() - offset, NESDL_STATE_BLOCK_SIZE);
+        size_t sizesAt = out.size();
+        out.resize(sizesAt + sizeof(sizes));
+        Compress(src.data() + offset, sizes[0], out);
+
+        // Not worth it (noise, mostly) - store it as it was
+        sizes[1] = (uint32_t)(out.size() - sizesAt - sizeof(sizes));
+        if (sizes[1] >= sizes[0])
+        {
+            out.resize(sizesAt + sizeof(sizes));
+            out.insert(out.end(), src.begin() + offset, src.begin() + offset + sizes[0]);
+            sizes[1] = sizes[0];
+        }
+        memcpy(out.data() + sizesAt, sizes, sizeof(sizes));
+    }
+}
+
+void NESDL_SaveStates::Compress(const uint8_t* src, size_t size, vector<uint8_t>& out)
+{
+    // LZ4-style sequences: a token (literal count in the high nibble, match length - 4 in the low,
+    // 15 meaning more length bytes follow), the literals, then a 2-byte offset back to the match.
+    // Matches are found through a small hash table of 4-byte sequences, which is plenty for RAM/VRAM
+    // dumps - they're mostly long runs of the same few bytes
+    const int hashBits = 12;
+    uint32_t table[1 << hashBits];
+    fill(begin(table), end(table), UINT32_MAX);
+    auto writeLength = [&out](size_t length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            out.push_back(255);
+        }
+        out.push_back((uint8_t)length);
+    };
+
+    size_t pos = 0;
+    size_t literalStart = 0;
+    while (pos + 4 <= size)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, src + pos, 4);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+        uint32_t match = table[hash];
+        table[hash] = (uint32_t)pos;
+        if (match == UINT32_MAX || pos - match > 0xFFFF || memcmp(src + match, src + pos, 4) != 0)
+        {
+            ++pos;
+            continue;
+        }
+
+        size_t matchLength = 4;
+        while (pos + matchLength < size && src[match + matchLength] == src[pos + matchLength])
+        {
+            ++matchLength;
+        }
+        size_t literals = pos - literalStart;
+        out.push_back((uint8_t)((min<size_t>(literals, 15) << 4) | min<size_t>(matchLength - 4, 15)));
+        if (literals >= 15)
+        {
+            writeLength(literals - 15);
+        }
+        out.insert(out.end(), src + literalStart, src + pos);
+        uint16_t offset = (uint16_t)(pos - match);
+        out.push_back(offset & 0xFF);
+        out.push_back(offset >> 8);
+        if (matchLength - 4 >= 15)
+        {
+            writeLength(matchLength - 4 - 15);
+        }
+        pos += matchLength;
+        literalStart = pos;
+    }
+
+    // Whatever's left goes out as literals with no match after them - which is also how the
+    // decompressor knows it's done
+    size_t literals = size - literalStart;
+    out.push_back((uint8_t)(min<size_t>(literals, 15) << 4));
+    if (literals >= 15)
+    {
+        writeLength(literals - 15);
+    }
+    out.insert(out.end(), src + literalStart, src + size);
+}
+
+bool NESDL_SaveStates::Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize)
+{
+    size_t in = 0;
+    size_t out = 0;
+    auto readLength = [&](size_t& length) -> bool
+    {
+        uint8_t next;
+        do
+        {
+            if (in >= size)
+            {
+                return false;
+            }
+            next = src[in++];
+            length += next;
+        } while (next == 255);
+        return true;
+    };
+
+    while (in < size)
+    {
+        uint8_t token = src[in++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals))
+        {
+            return false;
+        }
+        if (literals > size - in || literals > dstSize - out)
+        {
+            return false;
+        }
+        memcpy(dst + out, src + in, literals);
+        in += literals;
+        out += literals;
+        if (in == size)
+        {
+            break;
+        }
+
+        if (size - in < 2)
+        {
+            return false;
+        }
+        size_t offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+        size_t matchLength = (token & 0x0F) + 4;
+        if ((token & 0x0F) == 15 && !readLength(matchLength))
+        {
+            return false;
+        }
+        if (offset == 0 || offset > out || matchLength > dstSize - out)
+        {
+            return false;
+        }
+        // Byte at a time - matches are allowed to overlap what they're writing (runs)
+        for (size_t i = 0; i < matchLength; ++i, ++out)
+        {
+            dst[out] = dst[out - offset];
+        }
+    }
+    return out == dstSize;
+}
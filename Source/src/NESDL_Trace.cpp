@@ -0,0 +1,190 @@
+#include "NESDL.h"
+
+#ifdef NESDL_TRACING
+
+atomic<bool> NESDL_Trace::enabled(false);
+mutex NESDL_Trace::buffersMutex;
+vector<unique_ptr<NESDL_TraceBuffer>> NESDL_Trace::buffers;
+thread NESDL_Trace::flushThread;
+mutex NESDL_Trace::flushMutex;
+condition_variable NESDL_Trace::flushSignal;
+bool NESDL_Trace::stopRequested = false;
+ofstream NESDL_Trace::file;
+bool NESDL_Trace::firstEvent = true;
+uint64_t NESDL_Trace::startTicks = 0;
+
+void NESDL_TraceBuffer::Push(const NESDL_TraceEvent& event)
+{
+    uint32_t h = head.load(memory_order_relaxed);
+    if (h - tail.load(memory_order_acquire) >= NESDL_TRACE_BUFFER_SIZE)
+    {
+        // Flush thread fell behind - never block the emulator over it
+        dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    events[h & (NESDL_TRACE_BUFFER_SIZE - 1)] = event;
+    head.store(h + 1, memory_order_release);
+}
+
+bool NESDL_TraceBuffer::Pop(NESDL_TraceEvent& event)
+{
+    uint32_t t = tail.load(memory_order_relaxed);
+    if (t == head.load(memory_order_acquire))
+    {
+        return false;
+    }
+    event = events[t & (NESDL_TRACE_BUFFER_SIZE - 1)];
+    tail.store(t + 1, memory_order_release);
+    return true;
+}
+
+bool NESDL_Trace::Start(const char* path)
+{
+    if (enabled)
+    {
+        return true;
+    }
+    file.open(path, ofstream::out | ofstream::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    
+    // Name the two timelines - host work (real time) and emulated events (emulated time)
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Host\"}},\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"NES (emulated time)\"}}";
+    firstEvent = false;
+    
+    startTicks = SDL_GetPerformanceCounter();
+    stopRequested = false;
+    enabled = true;
+    flushThread = thread(FlushThread);
+    return true;
+}
+
+void NESDL_Trace::Stop()
+{
+    if (!enabled)
+    {
+        return;
+    }
+    enabled = false;
+    {
+        lock_guard<mutex> lock(flushMutex);
+        stopRequested = true;
+    }
+    flushSignal.notify_one();
+    flushThread.join();
+    
+    // Anything recorded after the last flush
+    Drain();
+    
+    // Overflows are only counted while tracing (the flush thread mustn't print) - they go into the
+    // trace as a global instant at the end, and get reported once here
+    double hostTicksToUS = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+    double endTS = (int64_t)(SDL_GetPerformanceCounter() - startTicks) * hostTicksToUS;
+    {
+        lock_guard<mutex> lock(buffersMutex);
+        for (auto& buffer : buffers)
+        {
+            uint64_t dropped = buffer->dropped.exchange(0);
+            if (dropped > 0)
+            {
+                file << string_format(",\n{\"name\":\"Events dropped\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"count\":%llu}}",
+                                      buffer->threadIndex, endTS, (unsigned long long)dropped);
+                printf("Trace buffer for thread %u overflowed, %llu events dropped\n", buffer->threadIndex, (unsigned long long)dropped);
+            }
+        }
+    }
+    file << "\n]}\n";
+    file.close();
+}
+
+void NESDL_Trace::Record(const char* name, char phase, bool emulated, uint64_t timestamp, uint64_t duration, uint32_t arg)
+{
+    NESDL_TraceEvent event;
+    event.name = name;
+    event.phase = phase;
+    event.emulated = emulated;
+    event.timestamp = timestamp;
+    event.duration = duration;
+    event.arg = arg;
+    GetThreadBuffer()->Push(event);
+}
+
+NESDL_TraceBuffer* NESDL_Trace::GetThreadBuffer()
+{
+    // Each thread gets its own ring the first time it records anything. Buffers live until
+    // the program exits, so the flush thread never sees one disappear under it
+    thread_local NESDL_TraceBuffer* buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        lock_guard<mutex> lock(buffersMutex);
+        buffers.push_back(make_unique<NESDL_TraceBuffer>((uint32_t)buffers.size() + 1));
+        buffer = buffers.back().get();
+    }
+    return buffer;
+}
+
+void NESDL_Trace::FlushThread()
+{
+    unique_lock<mutex> lock(flushMutex);
+    while (!stopRequested)
+    {
+        flushSignal.wait_for(lock, chrono::milliseconds(NESDL_TRACE_FLUSH_MS));
+        Drain();
+    }
+}
+
+void NESDL_Trace::Drain()
+{
+    double hostTicksToUS = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+    double clockToUS = 1000000.0 / (double)NESDL_MASTER_CLOCK;
+    
+    lock_guard<mutex> lock(buffersMutex);
+    for (auto& buffer : buffers)
+    {
+        NESDL_TraceEvent event;
+        while (buffer->Pop(event))
+        {
+            double ts;
+            double dur;
+            int pid;
+            uint32_t tid;
+            if (event.emulated)
+            {
+                ts = event.timestamp * clockToUS;
+                dur = event.duration * clockToUS;
+                pid = 2;
+                tid = 1;
+            }
+            else
+            {
+                ts = (int64_t)(event.timestamp - startTicks) * hostTicksToUS;
+                dur = event.duration * hostTicksToUS;
+                pid = 1;
+                tid = buffer->threadIndex;
+            }
+            
+            file << (firstEvent ? "" : ",\n");
+            firstEvent = false;
+            file << string_format("{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f", event.name, event.phase, pid, tid, ts);
+            if (event.phase == 'X')
+            {
+                file << string_format(",\"dur\":%.3f", dur);
+            }
+            else
+            {
+                file << ",\"s\":\"t\"";
+            }
+            if (event.emulated)
+            {
+                file << string_format(",\"args\":{\"clock\":%llu,\"value\":%u}", (unsigned long long)event.timestamp, event.arg);
+            }
+            file << "}";
+        }
+    }
+}
+
+#endif
@@ -6,6 +6,12 @@
 #define ID_FILE_RESET	103
 #define ID_FILE_RESETH	104
 #define ID_FILE_QUIT	105
+#define ID_FILE_LIBRARY	106
+#define ID_FILE_SAVEST	107
+#define ID_FILE_LOADST	108
+#define ID_FILE_SLOT	109
+#define ID_FILE_RECMOV	110
+#define ID_FILE_PLAYMOV	111
 
 #define ID_VIEW_RESIZE1	201
 #define ID_VIEW_RESIZE2	202
@@ -24,6 +30,11 @@
 #define ID_DBUG_STEPPPU	305
 #define ID_DBUG_NINTLOG	306
 #define ID_DBUG_REMVLOG	307
+#define ID_DBUG_TRACE	308
+#define ID_DBUG_ENDTRCE	309
+#define ID_DBUG_FLIGHT	310
+#define ID_DBUG_DIVERGE	312
+#define ID_DBUG_FASTCPU	313
 
 
 void NESDL_WinMenu::Initialize(SDL_Window* window)
@@ -44,7 +55,13 @@ void NESDL_WinMenu::Initialize(SDL_Window* window)
     // Initialize File menu, store in main menu as the first option
     AppendMenu(mainMenu, MF_POPUP, (UINT_PTR)fileMenu, L"File");
     AppendMenu(fileMenu, MF_STRING, ID_FILE_OPEN, L"Open ROM...");
+    AppendMenu(fileMenu, MF_STRING, ID_FILE_LIBRARY, L"Scan ROM Library...");
     AppendMenu(fileMenu, MF_STRING, ID_FILE_CLOSE, L"Close ROM");
+    AppendMenu(fileMenu, MF_STRING, ID_FILE_SAVEST, L"Save State\tF5");
+    AppendMenu(fileMenu, MF_STRING, ID_FILE_SLOT, L"Next State Slot\tF6");
+    AppendMenu(fileMenu, MF_STRING, ID_FILE_LOADST, L"Load State\tF7");
+    AppendMenu(fileMenu, MF_STRING, ID_FILE_RECMOV, L"Record/Stop Movie\tF8");
+    AppendMenu(fileMenu, MF_STRING, ID_FILE_PLAYMOV, L"Play/Stop Movie\tF9");
     AppendMenu(fileMenu, MF_STRING, ID_FILE_RESET, L"Reset System");
     AppendMenu(fileMenu, MF_STRING, ID_FILE_RESETH, L"Reset System (Hard)");
     AppendMenu(fileMenu, MF_STRING, ID_FILE_QUIT, L"Quit");
@@ -73,7 +90,12 @@ void NESDL_WinMenu::Initialize(SDL_Window* window)
 #ifdef _DEBUG
     AppendMenu(debugMenu, MF_STRING, ID_DBUG_NINTLOG, L"Attach Nintendulator Log...");
     AppendMenu(debugMenu, MF_STRING, ID_DBUG_REMVLOG, L"Detach Nintendulator Log");
+    AppendMenu(debugMenu, MF_STRING, ID_DBUG_TRACE, L"Start CPU Trace...");
+    AppendMenu(debugMenu, MF_STRING, ID_DBUG_ENDTRCE, L"Stop CPU Trace");
+    AppendMenu(debugMenu, MF_STRING, ID_DBUG_FASTCPU, L"Toggle CPU Fast Paths");
+    AppendMenu(debugMenu, MF_STRING, ID_DBUG_FLIGHT, L"Dump Flight Recorder");
 #endif
+    AppendMenu(debugMenu, MF_STRING, ID_DBUG_DIVERGE, L"Find Movie Divergence");
 
     // attach menu bar to the window
     SetMenu(hwnd, mainMenu);
@@ -86,9 +108,27 @@ void NESDL_WinMenu::HandleWindowEvent(int eventId, NESDL_Core* core)
         case ID_FILE_OPEN:
             core->Action_OpenROM();
             break;
+        case ID_FILE_LIBRARY:
+            core->Action_ScanROMLibrary();
+            break;
         case ID_FILE_CLOSE:
             core->Action_CloseROM();
             break;
+        case ID_FILE_SAVEST:
+            core->Action_SaveState();
+            break;
+        case ID_FILE_LOADST:
+            core->Action_LoadState();
+            break;
+        case ID_FILE_SLOT:
+            core->Action_NextStateSlot();
+            break;
+        case ID_FILE_RECMOV:
+            core->Action_RecordMovie();
+            break;
+        case ID_FILE_PLAYMOV:
+            core->Action_PlayMovie();
+            break;
         case ID_FILE_RESET:
             core->Action_ResetSoft();
             break;
@@ -146,6 +186,21 @@ void NESDL_WinMenu::HandleWindowEvent(int eventId, NESDL_Core* core)
         case ID_DBUG_REMVLOG:
             core->Action_DetachNintendulatorLog();
             break;
+        case ID_DBUG_TRACE:
+            core->Action_StartCPUTrace();
+            break;
+        case ID_DBUG_ENDTRCE:
+            core->Action_StopCPUTrace();
+            break;
+        case ID_DBUG_FASTCPU:
+            core->Action_ToggleCPUFastPaths();
+            break;
+        case ID_DBUG_FLIGHT:
+            core->Action_DumpFlightRecorder();
+            break;
+        case ID_DBUG_DIVERGE:
+            core->Action_FindMovieDivergence();
+            break;
     }
 }
 #endif
@@ -1,142 +1,72 @@
 #include "NESDL.h"
 
-void NESDL_Mapper_1::InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks)
+void NESDL_Mapper_1::ResetBanks()
 {
-    prgBanks = prgROMBanks;
-    chrBanks = chrROMBanks;
-    
-    // Init PRG-ROM data
-    if (prgBanks > 0)
-    {
-        prgROM = new uint8_t[prgBanks * 0x4000];
-        memcpy(prgROM, prgROMData, prgBanks * 0x4000);
-    }
-    
-    // Init CHR-ROM Data
-    if (chrBanks > 0)
-    {
-        chrROM = new uint8_t[chrBanks * 0x2000];
-        memcpy(chrROM, chrROMData, chrBanks * 0x2000);
-    }
-    else
-    {
-        // Assume 8KB of CHR-RAM
-        chrROM = new uint8_t[0x2000];
-        memset(chrROM, 0x00, 0x2000);
-    }
-    
     // Assume we start in PRG-ROM bank mode 3 (confirmed?) and 8KB CHR mode
+    shiftRegister = 0;
+    shiftIndex = 0;
+    prgROMMode = 3;
+    chrROMMode = false;
     prgROM0Index = 0;
     prgROM1Index = (prgBanks-1);
     chrROM0Index = 0;
     chrROM1Index = 1;
-    
-    // TODO what is this flag for? Was this defined in MMC1 docs?
-    prgRAMEnable = true;
+    UpdateBanks();
 }
 
-uint8_t NESDL_Mapper_1::ReadByte(uint16_t addr)
+void NESDL_Mapper_1::WriteRegister(uint16_t addr, uint8_t data)
 {
-    if (addr < 0x1000)
-    {
-        return chrROM[chrROM0Index * 0x1000 + addr];
-    }
-    else if (addr < 0x2000)
-    {
-        return chrROM[chrROM1Index * 0x1000 + (addr - 0x1000)];
-    }
+    core->cpu->DidMapperWrite();
     
-    if (addr >= 0x6000 && addr < 0x8000)
+    // Clear latch if bit 7 is ever written to
+    if ((data & 0x80) == 0x80)
     {
-        if (prgRAMEnable)
-        {
-            return prgRAM[addr - 0x6000];
-        }
+        shiftRegister = 0;
+        shiftIndex = 0;
+        return;
     }
-    else if (addr >= 0x8000 && addr < 0xC000)
-    {
-        return prgROM[prgROM0Index * 0x4000 + (addr - 0x8000)];
-    }
-    else if (addr >= 0xC000)
+    
+    // Ignore successive writes
+    // https://www.nesdev.org/wiki/MMC1#Consecutive-cycle_writes
+    if (core->cpu->IsConsecutiveMapperWrite())
     {
-        return prgROM[prgROM1Index * 0x4000 + (addr - 0xC000)];
+//            return;
     }
     
-    return 0;
-}
-
-void NESDL_Mapper_1::WriteByte(uint16_t addr, uint8_t data)
-{
-    // If we have no CHR-ROM banks, assume CHR-RAM is on-board and make
-    // this address space writable
-    if (chrBanks == 0)
+    // It takes 5 consecutive writes to fill the shift register
+    // and send it to where it needs to go
+    shiftRegister |= (data & 0x1) << shiftIndex++;
+    if (shiftIndex == 5)
     {
-        if (addr < 0x1000)
+        if (addr >= 0xA000)
         {
-            chrROM[chrROM0Index * 0x1000 + addr] = data;
+            NESDL_TRACE_EMU_INSTANT("Bank switch", core->ppu->elapsedCycles * 4, (addr & 0xE000) | shiftRegister);
         }
-        else if (addr < 0x2000)
+        
+        // We have 5 bits loaded to send this info to
+        if (addr < 0xA000)
         {
-            chrROM[chrROM1Index * 0x1000 + (addr - 0x1000)] = data;
+            // Send to "control"
+            WriteControl();
         }
-    }
-    
-    if (addr >= 0x6000 && addr < 0x8000)
-    {
-        if (prgRAMEnable)
+        else if (addr < 0xC000)
         {
-            prgRAM[addr - 0x6000] = data;
+            // Send to CHR bank 0
+            WriteCHRBank(0);
         }
-    }
-    else if (addr >= 0x8000)
-    {
-        core->cpu->DidMapperWrite();
-        
-        // Clear latch if bit 7 is ever written to
-        if ((data & 0x80) == 0x80)
+        else if (addr < 0xE000)
         {
-            shiftRegister = 0;
-            shiftIndex = 0;
-            return;
+            // Send to CHR bank 1
+            WriteCHRBank(1);
         }
-        
-        // Ignore successive writes
-        // https://www.nesdev.org/wiki/MMC1#Consecutive-cycle_writes
-        if (core->cpu->IsConsecutiveMapperWrite())
+        else
         {
-//            return;
+            // Send to PRG bank
+            WritePRGBank();
         }
         
-        // It takes 5 consecutive writes to fill the shift register
-        // and send it to where it needs to go
-        shiftRegister |= (data & 0x1) << shiftIndex++;
-        if (shiftIndex == 5)
-        {
-            // We have 5 bits loaded to send this info to
-            if (addr < 0xA000)
-            {
-                // Send to "control"
-                WriteControl();
-            }
-            else if (addr < 0xC000)
-            {
-                // Send to CHR bank 0
-                WriteCHRBank(0);
-            }
-            else if (addr < 0xE000)
-            {
-                // Send to CHR bank 1
-                WriteCHRBank(1);
-            }
-            else
-            {
-                // Send to PRG bank
-                WritePRGBank();
-            }
-            
-            shiftRegister = 0;
-            shiftIndex = 0;
-        }
+        shiftRegister = 0;
+        shiftIndex = 0;
     }
 }
 
@@ -192,6 +122,7 @@ void NESDL_Mapper_1::WriteCHRBank(uint8_t index)
             chrROM1Index = value;
         }
     }
+    UpdateBanks();
 }
 
 void NESDL_Mapper_1::WritePRGBank()
@@ -222,5 +153,38 @@ void NESDL_Mapper_1::WritePRGBank()
             }
             break;
     }
+    UpdateBanks();
+}
+
+void NESDL_Mapper_1::SaveRegisters(NESDL_StateWriter& state)
+{
+    state.Write(shiftRegister, "shiftRegister");
+    state.Write(shiftIndex, "shiftIndex");
+    state.Write(prgROM0Index, "prgROM0Index");
+    state.Write(prgROM1Index, "prgROM1Index");
+    state.Write(chrROM0Index, "chrROM0Index");
+    state.Write(chrROM1Index, "chrROM1Index");
+    state.Write(prgROMMode, "prgROMMode");
+    state.Write(chrROMMode, "chrROMMode");
+}
+
+void NESDL_Mapper_1::LoadRegisters(NESDL_StateReader& state)
+{
+    state.Read(shiftRegister);
+    state.Read(shiftIndex);
+    state.Read(prgROM0Index);
+    state.Read(prgROM1Index);
+    state.Read(chrROM0Index);
+    state.Read(chrROM1Index);
+    state.Read(prgROMMode);
+    state.Read(chrROMMode);
+}
+
+void NESDL_Mapper_1::UpdateBanks()
+{
+    MapPRG(0, prgROM0Index);
+    MapPRG(1, prgROM1Index);
+    MapCHR(0, chrROM0Index);
+    MapCHR(1, chrROM1Index);
 }
 
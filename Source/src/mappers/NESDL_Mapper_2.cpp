@@ -0,0 +1,17 @@
+#include "NESDL.h"
+
+void NESDL_Mapper_2::ResetBanks()
+{
+    // 0x8000-0xBFFF is switchable, 0xC000-0xFFFF is always the last bank
+    MapPRG(0, 0);
+    MapPRG(1, -1);
+    MapCHR(0, 0);
+}
+
+void NESDL_Mapper_2::WriteRegister(uint16_t /*addr*/, uint8_t data)
+{
+    // Any write to 0x8000-0xFFFF selects the bank. UNROM only wires up 3 bits and UOROM 4, which
+    // MapPRG's wrap-around covers. Bus conflicts (the ROM fighting the written value) are ignored
+    NESDL_TRACE_EMU_INSTANT("Bank switch", core->ppu->elapsedCycles * 4, data);
+    MapPRG(0, data);
+}
@@ -0,0 +1,16 @@
+#include "NESDL.h"
+
+void NESDL_Mapper_3::ResetBanks()
+{
+    // PRG-ROM is laid out just like NROM
+    MapPRG(0, 0);
+    MapPRG(1, -1);
+    MapCHR(0, 0);
+}
+
+void NESDL_Mapper_3::WriteRegister(uint16_t /*addr*/, uint8_t data)
+{
+    // Any write to 0x8000-0xFFFF selects the 8KB CHR bank (bus conflicts ignored, same as UxROM)
+    NESDL_TRACE_EMU_INSTANT("Bank switch", core->ppu->elapsedCycles * 4, data);
+    MapCHR(0, data);
+}
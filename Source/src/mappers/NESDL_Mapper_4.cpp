@@ -1,29 +1,25 @@
 #include "NESDL.h"
 
-void NESDL_Mapper_4::InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks)
+void NESDL_Mapper_4::ResetBanks()
 {
-    prgBanks = prgROMBanks * 2; // iNES is PRG-ROM in 16KB blocks, MMC3 works in 8KB
-	chrBanks = chrROMBanks * 8; // iNES is CHR-ROM in 8KB blocks, MMC3 works in 1KB
-
-    // Init PRG-ROM data
-    if (prgBanks > 0)
-    {
-        prgROM = new uint8_t[prgBanks * 0x2000];
-        memcpy(prgROM, prgROMData, prgBanks * 0x2000);
-    }
-
-    // Init CHR-ROM data
-    if (chrBanks > 0)
-    {
-        chrROM = new uint8_t[chrBanks * 0x400];
-        memcpy(chrROM, chrROMData, chrBanks * 0x400);
-    }
-    else
-    {
-        // Assume 8KB of CHR-RAM
-        chrROM = new uint8_t[0x2000];
-        memset(chrROM, 0x00, 0x2000);
-    }
+    // Registers aren't defined at power on - start out with every bank in order
+    prgROM0Index = 0;
+    prgROM1Index = 1;
+    chrROM0Index = 0;
+    chrROM1Index = 2;
+    chrROM2Index = 4;
+    chrROM3Index = 5;
+    chrROM4Index = 6;
+    chrROM5Index = 7;
+    bankRegisterMode = 0;
+    prgROMBankMode = 0;
+    chrA12Inversion = 0;
+    UpdateBanks();
+    
+    irqEnabled = false;
+    irqCounter = 0;
+    irqCounterReload = 0;
+    irqSyncedAt = 0;
 }
 
 void NESDL_Mapper_4::SetFourWayMirroring(uint8_t fourWayMirroringMode)
@@ -36,188 +32,8 @@ void NESDL_Mapper_4::SetFourWayMirroring(uint8_t fourWayMirroringMode)
     }
 }
 
-uint8_t NESDL_Mapper_4::ReadByte(uint16_t addr)
+void NESDL_Mapper_4::WriteRegister(uint16_t addr, uint8_t data)
 {
-    if (chrA12Inversion == false)
-    {
-        if (addr < 0x800)
-        {
-            return chrROM[(chrROM0Index * 0x400) + addr];
-        }
-        else if (addr < 0x1000)
-        {
-            return chrROM[(chrROM1Index * 0x400) + (addr - 0x800)];
-        }
-        else if (addr < 0x1400)
-        {
-            return chrROM[(chrROM2Index * 0x400) + (addr - 0x1000)];
-        }
-        else if (addr < 0x1800)
-        {
-            return chrROM[(chrROM3Index * 0x400) + (addr - 0x1400)];
-        }
-        else if (addr < 0x1C00)
-        {
-            return chrROM[(chrROM4Index * 0x400) + (addr - 0x1800)];
-        }
-        else if (addr < 0x2000)
-        {
-            return chrROM[(chrROM5Index * 0x400) + (addr - 0x1C00)];
-        }
-    }
-    else
-    {
-        if (addr < 0x400)
-        {
-            return chrROM[(chrROM2Index * 0x400) + addr];
-        }
-        else if (addr < 0x800)
-        {
-            return chrROM[(chrROM3Index * 0x400) + (addr - 0x400)];
-        }
-        else if (addr < 0xC00)
-        {
-            return chrROM[(chrROM4Index * 0x400) + (addr - 0x800)];
-        }
-        else if (addr < 0x1000)
-        {
-            return chrROM[(chrROM5Index * 0x400) + (addr - 0xC00)];
-        }
-        else if (addr < 0x1800)
-        {
-            return chrROM[(chrROM0Index * 0x400) + (addr - 0x1000)];
-        }
-        else if (addr < 0x2000)
-        {
-            return chrROM[(chrROM1Index * 0x400) + (addr - 0x1800)];
-        }
-    }
-
-    if (addr >= 0x6000 && addr < 0x8000)
-    {
-        return prgRAM[addr - 0x6000];
-    }
-    else if (addr >= 0x8000)
-    {
-        // CPU Bank 0x8000-0x9FFF returns PRG-ROM bank 0 or second-to-last bank
-        if (addr < 0xA000)
-        {
-            if (prgROMBankMode == 0)
-            {
-                return prgROM[(prgROM0Index * 0x2000) + (addr - 0x8000)];
-            }
-            else
-            {
-                return prgROM[((prgBanks - 2) * 0x2000) + (addr - 0x8000)];
-            }
-        }
-        // CPU Bank 0xA000-0xBFFF returns PRG-ROM bank 1
-        else if (addr < 0xC000)
-        {
-            return prgROM[(prgROM1Index * 0x2000) + (addr - 0xA000)];
-        }
-        // CPU Bank 0xC000-0xDFFF returns second-to-last bank or PRG-ROM bank 0
-        else if (addr < 0xE000)
-        {
-            if (prgROMBankMode == 0)
-            {
-                return prgROM[((prgBanks - 2) * 0x2000) + (addr - 0xC000)];
-            }
-            else
-            {
-                return prgROM[(prgROM0Index * 0x2000) + (addr - 0xC000)];
-            }
-        }
-        // CPU Bank 0xE000-0xFFFF returns last bank
-        else
-        {
-            return prgROM[((prgBanks - 1) * 0x2000) + (addr - 0xE000)];
-        }
-    }
-
-    return 0;
-}
-
-void NESDL_Mapper_4::WriteByte(uint16_t addr, uint8_t data)
-{
-    // If we have no CHR-ROM banks, assume CHR-RAM is on-board and make
-    // this address space writable
-    if (chrBanks == 0)
-    {
-        if (chrA12Inversion == false)
-        {
-            if (addr < 0x800)
-            {
-                uint16_t a = (chrROM0Index * 0x400) + addr;
-                chrROM[a] = data;
-            }
-            else if (addr < 0x1000)
-            {
-                uint16_t a = (chrROM1Index * 0x400) + (addr - 0x800);
-                chrROM[a] = data;
-            }
-            else if (addr < 0x1400)
-            {
-                uint16_t a = (chrROM2Index * 0x400) + (addr - 0x1000);
-                chrROM[a] = data;
-            }
-            else if (addr < 0x1800)
-            {
-                uint16_t a = (chrROM3Index * 0x400) + (addr - 0x1400);
-                chrROM[a] = data;
-            }
-            else if (addr < 0x1C00)
-            {
-                uint16_t a = (chrROM4Index * 0x400) + (addr - 0x1800);
-                chrROM[a] = data;
-            }
-            else if (addr < 0x2000)
-            {
-                uint16_t a = (chrROM5Index * 0x400) + (addr - 0x1C00);
-                chrROM[a] = data;
-            }
-        }
-        else
-        {
-            if (addr < 0x400)
-            {
-                uint16_t a = (chrROM2Index * 0x400) + addr;
-                chrROM[a] = data;
-            }
-            else if (addr < 0x800)
-            {
-                uint16_t a = (chrROM3Index * 0x400) + (addr - 0x400);
-                chrROM[a] = data;
-            }
-            else if (addr < 0xC00)
-            {
-                uint16_t a = (chrROM4Index * 0x400) + (addr - 0x800);
-                chrROM[a] = data;
-            }
-            else if (addr < 0x1000)
-            {
-                uint16_t a = (chrROM5Index * 0x400) + (addr - 0xC00);
-                chrROM[a] = data;
-            }
-            else if (addr < 0x1800)
-            {
-                uint16_t a = (chrROM0Index * 0x400) + (addr - 0x1000);
-                chrROM[a] = data;
-            }
-            else if (addr < 0x2000)
-            {
-                uint16_t a = (chrROM1Index * 0x400) + (addr - 0x1800);
-                chrROM[a] = data;
-            }
-        }
-    }
-
-    // PRG-RAM (MMC3 has write protection flags but we can ignore them?)
-    // TODO investigate this and also work on CPU open bus behavior
-    if (addr >= 0x6000 && addr < 0x8000)
-    {
-        prgRAM[addr - 0x6000] = data;
-    }
     // Bank Select / Bank Data writes
     if (addr >= 0x8000 && addr <= 0x9FFF)
     {
@@ -227,6 +43,7 @@ void NESDL_Mapper_4::WriteByte(uint16_t addr, uint8_t data)
             bankRegisterMode = data & 0x07; // First 3 bits selects bank data
             prgROMBankMode = (data & 0x40) >> 6; // Bit 7 selects PRG-ROM bank mode
             chrA12Inversion = (data & 0x80) >> 7; // Bit 8 selects "CHR A12 inversion" (bank addr swaps)
+            UpdateBanks();
         }
         // Bank Data logic on odd
         else
@@ -240,6 +57,7 @@ void NESDL_Mapper_4::WriteByte(uint16_t addr, uint8_t data)
             // undocumented on nesdev but is absolutely followed in emulators (Nintendulator)
             // https://gamedev.stackexchange.com/q/200650
 
+            NESDL_TRACE_EMU_INSTANT("Bank switch", core->ppu->elapsedCycles * 4, (bankRegisterMode << 8) | data);
             switch (bankRegisterMode)
             {
                 case 0:
@@ -261,12 +79,13 @@ void NESDL_Mapper_4::WriteByte(uint16_t addr, uint8_t data)
                     chrROM5Index = data;
                     break;
                 case 6:
-                    prgROM0Index = (data & 0x3F) % prgBanks;
+                    prgROM0Index = (data & 0x3F);
                     break;
                 case 7:
-                    prgROM1Index = (data & 0x3F) % prgBanks;
+                    prgROM1Index = (data & 0x3F);
                     break;
             }
+            UpdateBanks();
         }
     }
     // NT Arrangement / PRG-RAM Protect
@@ -291,6 +110,11 @@ void NESDL_Mapper_4::WriteByte(uint16_t addr, uint8_t data)
             // Very low priority but will need to return to this eventually!
         }
     }
+    // Everything from here on changes the IRQ counter, so bring it up to date first
+    if (addr >= 0xC000)
+    {
+        SyncIRQ();
+    }
     // IRQ Latch / IRQ Reload
     if (addr >= 0xC000 && addr <= 0xDFFF)
     {
@@ -321,10 +145,76 @@ void NESDL_Mapper_4::WriteByte(uint16_t addr, uint8_t data)
             irqEnabled = true;
         }
     }
+    if (addr >= 0xC000)
+    {
+        ScheduleIRQ();
+    }
+}
+
+void NESDL_Mapper_4::SaveRegisters(NESDL_StateWriter& state)
+{
+    state.Write(prgROM0Index, "prgROM0Index");
+    state.Write(prgROM1Index, "prgROM1Index");
+    state.Write(chrROM0Index, "chrROM0Index");
+    state.Write(chrROM1Index, "chrROM1Index");
+    state.Write(chrROM2Index, "chrROM2Index");
+    state.Write(chrROM3Index, "chrROM3Index");
+    state.Write(chrROM4Index, "chrROM4Index");
+    state.Write(chrROM5Index, "chrROM5Index");
+    state.Write(bankRegisterMode, "bankRegisterMode");
+    state.Write(prgROMBankMode, "prgROMBankMode");
+    state.Write(chrA12Inversion, "chrA12Inversion");
+    state.Write(irqEnabled, "irqEnabled");
+    state.Write(irqCounter, "irqCounter");
+    state.Write(irqCounterReload, "irqCounterReload");
+    // Goes hand in hand with the PPU's mapperIRQAt (in its state), so the prediction carries on as-is
+    state.Write(irqSyncedAt, "irqSyncedAt");
+}
+
+void NESDL_Mapper_4::LoadRegisters(NESDL_StateReader& state)
+{
+    state.Read(prgROM0Index);
+    state.Read(prgROM1Index);
+    state.Read(chrROM0Index);
+    state.Read(chrROM1Index);
+    state.Read(chrROM2Index);
+    state.Read(chrROM3Index);
+    state.Read(chrROM4Index);
+    state.Read(chrROM5Index);
+    state.Read(bankRegisterMode);
+    state.Read(prgROMBankMode);
+    state.Read(chrA12Inversion);
+    state.Read(irqEnabled);
+    state.Read(irqCounter);
+    state.Read(irqCounterReload);
+    state.Read(irqSyncedAt);
+}
+
+void NESDL_Mapper_4::UpdateBanks()
+{
+    // 0x8000-0x9FFF and 0xC000-0xDFFF swap between R6 and the second-to-last bank depending on
+    // PRG-ROM bank mode. 0xA000-0xBFFF is always R7, and 0xE000-0xFFFF always the last bank
+    MapPRG(prgROMBankMode == 0 ? 0 : 2, prgROM0Index);
+    MapPRG(1, prgROM1Index);
+    MapPRG(prgROMBankMode == 0 ? 2 : 0, -2);
+    MapPRG(3, -1);
+    
+    // R0/R1 are 2KB banks and R2-R5 1KB banks. CHR A12 inversion swaps the two 4KB halves
+    uint32_t inversion = chrA12Inversion ? 4 : 0;
+    MapCHR(0 ^ inversion, chrROM0Index);
+    MapCHR(1 ^ inversion, chrROM0Index + 1);
+    MapCHR(2 ^ inversion, chrROM1Index);
+    MapCHR(3 ^ inversion, chrROM1Index + 1);
+    MapCHR(4 ^ inversion, chrROM2Index);
+    MapCHR(5 ^ inversion, chrROM3Index);
+    MapCHR(6 ^ inversion, chrROM4Index);
+    MapCHR(7 ^ inversion, chrROM5Index);
 }
 
 void NESDL_Mapper_4::ClockIRQ()
 {
+    SyncIRQ();
+    
     //printf("%d/%d|%d\n", irqCounter, irqCounterReload, irqEnabled);
     if (irqCounter == 0)
     {
@@ -341,4 +231,111 @@ void NESDL_Mapper_4::ClockIRQ()
         core->cpu->irq = true;
         core->ppu->irqFiredAt = core->ppu->elapsedCycles;
     }
+    
+    ScheduleIRQ();
+}
+
+// The counter gets clocked once per line (on the visible lines and the pre-render line), at the dot
+// PPU address line A12 goes from 0 to 1 - which depends on which pattern table BG and sprites use.
+// Those lines/dots never move, so the number of clocks between two PPU cycles can just be counted,
+// with PPU cycles turned into "dots since the start of some frame" by GetIRQClockBase
+#define MMC3_IRQ_CLOCKS_PER_FRAME   241
+#define MMC3_IRQ_DOTS_PER_FRAME     (PPU_DOTS_PER_LINE * PPU_LINES_PER_FRAME)
+
+uint16_t NESDL_Mapper_4::GetIRQClockDot()
+{
+    uint8_t ctrl = core->ppu->registers.ctrl;
+    if ((ctrl & PPUCTRL_BGTILE) && !(ctrl & PPUCTRL_SPRTILE))
+    {
+        // BG=0x1000 (& Spr = 0x0000), next line's BG fetches raise A12 at PPU=324
+        return 324;
+    }
+    if (!(ctrl & PPUCTRL_BGTILE) && (ctrl & PPUCTRL_SPRTILE))
+    {
+        // BG=0x0000 (& Spr = 0x1000), sprite fetches raise A12 at PPU=260
+        return 260;
+    }
+    // Both on the same pattern table - A12 never toggles, so no clocks at all
+    return 0;
+}
+
+uint64_t NESDL_Mapper_4::GetIRQClockBase(uint64_t now)
+{
+    // What to add to a PPU cycle to get its dot count from the start of a frame
+    NESDL_PPU* ppu = core->ppu;
+    uint64_t dotInFrame = (uint64_t)ppu->currentScanline * PPU_DOTS_PER_LINE + ppu->currentScanlineCycle;
+    return (dotInFrame + MMC3_IRQ_DOTS_PER_FRAME - now % MMC3_IRQ_DOTS_PER_FRAME) % MMC3_IRQ_DOTS_PER_FRAME;
+}
+
+// Clocks from the start of frame 0 up to and including this dot
+static uint64_t CountIRQClocks(uint64_t dot, uint16_t clockDot)
+{
+    uint64_t frame = dot / MMC3_IRQ_DOTS_PER_FRAME;
+    uint32_t line = (uint32_t)(dot % MMC3_IRQ_DOTS_PER_FRAME) / PPU_DOTS_PER_LINE;
+    uint32_t lineDot = (uint32_t)(dot % MMC3_IRQ_DOTS_PER_FRAME) % PPU_DOTS_PER_LINE;
+    uint64_t clocks = frame * MMC3_IRQ_CLOCKS_PER_FRAME + min(line, 240u);
+    if ((line < 240 || line == PPU_LINES_PER_FRAME - 1) && lineDot >= clockDot)
+    {
+        clocks++;
+    }
+    return clocks;
+}
+
+void NESDL_Mapper_4::SyncIRQ()
+{
+    uint64_t now = core->ppu->elapsedCycles;
+    uint16_t clockDot = GetIRQClockDot();
+    if (clockDot != 0 && now > irqSyncedAt)
+    {
+        uint64_t base = GetIRQClockBase(now);
+        uint64_t clocks = CountIRQClocks(now + base, clockDot) - CountIRQClocks(irqSyncedAt + base, clockDot);
+        
+        // Same as calling ClockIRQ that many times (minus the IRQ, which is RunPredictedIRQ's job) -
+        // count down to 0, then it's a reload and a count down again every irqCounterReload + 1 clocks
+        if (clocks <= irqCounter)
+        {
+            irqCounter -= clocks;
+        }
+        else
+        {
+            irqCounter = irqCounterReload - (clocks - irqCounter - 1) % ((uint64_t)irqCounterReload + 1);
+        }
+    }
+    irqSyncedAt = now;
+}
+
+void NESDL_Mapper_4::ScheduleIRQ()
+{
+    // Needs the counter synced up to now
+    uint16_t clockDot = GetIRQClockDot();
+    if (!irqEnabled || clockDot == 0)
+    {
+        core->ppu->mapperIRQAt = UINT64_MAX;
+        return;
+    }
+    
+    // A counter at 0 reloads on the next clock instead of firing, then counts back down
+    uint64_t now = core->ppu->elapsedCycles;
+    uint64_t base = GetIRQClockBase(now);
+    uint64_t clocksUntilIRQ = irqCounter > 0 ? irqCounter : (uint64_t)irqCounterReload + 1;
+    uint64_t clock = CountIRQClocks(now + base, clockDot) + clocksUntilIRQ - 1; // Counted from 0
+    uint64_t clockInFrame = clock % MMC3_IRQ_CLOCKS_PER_FRAME;
+    uint64_t line = clockInFrame < 240 ? clockInFrame : PPU_LINES_PER_FRAME - 1;
+    uint64_t dot = (clock / MMC3_IRQ_CLOCKS_PER_FRAME) * MMC3_IRQ_DOTS_PER_FRAME + line * PPU_DOTS_PER_LINE + clockDot;
+    core->ppu->mapperIRQAt = dot - base;
+}
+
+void NESDL_Mapper_4::RunPredictedIRQ()
+{
+    SyncIRQ();
+    //printf("IRQ Trigger\n");
+    core->cpu->irq = true;
+    core->ppu->irqFiredAt = core->ppu->elapsedCycles;
+    ScheduleIRQ();
+}
+
+void NESDL_Mapper_4::RestartIRQTiming()
+{
+    irqSyncedAt = core->ppu->elapsedCycles;
+    ScheduleIRQ();
 }
@@ -0,0 +1,16 @@
+#include "NESDL.h"
+
+void NESDL_Mapper_7::ResetBanks()
+{
+    MapPRG(0, 0);
+    MapCHR(0, 0);
+    mirroringMode = MirroringMode::One_LowerBank;
+}
+
+void NESDL_Mapper_7::WriteRegister(uint16_t /*addr*/, uint8_t data)
+{
+    // Bits 0-2 select the 32KB PRG bank, bit 4 the nametable shown on every screen
+    NESDL_TRACE_EMU_INSTANT("Bank switch", core->ppu->elapsedCycles * 4, data);
+    MapPRG(0, data & 0x07);
+    mirroringMode = (data & 0x10) == 0 ? MirroringMode::One_LowerBank : MirroringMode::One_UpperBank;
+}
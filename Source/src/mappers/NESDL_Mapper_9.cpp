@@ -1,26 +1,30 @@
 #include "NESDL.h"
 
-void NESDL_Mapper_9::InitROMData(uint8_t* prgROMData, uint8_t prgROMBanks, uint8_t* chrROMData, uint8_t chrROMBanks)
+void NESDL_Mapper_9::InitROMData(const uint8_t* prgROMData, uint8_t prgROMBanks, const uint8_t* chrROMData, uint8_t chrROMBanks)
 {
     prgBanks = prgROMBanks * 2; // iNES is PRG-ROM in 16KB blocks, MMC2 works in 8KB
     chrBanks = chrROMBanks;
     
-    // Init PRG-ROM data
-    if (prgBanks > 0)
-    {
-        prgROM = new uint8_t[prgBanks * 0x2000];
-        memcpy(prgROM, prgROMData, prgBanks * 0x2000);
-    }
+    // PRG-ROM (and CHR-ROM, if any) are used in place, straight out of the ROM file
+    prgROM = prgROMData;
     
     // Init CHR-ROM data
     if (chrBanks > 0)
     {
-        chrROM = new uint8_t[chrBanks * 0x2000];
-        memcpy(chrROM, chrROMData, chrBanks * 0x2000);
+        chrROM = chrROMData;
     }
     
     // Vertical by default
     mirroringMode = MirroringMode::Vertical;
+
+    // Everything starts out at bank 0. Neither latch is set until the PPU first fetches tile 0xFD/0xFE
+    prgROMIndex = 0;
+    chrROM0Index0 = 0;
+    chrROM0Index1 = 0;
+    chrROM1Index0 = 0;
+    chrROM1Index1 = 0;
+    chrROM0Latch = 0;
+    chrROM1Latch = 0;
 }
 
 uint8_t NESDL_Mapper_9::ReadByte(uint16_t addr)
@@ -97,6 +101,44 @@ uint8_t NESDL_Mapper_9::ReadByte(uint16_t addr)
     return 0;
 }
 
+int32_t NESDL_Mapper_9::GetPRGROMOffset(uint16_t addr)
+{
+    if (addr < 0x8000)
+    {
+        return -1;
+    }
+    else if (addr < 0xA000)
+    {
+        return prgROMIndex * 0x2000 + (addr - 0x8000);
+    }
+    uint8_t bankIndex = ((addr / 0x2000) - 5) + (prgBanks - 3);
+    return bankIndex * 0x2000 + (addr % 0x2000);
+}
+
+void NESDL_Mapper_9::SaveState(NESDL_StateWriter& state)
+{
+    NESDL_Mapper::SaveState(state);
+    state.Write(prgROMIndex, "prgROMIndex");
+    state.Write(chrROM0Index0, "chrROM0Index0");
+    state.Write(chrROM0Index1, "chrROM0Index1");
+    state.Write(chrROM1Index0, "chrROM1Index0");
+    state.Write(chrROM1Index1, "chrROM1Index1");
+    state.Write(chrROM0Latch, "chrROM0Latch");
+    state.Write(chrROM1Latch, "chrROM1Latch");
+}
+
+void NESDL_Mapper_9::LoadState(NESDL_StateReader& state)
+{
+    NESDL_Mapper::LoadState(state);
+    state.Read(prgROMIndex);
+    state.Read(chrROM0Index0);
+    state.Read(chrROM0Index1);
+    state.Read(chrROM1Index0);
+    state.Read(chrROM1Index1);
+    state.Read(chrROM0Latch);
+    state.Read(chrROM1Latch);
+}
+
 void NESDL_Mapper_9::WriteByte(uint16_t addr, uint8_t data)
 {
     if (core->cpu->ignoreChanges)
@@ -104,10 +146,15 @@ void NESDL_Mapper_9::WriteByte(uint16_t addr, uint8_t data)
         return;
     }
     
+    if (addr >= 0xA000 && addr < 0xF000)
+    {
+        NESDL_TRACE_EMU_INSTANT("Bank switch", core->ppu->elapsedCycles * 4, (addr & 0xF000) | data);
+    }
+    
     if (addr >= 0x6000 && addr < 0x8000)
     {
         // PRG-RAM
-        prgRAM[addr - 0x6000] = data;
+        WritePRGRAM(addr - 0x6000, data);
     }
     else if (addr >= 0x8000 && addr < 0xA000)
     {
@@ -0,0 +1,210 @@
+// NESDL_TraceTool - offline companion to the binary CPU trace (Debug > Start CPU Trace...)
+//
+//   diff <a.nestrace> <b.nestrace>          Find the first record where two traces diverge
+//   dump <file.nestrace> [start] [count]    Print records as Nintendulator-style text
+//
+// Standalone - doesn't link against the emulator. Build with e.g.:
+//   g++ -std=c++20 -O2 -I../include NESDL_TraceTool.cpp -o nesdl_tracetool
+//   cl /std:c++20 /O2 /EHsc /I..\include NESDL_TraceTool.cpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NESDL_TRACETOOL_SSE2
+#endif
+
+#define NESDL_CPUTRACE_FORMAT_ONLY
+#include "NESDL_CPUTrace.h"
+
+// Records read per chunk when diffing (1M records = 32MB per file)
+#define TRACETOOL_CHUNK 0x100000
+
+static FILE* OpenTrace(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Couldn't open %s\n", path);
+        return NULL;
+    }
+    CPUTraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, NESDL_CPUTRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s isn't a NESDL CPU trace\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if (header.version != NESDL_CPUTRACE_VERSION || header.recordSize != sizeof(CPUTraceRecord))
+    {
+        fprintf(stderr, "%s is trace version %u (%u byte records), expected version %u (%u byte records)\n",
+                path, header.version, header.recordSize, NESDL_CPUTRACE_VERSION, (uint32_t)sizeof(CPUTraceRecord));
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+// Index of the first record in a/b that differs, or count if they're all equal.
+// Records are 32 bytes, so each one is two 16 byte compares
+static size_t FindFirstMismatch(const CPUTraceRecord* a, const CPUTraceRecord* b, size_t count)
+{
+#ifdef NESDL_TRACETOOL_SSE2
+    const __m128i* va = (const __m128i*)a;
+    const __m128i* vb = (const __m128i*)b;
+    for (size_t i = 0; i < count; ++i)
+    {
+        __m128i lo = _mm_cmpeq_epi8(_mm_loadu_si128(va + i * 2), _mm_loadu_si128(vb + i * 2));
+        __m128i hi = _mm_cmpeq_epi8(_mm_loadu_si128(va + i * 2 + 1), _mm_loadu_si128(vb + i * 2 + 1));
+        if (_mm_movemask_epi8(_mm_and_si128(lo, hi)) != 0xFFFF)
+        {
+            return i;
+        }
+    }
+    return count;
+#else
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (memcmp(a + i, b + i, sizeof(CPUTraceRecord)) != 0)
+        {
+            return i;
+        }
+    }
+    return count;
+#endif
+}
+
+static void PrintRecord(const CPUTraceRecord& r)
+{
+    // Instruction bytes are always the 3 bytes at PC - without a disassembler we don't know the
+    // opcode's length, so all three are printed
+    printf("%04X  %02X %02X %02X  A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu\n",
+           r.pc, r.opcode, r.param0, r.param1, r.a, r.x, r.y, r.p, r.sp,
+           r.ppuScanline, r.ppuDot, (unsigned long long)r.cpuCycle);
+}
+
+static void PrintFieldDifferences(const CPUTraceRecord& a, const CPUTraceRecord& b)
+{
+#define TRACETOOL_FIELD(name) \
+    if (a.name != b.name) \
+    { \
+        printf("  %-12s %llX vs %llX\n", #name, (unsigned long long)a.name, (unsigned long long)b.name); \
+    }
+    TRACETOOL_FIELD(masterCycle);
+    TRACETOOL_FIELD(cpuCycle);
+    TRACETOOL_FIELD(pc);
+    TRACETOOL_FIELD(ppuScanline);
+    TRACETOOL_FIELD(ppuDot);
+    TRACETOOL_FIELD(opcode);
+    TRACETOOL_FIELD(param0);
+    TRACETOOL_FIELD(param1);
+    TRACETOOL_FIELD(a);
+    TRACETOOL_FIELD(x);
+    TRACETOOL_FIELD(y);
+    TRACETOOL_FIELD(p);
+    TRACETOOL_FIELD(sp);
+#undef TRACETOOL_FIELD
+}
+
+static int Diff(const char* pathA, const char* pathB)
+{
+    FILE* fileA = OpenTrace(pathA);
+    FILE* fileB = OpenTrace(pathB);
+    if (fileA == NULL || fileB == NULL)
+    {
+        if (fileA) fclose(fileA);
+        if (fileB) fclose(fileB);
+        return 2;
+    }
+
+    std::unique_ptr<CPUTraceRecord[]> chunkA(new CPUTraceRecord[TRACETOOL_CHUNK]);
+    std::unique_ptr<CPUTraceRecord[]> chunkB(new CPUTraceRecord[TRACETOOL_CHUNK]);
+    uint64_t recordIndex = 0;
+    int result = 0;
+    while (true)
+    {
+        size_t countA = fread(chunkA.get(), sizeof(CPUTraceRecord), TRACETOOL_CHUNK, fileA);
+        size_t countB = fread(chunkB.get(), sizeof(CPUTraceRecord), TRACETOOL_CHUNK, fileB);
+        size_t count = countA < countB ? countA : countB;
+        size_t mismatch = FindFirstMismatch(chunkA.get(), chunkB.get(), count);
+        if (mismatch < count)
+        {
+            const CPUTraceRecord& a = chunkA[mismatch];
+            const CPUTraceRecord& b = chunkB[mismatch];
+            printf("Traces diverge at record %llu\n", (unsigned long long)(recordIndex + mismatch));
+            if (mismatch > 0)
+            {
+                printf("Last matching:\n  ");
+                PrintRecord(chunkA[mismatch - 1]);
+            }
+            printf("%s:\n  ", pathA);
+            PrintRecord(a);
+            printf("%s:\n  ", pathB);
+            PrintRecord(b);
+            printf("Differing fields:\n");
+            PrintFieldDifferences(a, b);
+            result = 1;
+            break;
+        }
+        recordIndex += count;
+        if (countA != countB)
+        {
+            printf("Traces match for %llu records, then %s ends\n",
+                   (unsigned long long)recordIndex, countA < countB ? pathA : pathB);
+            result = 1;
+            break;
+        }
+        if (count < TRACETOOL_CHUNK)
+        {
+            printf("Traces are identical (%llu records)\n", (unsigned long long)recordIndex);
+            break;
+        }
+    }
+    fclose(fileA);
+    fclose(fileB);
+    return result;
+}
+
+static int Dump(const char* path, uint64_t start, uint64_t count)
+{
+    FILE* file = OpenTrace(path);
+    if (file == NULL)
+    {
+        return 2;
+    }
+    // Records are fixed-size, so any index can be seeked to directly
+#ifdef _WIN32
+    _fseeki64(file, (int64_t)(sizeof(CPUTraceFileHeader) + start * sizeof(CPUTraceRecord)), SEEK_SET);
+#else
+    fseeko(file, (off_t)(sizeof(CPUTraceFileHeader) + start * sizeof(CPUTraceRecord)), SEEK_SET);
+#endif
+    CPUTraceRecord record;
+    for (uint64_t i = 0; i < count && fread(&record, sizeof(record), 1, file) == 1; ++i)
+    {
+        PrintRecord(record);
+    }
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 4 && strcmp(argv[1], "diff") == 0)
+    {
+        return Diff(argv[2], argv[3]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "dump") == 0)
+    {
+        uint64_t start = argc >= 4 ? strtoull(argv[3], NULL, 10) : 0;
+        uint64_t count = argc >= 5 ? strtoull(argv[4], NULL, 10) : UINT64_MAX;
+        return Dump(argv[2], start, count);
+    }
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  %s diff <a.nestrace> <b.nestrace>\n", argv[0]);
+    fprintf(stderr, "  %s dump <file.nestrace> [start] [count]\n", argv[0]);
+    return 2;
+}